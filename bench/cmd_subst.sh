@@ -0,0 +1,22 @@
+#!/bin/sh
+# Measure command substitution capture throughput.
+# Usage: bench/cmd_subst.sh [path-to-vush]
+VUSH=${1:-$(dirname "$0")/../build/vush}
+
+run() {
+    size=$1
+    script="x=\$(head -c $size /dev/zero | tr '\\0' a); echo \${#x}"
+    start=$(date +%s%N)
+    len=$("$VUSH" -c "$script")
+    end=$(date +%s%N)
+    ns=$((end - start))
+    if [ "$len" != "$size" ]; then
+        echo "capture of $size bytes returned $len bytes" >&2
+        exit 1
+    fi
+    mb=$((size / 1048576))
+    echo "$mb MB: $((ns / 1000000)) ms, $((size * 1000000000 / 1048576 / ns)) MB/s"
+}
+
+run 1048576
+run 104857600
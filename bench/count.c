@@ -0,0 +1,112 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Allocation and process counters for the benchmark harness.
+ */
+
+/*
+ * Preloaded into the shell by vush-bench.  Every malloc(), calloc() and
+ * realloc() call and every fork() or posix_spawn() is counted in a shared
+ * page, so work done in subshells is included.  LD_PRELOAD is removed from
+ * the environment at load time so the commands the shell runs are not
+ * counted.  When the shell exits the totals are written to the file named
+ * by VUSH_BENCH_COUNTS as "allocs forks".
+ *
+ * The allocator hooks rely on the __libc_* entry points of glibc.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+struct counts {
+    unsigned long allocs;
+    unsigned long forks;
+};
+
+static struct counts *counts;
+static pid_t owner;
+
+#define COUNT(field) \
+    do { \
+        if (counts) \
+            __atomic_add_fetch(&counts->field, 1, __ATOMIC_RELAXED); \
+    } while (0)
+
+__attribute__((constructor)) static void count_init(void) {
+    void *p = mmap(NULL, sizeof(*counts), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return;
+    owner = getpid();
+    unsetenv("LD_PRELOAD");
+    counts = p;
+}
+
+__attribute__((destructor)) static void count_report(void) {
+    const char *path = getenv("VUSH_BENCH_COUNTS");
+    if (!counts || !path || getpid() != owner)
+        return;
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return;
+    fprintf(f, "%lu %lu\n", counts->allocs, counts->forks);
+    fclose(f);
+}
+
+void *malloc(size_t n) {
+    COUNT(allocs);
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size) {
+    COUNT(allocs);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n) {
+    COUNT(allocs);
+    return __libc_realloc(p, n);
+}
+
+pid_t fork(void) {
+    static pid_t (*real)(void);
+    if (!real)
+        real = (pid_t (*)(void))dlsym(RTLD_NEXT, "fork");
+    COUNT(forks);
+    return real();
+}
+
+typedef int (*spawn_fn)(pid_t *, const char *,
+                        const posix_spawn_file_actions_t *,
+                        const posix_spawnattr_t *, char *const[],
+                        char *const[]);
+
+int posix_spawn(pid_t *pid, const char *path,
+                const posix_spawn_file_actions_t *fa,
+                const posix_spawnattr_t *attr, char *const argv[],
+                char *const envp[]) {
+    static spawn_fn real;
+    if (!real)
+        real = (spawn_fn)dlsym(RTLD_NEXT, "posix_spawn");
+    COUNT(forks);
+    return real(pid, path, fa, attr, argv, envp);
+}
+
+int posix_spawnp(pid_t *pid, const char *file,
+                 const posix_spawn_file_actions_t *fa,
+                 const posix_spawnattr_t *attr, char *const argv[],
+                 char *const envp[]) {
+    static spawn_fn real;
+    if (!real)
+        real = (spawn_fn)dlsym(RTLD_NEXT, "posix_spawnp");
+    COUNT(forks);
+    return real(pid, file, fa, attr, argv, envp);
+}
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Measure pathname expansion on a large tree.  The tree holds FILES files
+# (default 1000000) spread over directories of 1000 entries each and is
+# created once under ${TMPDIR:-/tmp}.  Each VUSH binary given expands
+# several patterns over one directory and a pattern spanning the whole
+# tree; pass a build from before the native glob engine to compare with
+# glob(3).
+# Usage: [FILES=n] bench/glob.sh [path-to-vush...]
+[ $# -eq 0 ] && set -- "$(dirname "$0")/../build/vush"
+FILES=${FILES:-1000000}
+DIRS=$(((FILES + 999) / 1000))
+TREE=${TMPDIR:-/tmp}/vush-glob-bench-$FILES
+
+if [ ! -d "$TREE" ]; then
+    echo "creating $FILES files under $TREE"
+    mkdir -p "$TREE" || exit 1
+    d=0
+    while [ $d -lt $DIRS ]; do
+        mkdir -p "$TREE/d$d"
+        (cd "$TREE/d$d" && seq -f 'f%g.log' 0 999 | xargs touch &&
+            touch a1.log b1.log c1.txt) || exit 1
+        d=$((d + 1))
+    done
+fi
+
+run() {
+    vush=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+    name=$2
+    script=$3
+    start=$(date +%s%N)
+    (cd "$TREE" && "$vush" -c "$script" </dev/null) || exit 1
+    end=$(date +%s%N)
+    echo "$vush: $name: $(((end - start) / 1000000)) ms"
+}
+
+for vush in "$@"; do
+    run "$vush" "3 patterns, 1 dir" \
+        'i=0; while test $i -lt 200; do : d0/a*.log d0/b*.log d0/c*.txt; i=$((i + 1)); done; :'
+    run "$vush" "whole tree" ': */f1*.log */a*.log'
+    if "$vush" -c 'set -o' </dev/null | grep -q globstar; then
+        run "$vush" "globstar" 'set -o globstar; : **/c*.txt'
+    fi
+done
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Measure external command launch latency as the shell's memory grows.
+# Each VUSH binary given is run with 0, 16 and 64 MB held in a shell
+# variable before launching /bin/true in a loop.
+# Usage: bench/spawn.sh [path-to-vush...]
+[ $# -eq 0 ] && set -- "$(dirname "$0")/../build/vush"
+N=500
+
+run() {
+    vush=$1
+    mb=$2
+    script="x=\$(head -c $((mb * 1048576)) /dev/zero | tr '\\0' a); i=0; while test \$i -lt $N; do /bin/true; i=\$((i + 1)); done; :"
+    start=$(date +%s%N)
+    "$vush" -c "$script" || exit 1
+    end=$(date +%s%N)
+    echo "$vush: $mb MB: $(((end - start) / N / 1000)) us/command"
+}
+
+for vush in "$@"; do
+    for mb in 0 16 64; do
+        run "$vush" $mb
+    done
+done
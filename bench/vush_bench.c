@@ -0,0 +1,351 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Microbenchmark harness.
+ */
+
+/*
+ * Each benchmark runs a short shell loop twice, once with its iteration
+ * count and once with none, and reports the difference divided by the
+ * count, so startup and setup cost drop out.  Benchmarks marked per
+ * process instead start the shell once per operation.  The shell is run
+ * with count.so preloaded to count allocations and forks; see count.c.
+ *
+ * Times depend on the machine and are only reported next to the baseline.
+ * Allocation and fork counts are deterministic, so a benchmark whose
+ * counts grow past the baseline makes the harness exit with status 1.
+ *
+ * Usage: vush-bench -s shell -p count.so [-b baseline] [-w out] [name...]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* timed runs of every benchmark; the fastest one counts */
+#define REPEATS 3
+/* allowed growth of allocs/op and forks/op before it counts as a regression */
+#define COUNT_SLACK 0.05
+#define COUNT_MIN_SLACK 0.5
+/* files created for the glob benchmark and lines in the history file */
+#define GLOB_FILES 300
+#define HISTORY_LINES 5000
+
+typedef struct {
+    const char *name;
+    const char *setup;      /* run once before the loop */
+    const char *body;       /* one operation */
+    int iters;
+    int per_process;        /* start the shell once per operation */
+} Bench;
+
+static const Bench benches[] = {
+    {"loop", "", ":", 20000, 0},
+    {"function", "f() { :; }", "f", 20000, 0},
+    {"arith", "", "x=$(( (i * 3 + 7) % 5 ))", 20000, 0},
+    {"param", "v=/usr/local/lib/libvush.so.1",
+     "a=${v##*/}; b=${v%.*}; c=${v#/usr}; d=${v/lib/LIB}", 10000, 0},
+    {"split", "v='a b c d e f g h i j k l m n o p'", "set -- $v", 10000, 0},
+    {"glob", "cd \"$BENCH_DIR/glob\"", "set -- *.txt", 1000, 0},
+    {"cmdsubst", "", "x=$(echo hi)", 500, 0},
+    {"pipeline", "", "echo hi | cat >/dev/null", 300, 0},
+    {"startup", NULL, ":", 100, 1},
+    {"history", NULL, ":", 50, 1},
+};
+
+#define NBENCH (sizeof(benches) / sizeof(benches[0]))
+
+typedef struct {
+    double ns;
+    double allocs;
+    double forks;
+} Result;
+
+typedef struct {
+    char name[64];
+    Result r;
+} BaselineEntry;
+
+static const char *shell;
+static const char *preload;
+static char dir[] = "/tmp/vush-bench-XXXXXX";
+static char counts_path[4096];
+static char history_path[4096];
+/* other benchmarks keep no history between runs */
+static const char empty_history_path[] = "/dev/null";
+
+static void die(const char *what) {
+    perror(what);
+    exit(2);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void write_file(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (!f)
+        die(path);
+    fputs(text, f);
+    fclose(f);
+}
+
+/* Create the history file.  Every run of the history benchmark appends
+ * its command to it, as a shell in normal use would. */
+static void write_history(void) {
+    FILE *f = fopen(history_path, "w");
+    if (!f)
+        die(history_path);
+    for (int i = 0; i < HISTORY_LINES; i++)
+        fprintf(f, "echo history line %d | grep -v nothing\n", i);
+    fclose(f);
+}
+
+/* Create the glob directory under DIR and name the other fixture files. */
+static void make_fixtures(void) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/glob", dir);
+    if (mkdir(path, 0700) != 0)
+        die(path);
+    for (int i = 0; i < GLOB_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/glob/file%d.%s", dir, i,
+                 i % 3 ? "txt" : "log");
+        write_file(path, "");
+    }
+    snprintf(history_path, sizeof(history_path), "%s/history", dir);
+    write_history();
+    snprintf(counts_path, sizeof(counts_path), "%s/counts", dir);
+}
+
+/* Run SCRIPT in the shell and add its counts to *RES.  Returns the wall
+ * time in nanoseconds. */
+static double run_shell(const char *script, const char *histfile,
+                        Result *res) {
+    unlink(counts_path);
+    double start = now_ns();
+    pid_t pid = fork();
+    if (pid < 0)
+        die("fork");
+    if (pid == 0) {
+        int fd = open("/dev/null", O_RDWR);
+        if (fd >= 0) {
+            dup2(fd, 0);
+            dup2(fd, 1);
+        }
+        setenv("HOME", dir, 1);
+        setenv("BENCH_DIR", dir, 1);
+        setenv("VUSH_HISTFILE", histfile, 1);
+        setenv("VUSH_HISTSIZE", "100000", 1);
+        setenv("VUSH_BENCH_COUNTS", counts_path, 1);
+        setenv("LD_PRELOAD", preload, 1);
+        execl(shell, shell, "-c", script, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR)
+            die("waitpid");
+    double elapsed = now_ns() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "vush-bench: shell failed running: %s\n", script);
+        exit(2);
+    }
+    unsigned long allocs = 0, forks = 0;
+    FILE *f = fopen(counts_path, "r");
+    if (!f || fscanf(f, "%lu %lu", &allocs, &forks) != 2) {
+        fprintf(stderr, "vush-bench: no counts from %s (is %s loadable?)\n",
+                shell, preload);
+        exit(2);
+    }
+    fclose(f);
+    res->allocs += allocs;
+    res->forks += forks;
+    return elapsed;
+}
+
+/* Return the fastest of REPEATS runs of SCRIPT with its counts. */
+static Result best_of(const char *script, const char *histfile) {
+    Result best = {0, 0, 0};
+    for (int i = 0; i < REPEATS; i++) {
+        Result r = {0, 0, 0};
+        r.ns = run_shell(script, histfile, &r);
+        if (i == 0 || r.ns < best.ns)
+            best = r;
+    }
+    return best;
+}
+
+static Result run_bench(const Bench *b) {
+    Result res = {0, 0, 0};
+    if (b->per_process) {
+        const char *hist = strcmp(b->name, "history") == 0 ?
+                           history_path : empty_history_path;
+        Result one = best_of(b->body, hist);
+        double total = one.ns;
+        for (int i = 1; i < b->iters; i++) {
+            Result r = {0, 0, 0};
+            total += run_shell(b->body, hist, &r);
+        }
+        res.ns = total / b->iters;
+        res.allocs = one.allocs;
+        res.forks = one.forks;
+        return res;
+    }
+    char script[1024];
+    const char *sep = *b->setup ? "; " : "";
+    snprintf(script, sizeof(script),
+             "%s%si=0; while test $i -lt %d; do %s; i=$((i + 1)); done; :",
+             b->setup, sep, b->iters, b->body);
+    Result full = best_of(script, empty_history_path);
+    snprintf(script, sizeof(script),
+             "%s%si=0; while test $i -lt 0; do %s; i=$((i + 1)); done; :",
+             b->setup, sep, b->body);
+    Result empty = best_of(script, empty_history_path);
+    res.ns = (full.ns - empty.ns) / b->iters;
+    res.allocs = (full.allocs - empty.allocs) / b->iters;
+    res.forks = (full.forks - empty.forks) / b->iters;
+    if (res.ns < 0)
+        res.ns = 0;
+    return res;
+}
+
+static int load_baseline(const char *path, BaselineEntry *out, int max) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        if (errno == ENOENT)
+            return 0;
+        die(path);
+    }
+    char line[256];
+    int n = 0;
+    while (n < max && fgets(line, sizeof(line), f)) {
+        if (line[0] == '#')
+            continue;
+        BaselineEntry *e = &out[n];
+        if (sscanf(line, "%63s %lf %lf %lf", e->name, &e->r.ns, &e->r.allocs,
+                   &e->r.forks) == 4)
+            n++;
+    }
+    fclose(f);
+    return n;
+}
+
+static const Result *find_baseline(const BaselineEntry *base, int n,
+                                   const char *name) {
+    for (int i = 0; i < n; i++)
+        if (strcmp(base[i].name, name) == 0)
+            return &base[i].r;
+    return NULL;
+}
+
+static int count_regressed(double now, double before) {
+    double slack = before * COUNT_SLACK;
+    if (slack < COUNT_MIN_SLACK)
+        slack = COUNT_MIN_SLACK;
+    return now > before + slack;
+}
+
+static void remove_fixtures(void) {
+    char cmd[4200];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd) != 0)
+        fprintf(stderr, "vush-bench: could not remove %s\n", dir);
+}
+
+static int selected(const char *name, char **names, int nnames) {
+    if (nnames == 0)
+        return 1;
+    for (int i = 0; i < nnames; i++)
+        if (strcmp(names[i], name) == 0)
+            return 1;
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: vush-bench -s shell -p count.so [-b baseline] "
+                    "[-w out] [name...]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *baseline = NULL;
+    const char *outpath = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:b:w:")) != -1) {
+        switch (opt) {
+        case 's': shell = optarg; break;
+        case 'p': preload = optarg; break;
+        case 'b': baseline = optarg; break;
+        case 'w': outpath = optarg; break;
+        default: usage();
+        }
+    }
+    if (!shell || !preload)
+        usage();
+    /* the preload path must survive the shell changing directory */
+    static char abs_preload[4096];
+    if (!realpath(preload, abs_preload))
+        die(preload);
+    preload = abs_preload;
+
+    BaselineEntry base[NBENCH * 2];
+    int nbase = baseline ? load_baseline(baseline, base, NBENCH * 2) : 0;
+
+    if (!mkdtemp(dir))
+        die("mkdtemp");
+    make_fixtures();
+
+    FILE *out = NULL;
+    if (outpath) {
+        out = fopen(outpath, "w");
+        if (!out)
+            die(outpath);
+        fprintf(out, "# name ns/op allocs/op forks/op\n");
+    }
+
+    printf("%-10s %12s %10s %9s   %s\n", "benchmark", "ns/op", "allocs/op",
+           "forks/op", "vs baseline");
+    int regressions = 0;
+    for (size_t i = 0; i < NBENCH; i++) {
+        const Bench *b = &benches[i];
+        if (!selected(b->name, argv + optind, argc - optind))
+            continue;
+        Result r = run_bench(b);
+        printf("%-10s %12.0f %10.2f %9.2f", b->name, r.ns, r.allocs,
+               r.forks);
+        const Result *old = find_baseline(base, nbase, b->name);
+        if (old) {
+            double dt = old->ns > 0 ? (r.ns - old->ns) * 100 / old->ns : 0;
+            printf("   time %+.0f%% allocs %+.2f forks %+.2f", dt,
+                   r.allocs - old->allocs, r.forks - old->forks);
+            if (count_regressed(r.allocs, old->allocs) ||
+                count_regressed(r.forks, old->forks)) {
+                printf("  REGRESSION");
+                regressions++;
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+        if (out)
+            fprintf(out, "%s %.0f %.2f %.2f\n", b->name, r.ns, r.allocs,
+                    r.forks);
+    }
+    if (out)
+        fclose(out);
+    remove_fixtures();
+    if (regressions) {
+        printf("%d benchmark%s allocate or fork more than the baseline\n",
+               regressions, regressions == 1 ? "" : "s");
+        return 1;
+    }
+    return 0;
+}
@@ -10,50 +10,43 @@
 #define _GNU_SOURCE
 #include "alias_expand.h"
 #include "builtins.h"
+#include "strarray.h"
 #include <string.h>
 #include <stdlib.h>
 
 #define MAX_ALIAS_DEPTH 10
 
+/* Append a copy of WORD to OUT.  Returns 0 on success or -1 on failure. */
+static int push_word(StrArray *out, const char *word) {
+    char *cp = strdup(word);
+    if (!cp || strarray_push(out, cp) == -1) {
+        free(cp);
+        return -1;
+    }
+    return 0;
+}
+
 /*
  * Recursively collect the tokens produced by expanding the alias NAME.
- * Results are appended to OUT and COUNT is updated. The VISITED array
- * tracks aliases already expanded to avoid infinite recursion.
+ * Results are appended to OUT. The VISITED array tracks aliases already
+ * expanded to avoid infinite recursion.
  * Returns 0 on success or -1 on allocation failure.
  */
-static int collect_alias_tokens(const char *name, char **out, int *count,
+static int collect_alias_tokens(const char *name, StrArray *out,
                                 char visited[][MAX_LINE], int depth) {
-    if (*count >= MAX_TOKENS - 1)
-        return 0;
+    int start = out->count;
 
-    int start = *count;
-
-    if (depth >= MAX_ALIAS_DEPTH) {
-        char *cp = strdup(name);
-        if (!cp)
-            return -1;
-        out[(*count)++] = cp;
-        return 0;
-    }
+    if (depth >= MAX_ALIAS_DEPTH)
+        return push_word(out, name);
 
     for (int i = 0; i < depth; i++) {
-        if (strcmp(visited[i], name) == 0) {
-            char *cp = strdup(name);
-            if (!cp)
-                return -1;
-            out[(*count)++] = cp;
-            return 0;
-        }
+        if (strcmp(visited[i], name) == 0)
+            return push_word(out, name);
     }
 
     const char *alias = get_alias(name);
-    if (!alias) {
-        char *cp = strdup(name);
-        if (!cp)
-            return -1;
-        out[(*count)++] = cp;
-        return 0;
-    }
+    if (!alias)
+        return push_word(out, name);
 
     strncpy(visited[depth], name, MAX_LINE);
     visited[depth][MAX_LINE - 1] = '\0';
@@ -69,19 +62,17 @@ static int collect_alias_tokens(const char *name, char **out, int *count,
         return 0;
     }
 
-    if (collect_alias_tokens(word, out, count, visited, depth + 1) == -1) {
+    if (collect_alias_tokens(word, out, visited, depth + 1) == -1) {
         free(dup);
         goto error;
     }
 
     word = strtok_r(NULL, " \t", &sp);
-    while (word && *count < MAX_TOKENS - 1) {
-        char *cp = strdup(word);
-        if (!cp) {
+    while (word) {
+        if (push_word(out, word) == -1) {
             free(dup);
             goto error;
         }
-        out[(*count)++] = cp;
         word = strtok_r(NULL, " \t", &sp);
     }
 
@@ -89,9 +80,9 @@ static int collect_alias_tokens(const char *name, char **out, int *count,
     return 0;
 
 error:
-    for (int i = start; i < *count; i++)
-        free(out[i]);
-    *count = start;
+    for (int i = start; i < out->count; i++)
+        free(out->items[i]);
+    out->count = start;
     return -1;
 }
 
@@ -106,32 +97,32 @@ int expand_aliases_in_segment(PipelineSegment *seg, int *argc, char *tok) {
         return 0;
 
     char *orig = tok;
-    char *tokens[MAX_TOKENS];
-    int count = 0;
+    StrArray tokens;
+    strarray_init(&tokens);
     char visited[MAX_ALIAS_DEPTH][MAX_LINE];
     memset(visited, 0, sizeof(visited));
 
-    if (collect_alias_tokens(orig, tokens, &count, visited, 0) == -1) {
+    if (collect_alias_tokens(orig, &tokens, visited, 0) == -1) {
         free(orig);
-        for (int i = 0; i < count; i++)
-            free(tokens[i]);
+        strarray_release(&tokens);
         return -1;
     }
 
-    if (count == 0) {
+    if (tokens.count == 0) {
         free(orig);
+        strarray_release(&tokens);
         return 0;
     }
 
     free(orig);
     int i = 0;
-    for (; i < count && *argc < MAX_TOKENS - 1; i++) {
-        seg->argv[*argc] = tokens[i];
-        seg->expand[*argc] = 1;
-        seg->quoted[*argc] = 0;
-        (*argc)++;
+    for (; i < tokens.count; i++) {
+        if (segment_add_word(seg, argc, tokens.items[i], 1, 0) == -1)
+            break;
     }
-    for (; i < count; i++)
-        free(tokens[i]);
-    return 1;
+    int failed = i < tokens.count;
+    for (; i < tokens.count; i++)
+        free(tokens.items[i]);
+    free(tokens.items);
+    return failed ? -1 : 1;
 }
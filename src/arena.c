@@ -0,0 +1,106 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Region allocator for per-command data.
+ */
+
+/*
+ * Expanding a command produces many small strings: expanded words, split
+ * fields and the arrays holding them.  They all die together when the
+ * command finishes, so instead of freeing each one they are carved out of
+ * a few large chunks that are dropped in one pass.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "util.h"
+
+#define ARENA_CHUNK_SIZE 4096
+
+/* Every allocation is rounded to the alignment of this union. */
+typedef union {
+    long double ld;
+    long long ll;
+    void *p;
+    void (*fn)(void);
+} ArenaAlign;
+
+struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t used;
+    size_t size;
+    ArenaAlign data[];
+};
+
+struct ArenaOwned {
+    struct ArenaOwned *next;
+    void *ptr;
+};
+
+unsigned long arena_chunk_count;
+
+void arena_init(Arena *a) {
+    a->chunks = NULL;
+    a->owned = NULL;
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+    size = (size + sizeof(ArenaAlign) - 1) / sizeof(ArenaAlign) *
+           sizeof(ArenaAlign);
+    struct ArenaChunk *c = a->chunks;
+    if (!c || c->size - c->used < size) {
+        size_t cap = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        struct ArenaChunk *n = xmalloc(sizeof(*n) + cap);
+        n->used = 0;
+        n->size = cap;
+        arena_chunk_count++;
+        /* keep filling the current chunk when an oversized request comes
+         * in on its own */
+        if (c && cap > ARENA_CHUNK_SIZE) {
+            n->next = c->next;
+            c->next = n;
+        } else {
+            n->next = c;
+            a->chunks = n;
+        }
+        c = n;
+    }
+    void *p = (char *)c->data + c->used;
+    c->used += size;
+    return p;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t n) {
+    char *d = arena_alloc(a, n + 1);
+    memcpy(d, s, n);
+    d[n] = '\0';
+    return d;
+}
+
+char *arena_strdup(Arena *a, const char *s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+void *arena_own(Arena *a, void *p) {
+    if (!p)
+        return NULL;
+    struct ArenaOwned *o = arena_alloc(a, sizeof(*o));
+    o->ptr = p;
+    o->next = a->owned;
+    a->owned = o;
+    return p;
+}
+
+void arena_release(Arena *a) {
+    /* the owned list lives inside the chunks, so walk it first */
+    for (struct ArenaOwned *o = a->owned; o; o = o->next)
+        free(o->ptr);
+    struct ArenaChunk *c = a->chunks;
+    while (c) {
+        struct ArenaChunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    arena_init(a);
+}
@@ -0,0 +1,41 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Region allocator for per-command data.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct ArenaChunk;
+struct ArenaOwned;
+
+/*
+ * Memory handed out by an arena lives until arena_release() frees all of
+ * it at once.  Strings produced by malloc() elsewhere can be attached with
+ * arena_own() so they share the same lifetime.
+ */
+typedef struct {
+    struct ArenaChunk *chunks;
+    struct ArenaOwned *owned;
+} Arena;
+
+/* Prepare A for use.  Nothing is allocated until the first request. */
+void arena_init(Arena *a);
+/* Return SIZE bytes aligned for any type.  Exits when memory runs out. */
+void *arena_alloc(Arena *a, size_t size);
+/* Copy the N bytes at S into A and terminate them. */
+char *arena_strndup(Arena *a, const char *s, size_t n);
+char *arena_strdup(Arena *a, const char *s);
+/* Free the malloc'd block P when A is released.  Returns P. */
+void *arena_own(Arena *a, void *p);
+/* Free everything allocated from or owned by A and reinitialize it. */
+void arena_release(Arena *a);
+
+/* Number of chunks allocated since startup.  Blocks adopted with
+ * arena_own() are not counted; their list nodes live inside chunks. */
+extern unsigned long arena_chunk_count;
+
+#endif /* ARENA_H */
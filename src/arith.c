@@ -6,10 +6,12 @@
 
 #define _GNU_SOURCE
 /*
- * Simple arithmetic expression evaluator used by the shell.
+ * Arithmetic expressions are compiled once into a compact tree and then
+ * evaluated as often as needed, so loops such as for ((...)) do no parsing
+ * per iteration.
  *
- * Expressions are parsed using a tiny recursive–descent parser with the
- * following grammar.  Each non‑terminal corresponds to a static parse_*()
+ * The compiler is a tiny recursive–descent parser with the following
+ * grammar.  Each non‑terminal corresponds to a static compile_*()
  *
  *   expression  := assignment
  *   assignment  := NAME '=' assignment |
@@ -27,15 +29,17 @@
  *   unary       := ('+' | '-' | '!' | '~') unary | factor
  *   factor      := NUMBER | NAME | '(' expression ')'
  *
- * Each parse_* function consumes characters from the input string via a
- * char pointer passed by reference.  Variable lookups use get_shell_var()
- * and environment variables and assignments update shell variables via
-* set_shell_var().  eval_arith() simply calls parse_expression on the supplied
- * string and returns the resulting numeric value.
+ * Each compile_* function consumes characters from state->p and appends
+ * nodes to the expression being built, returning the index of the node
+ * for the parsed subexpression.  Variable names are bound to VarSlot
+ * entries so evaluation reads and assigns them without hashing the name
+ * again.  eval_arith() keeps recently seen expression texts and their
+ * compiled form in a small cache.
  */
-#include "vars.h" // for set_shell_var and get_shell_var
+#include "vars.h" // for VarSlot
 #include "shell_state.h"
 #include "arith.h"
+#include "util.h"
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,18 +47,77 @@
 #include <limits.h>
 #include <errno.h>
 
-
-#define PARSE_RHS(fn)              \
-    long long rhs = fn(state);    \
-    if (state->err) return 0;
-
-static ArithState *current_state = NULL;
-
-static void arith_set_error(const char *msg) {
-    if (current_state && !current_state->err) {
-        current_state->err = 1;
-        strncpy(current_state->err_msg, msg, sizeof(current_state->err_msg) - 1);
-        current_state->err_msg[sizeof(current_state->err_msg) - 1] = '\0';
+#define ARITH_NAME_MAX 64
+#define ARITH_CACHE_SIZE 64
+
+enum {
+    A_NONE,
+    A_NUM, A_VAR, A_NEG, A_NOT, A_BNOT,
+    A_MUL, A_DIV, A_MOD, A_ADD, A_SUB, A_SHL, A_SHR,
+    A_EQ, A_NE, A_GE, A_LE, A_GT, A_LT,
+    A_BAND, A_BXOR, A_BOR, A_LAND, A_LOR,
+    A_ASSIGN, A_PREINC, A_POSTINC
+};
+
+typedef struct ArithNode {
+    unsigned char op;
+    unsigned char assign_op;  /* A_NONE for '=' or the compound operator */
+    int lhs, rhs;             /* operand node indices */
+    int slot;                 /* variable of A_VAR and assignments */
+    long long num;            /* literal value or increment */
+} ArithNode;
+
+struct ArithExpr {
+    ArithNode *nodes;
+    int node_count;
+    int node_cap;
+    VarSlot *slots;           /* one per distinct variable name */
+    int slot_count;
+    int slot_cap;
+    int root;
+    char *error;              /* syntax error found while compiling */
+};
+
+/* Binary operator tokens of one precedence level in matching order. */
+struct arith_binop {
+    const char *tok;
+    int op;
+};
+
+static const struct arith_binop term_ops[] = {
+    {"*", A_MUL}, {"/", A_DIV}, {"%", A_MOD}, {NULL, A_NONE}
+};
+static const struct arith_binop sum_ops[] = {
+    {"+", A_ADD}, {"-", A_SUB}, {NULL, A_NONE}
+};
+static const struct arith_binop shift_ops[] = {
+    {"<<", A_SHL}, {">>", A_SHR}, {NULL, A_NONE}
+};
+static const struct arith_binop equality_ops[] = {
+    {"==", A_EQ}, {"!=", A_NE}, {">=", A_GE}, {"<=", A_LE},
+    {">", A_GT}, {"<", A_LT}, {NULL, A_NONE}
+};
+static const struct arith_binop bit_and_ops[] = { {"&", A_BAND}, {NULL, A_NONE} };
+static const struct arith_binop bit_xor_ops[] = { {"^", A_BXOR}, {NULL, A_NONE} };
+static const struct arith_binop bit_or_ops[] = { {"|", A_BOR}, {NULL, A_NONE} };
+static const struct arith_binop logical_and_ops[] = { {"&&", A_LAND}, {NULL, A_NONE} };
+static const struct arith_binop logical_or_ops[] = { {"||", A_LOR}, {NULL, A_NONE} };
+static const struct arith_binop compound_ops[] = {
+    {"+=", A_ADD}, {"-=", A_SUB}, {"*=", A_MUL}, {"/=", A_DIV},
+    {"%=", A_MOD}, {"<<=", A_SHL}, {">>=", A_SHR}, {"&=", A_BAND},
+    {"^=", A_BXOR}, {"|=", A_BOR}, {NULL, A_NONE}
+};
+
+static struct arith_cache_entry {
+    char *text;
+    ArithExpr *expr;
+} arith_cache[ARITH_CACHE_SIZE];
+
+static void arith_set_error(ArithState *state, const char *msg) {
+    if (!state->err) {
+        state->err = 1;
+        strncpy(state->err_msg, msg, sizeof(state->err_msg) - 1);
+        state->err_msg[sizeof(state->err_msg) - 1] = '\0';
     }
 }
 
@@ -88,108 +151,7 @@ static int parse_ll(const char *s, long long *out) {
     return 0;
 }
 
-static long long parse_expression(ArithState *state);
-
-/*
- * Parse a factor: number, variable or parenthesised subexpression.
- * Returns the parsed value and advances *s past the token.
- */
-static long long parse_factor(ArithState *state) {
-    if (state->err) return 0;
-    skip_ws(&state->p);
-    if (*state->p == '(') {
-        state->p++; /* '(' */
-        long long value = parse_expression(state);
-        if (state->err) return 0;
-        skip_ws(&state->p);
-        if (*state->p == ')')
-            state->p++;
-        else
-            arith_set_error("missing ')'");
-        return value;
-    }
-    if (isalpha((unsigned char)*state->p) || *state->p == '_') {
-        char name[64]; int len = 0;
-        while (isalnum((unsigned char)*state->p) || *state->p == '_') {
-            if (len < (int)sizeof(name) - 1)
-                name[len++] = *state->p;
-            state->p++;
-        }
-        name[len] = '\0';
-        const char *val = get_shell_var(name);
-        if (!val) val = getenv(name);
-        if (val) {
-            long long num = 0;
-            if (parse_ll(val, &num) < 0) {
-                if (errno == ERANGE)
-                    arith_set_error("overflow");
-                else
-                    arith_set_error("invalid number");
-            }
-            return num;
-        }
-        return 0;
-    }
-    const char *p = state->p;
-    char *end;
-    errno = 0;
-    long long base = strtoll(p, &end, 10);
-    if (errno == ERANGE)
-        arith_set_error("overflow");
-    if (end > p && *end == '#') {
-        if (base >= 2 && base <= 36) {
-            p = end + 1;
-            errno = 0;
-            long long val = strtoll(p, &end, (int)base);
-            if (end == p || errno == ERANGE)
-                arith_set_error("invalid number");
-            state->p = end;
-            return val;
-        } else {
-            arith_set_error("invalid base");
-        }
-    }
-    errno = 0;
-    long long value = strtoll(p, &end, 10);
-    if (end == p || errno == ERANGE)
-        arith_set_error("invalid number");
-    state->p = end;
-    return value;
-}
-
-/*
- * Parse unary plus/minus or a factor.
- * Returns the resulting value; *s is advanced.
- */
-static long long parse_unary(ArithState *state) {
-    if (state->err) return 0;
-    skip_ws(&state->p);
-    if (*state->p == '+' || *state->p == '-' || *state->p == '!' || *state->p == '~') {
-        char op = *state->p++;
-        long long operand = parse_unary(state);
-        if (state->err) return 0;
-        switch (op) {
-            case '-':
-                if (operand == LLONG_MIN) {
-                    arith_set_error("overflow");
-                    return 0;
-                }
-                return -operand;
-            case '!':
-                return !operand;
-            case '~':
-                return ~operand;
-            default:
-                return operand; /* unary plus */
-        }
-    }
-    return parse_factor(state);
-}
-
-/*
- * Parse multiplicative operators (*, /, %).
- * Returns the computed value; *s is advanced past the expression.
- */
+/* Checked operations store the result in *OUT or return 1 on overflow. */
 static int mul_overflow(long long a, long long b, long long *out) {
     if (a > 0) {
         if (b > 0) {
@@ -242,270 +204,236 @@ static int rshift_overflow(long long a, long long b, long long *out) {
     return 0;
 }
 
-static long long parse_term(ArithState *state) {
-    if (state->err) return 0;
-    long long value = parse_unary(state);
-    if (state->err) return 0;
-    while (1) {
-        skip_ws(&state->p);
-        char op = *state->p;
-        if (op == '*' || op == '/' || op == '%') {
-            state->p++;
-            long long rhs = parse_unary(state);
-            if (state->err) return 0;
-            if (op == '*') {
-                long long result;
-                if (mul_overflow(value, rhs, &result)) {
-                    arith_set_error("overflow");
-                    return 0;
-                }
-                value = result;
-            } else if (op == '/') {
-                if (rhs == 0) {
-                    arith_set_error("divide by zero");
-                    return 0;
-                }
-                if (value == LLONG_MIN && rhs == -1) {
-                    arith_set_error("overflow");
-                    return 0;
-                }
-                value /= rhs;
-            } else {
-                if (rhs == 0) {
-                    arith_set_error("divide by zero");
-                    return 0;
-                }
-                if (value == LLONG_MIN && rhs == -1) {
-                    arith_set_error("overflow");
-                    return 0;
-                }
-                value %= rhs;
-            }
-        } else break;
+/*
+ * Append a node with operator OP and operands LHS and RHS.
+ * Returns its index or -1 when memory runs out.
+ */
+static int new_node(ArithState *state, int op, int lhs, int rhs) {
+    ArithExpr *ae = state->expr;
+    if (ae->node_count == ae->node_cap) {
+        int cap = ae->node_cap ? ae->node_cap * 2 : 16;
+        ArithNode *nodes = realloc(ae->nodes, cap * sizeof(*nodes));
+        if (!nodes) {
+            arith_set_error(state, "out of memory");
+            return -1;
+        }
+        ae->nodes = nodes;
+        ae->node_cap = cap;
     }
-    return value;
+    ArithNode *n = &ae->nodes[ae->node_count];
+    memset(n, 0, sizeof(*n));
+    n->op = op;
+    n->lhs = lhs;
+    n->rhs = rhs;
+    n->slot = -1;
+    return ae->node_count++;
 }
 
-/*
- * Parse addition and subtraction operations.
- * Returns the computed value while advancing *s.
- */
-static long long parse_sum(ArithState *state) {
-    if (state->err) return 0;
-    long long value = parse_term(state);
-    if (state->err) return 0;
-    while (1) {
-        skip_ws(&state->p);
-        char op = *state->p;
-        if (op == '+' || op == '-') {
-            state->p++;
-            long long rhs = parse_term(state);
-            if (state->err) return 0;
-            long long result;
-            if (op == '+') {
-                if (add_overflow(value, rhs, &result)) {
-                    arith_set_error("overflow");
-                    return 0;
-                }
-            } else {
-                if (sub_overflow(value, rhs, &result)) {
-                    arith_set_error("overflow");
-                    return 0;
-                }
-            }
-            value = result;
-        } else break;
+/* Return the slot bound to NAME, adding one on first use or -1 on error. */
+static int name_slot(ArithState *state, const char *name) {
+    ArithExpr *ae = state->expr;
+    for (int i = 0; i < ae->slot_count; i++)
+        if (strcmp(ae->slots[i].name, name) == 0)
+            return i;
+    if (ae->slot_count == ae->slot_cap) {
+        int cap = ae->slot_cap ? ae->slot_cap * 2 : 4;
+        VarSlot *slots = realloc(ae->slots, cap * sizeof(*slots));
+        if (!slots) {
+            arith_set_error(state, "out of memory");
+            return -1;
+        }
+        ae->slots = slots;
+        ae->slot_cap = cap;
     }
-    return value;
+    VarSlot *slot = &ae->slots[ae->slot_count];
+    memset(slot, 0, sizeof(*slot));
+    slot->name = xstrdup(name);
+    return ae->slot_count++;
 }
 
-/*
- * Parse shift operators (<< and >>).
- * Returns the computed value while advancing *s.
- */
-static long long parse_shift(ArithState *state) {
-    if (state->err) return 0;
-    long long value = parse_sum(state);
-    if (state->err) return 0;
-    while (1) {
-        skip_ws(&state->p);
-        if (strncmp(state->p, "<<", 2) == 0) {
-            state->p += 2;
-            long long rhs = parse_sum(state);
-            if (state->err) return 0;
-            if (rhs < 0 || rhs >= (long long)(sizeof(long long) * 8)) {
-                arith_set_error("shift out of range");
-                return 0;
-            }
-            long long result;
-            if (lshift_overflow(value, rhs, &result)) {
-                arith_set_error("overflow");
-                return 0;
-            }
-            value = result;
-        } else if (strncmp(state->p, ">>", 2) == 0) {
-            state->p += 2;
-            long long rhs = parse_sum(state);
-            if (state->err) return 0;
-            if (rhs < 0 || rhs >= (long long)(sizeof(long long) * 8)) {
-                arith_set_error("shift out of range");
-                return 0;
-            }
-            long long result;
-            if (rshift_overflow(value, rhs, &result)) {
-                arith_set_error("overflow");
-                return 0;
-            }
-            value = result;
-        } else break;
+/* Append a node of type OP referring to variable NAME. */
+static int var_node(ArithState *state, int op, const char *name) {
+    int slot = name_slot(state, name);
+    if (slot < 0)
+        return -1;
+    int n = new_node(state, op, -1, -1);
+    if (n >= 0)
+        state->expr->nodes[n].slot = slot;
+    return n;
+}
+
+/* Append a literal node holding VALUE unless an error was recorded. */
+static int num_node(ArithState *state, long long value) {
+    if (state->err)
+        return -1;
+    int n = new_node(state, A_NUM, -1, -1);
+    if (n >= 0)
+        state->expr->nodes[n].num = value;
+    return n;
+}
+
+/* Copy the variable name at state->p into NAME, truncating long names. */
+static void read_name(ArithState *state, char *name) {
+    int len = 0;
+    while (isalnum((unsigned char)*state->p) || *state->p == '_') {
+        if (len < ARITH_NAME_MAX - 1)
+            name[len++] = *state->p;
+        state->p++;
     }
-    return value;
+    name[len] = '\0';
+}
+
+/* Return the entry of OPS whose token starts at state->p or NULL. */
+static const struct arith_binop *match_op(ArithState *state,
+                                          const struct arith_binop *ops) {
+    for (; ops->tok; ops++)
+        if (strncmp(state->p, ops->tok, strlen(ops->tok)) == 0)
+            return ops;
+    return NULL;
 }
 
+static int compile_expression(ArithState *state);
+
 /*
- * Parse equality and relational operators (==, !=, >=, <=, >, <).
- * Precedence: lower than bitwise AND but higher than shift. Left-associative.
- * Advances *s past the comparison expression and returns 1 or 0.
+ * Compile a factor: number, variable or parenthesised subexpression.
+ * Returns the node index and advances state->p past the token.
  */
-static long long parse_equality(ArithState *state) {
-    if (state->err) return 0;
-    long long value = parse_shift(state);
-    if (state->err) return 0;
-    while (1) {
+static int compile_factor(ArithState *state) {
+    if (state->err) return -1;
+    skip_ws(&state->p);
+    if (*state->p == '(') {
+        state->p++; /* '(' */
+        int n = compile_expression(state);
+        if (state->err) return -1;
         skip_ws(&state->p);
-        if (strncmp(state->p, "==", 2) == 0) {
-            state->p += 2;
-            PARSE_RHS(parse_shift);
-            value = (value == rhs);
-        } else if (strncmp(state->p, "!=", 2) == 0) {
-            state->p += 2;
-            PARSE_RHS(parse_shift);
-            value = (value != rhs);
-        } else if (strncmp(state->p, ">=", 2) == 0) {
-            state->p += 2;
-            PARSE_RHS(parse_shift);
-            value = (value >= rhs);
-        } else if (strncmp(state->p, "<=", 2) == 0) {
-            state->p += 2;
-            PARSE_RHS(parse_shift);
-            value = (value <= rhs);
-        } else if (*state->p == '>') {
-            state->p++;
-            PARSE_RHS(parse_shift);
-            value = (value > rhs);
-        } else if (*state->p == '<') {
+        if (*state->p == ')')
             state->p++;
-            PARSE_RHS(parse_shift);
-            value = (value < rhs);
+        else
+            arith_set_error(state, "missing ')'");
+        return state->err ? -1 : n;
+    }
+    if (isalpha((unsigned char)*state->p) || *state->p == '_') {
+        char name[ARITH_NAME_MAX];
+        read_name(state, name);
+        return var_node(state, A_VAR, name);
+    }
+    const char *p = state->p;
+    char *end;
+    errno = 0;
+    long long base = strtoll(p, &end, 10);
+    if (errno == ERANGE)
+        arith_set_error(state, "overflow");
+    if (end > p && *end == '#') {
+        if (base >= 2 && base <= 36) {
+            p = end + 1;
+            errno = 0;
+            long long val = strtoll(p, &end, (int)base);
+            if (end == p || errno == ERANGE)
+                arith_set_error(state, "invalid number");
+            state->p = end;
+            return num_node(state, val);
         } else {
-            break;
+            arith_set_error(state, "invalid base");
         }
     }
-    return value;
+    errno = 0;
+    long long value = strtoll(p, &end, 10);
+    if (end == p || errno == ERANGE)
+        arith_set_error(state, "invalid number");
+    state->p = end;
+    return num_node(state, value);
 }
 
 /*
- * Parse bitwise AND operations.
+ * Compile unary plus/minus, logical and bitwise not or a factor.
  */
-static long long parse_bit_and(ArithState *state) {
-    if (state->err) return 0;
-    long long value = parse_equality(state);
-    if (state->err) return 0;
-    while (1) {
-        skip_ws(&state->p);
-        if (*state->p == '&') {
-            state->p++;
-            long long rhs = parse_equality(state);
-            if (state->err) return 0;
-            value &= rhs;
-        } else break;
+static int compile_unary(ArithState *state) {
+    if (state->err) return -1;
+    skip_ws(&state->p);
+    if (*state->p == '+' || *state->p == '-' || *state->p == '!' || *state->p == '~') {
+        char op = *state->p++;
+        int operand = compile_unary(state);
+        if (state->err) return -1;
+        switch (op) {
+            case '-':
+                return new_node(state, A_NEG, operand, -1);
+            case '!':
+                return new_node(state, A_NOT, operand, -1);
+            case '~':
+                return new_node(state, A_BNOT, operand, -1);
+            default:
+                return operand; /* unary plus */
+        }
     }
-    return value;
+    return compile_factor(state);
 }
 
 /*
- * Parse bitwise XOR operations.
+ * Compile a left-associative chain of OPERAND separated by any operator
+ * listed in OPS.
  */
-static long long parse_bit_xor(ArithState *state) {
-    if (state->err) return 0;
-    long long value = parse_bit_and(state);
-    if (state->err) return 0;
+static int compile_binary(ArithState *state, int (*operand)(ArithState *),
+                          const struct arith_binop *ops) {
+    if (state->err) return -1;
+    int lhs = operand(state);
+    if (state->err) return -1;
     while (1) {
         skip_ws(&state->p);
-        if (*state->p == '^') {
-            state->p++;
-            long long rhs = parse_bit_and(state);
-            if (state->err) return 0;
-            value ^= rhs;
-        } else break;
+        const struct arith_binop *b = match_op(state, ops);
+        if (!b)
+            break;
+        state->p += strlen(b->tok);
+        int rhs = operand(state);
+        if (state->err) return -1;
+        lhs = new_node(state, b->op, lhs, rhs);
+        if (lhs < 0) return -1;
     }
-    return value;
+    return lhs;
 }
 
-/*
- * Parse bitwise OR operations.
- */
-static long long parse_bit_or(ArithState *state) {
-    if (state->err) return 0;
-    long long value = parse_bit_xor(state);
-    if (state->err) return 0;
-    while (1) {
-        skip_ws(&state->p);
-        if (*state->p == '|') {
-            state->p++;
-            long long rhs = parse_bit_xor(state);
-            if (state->err) return 0;
-            value |= rhs;
-        } else break;
-    }
-    return value;
+static int compile_term(ArithState *state) {
+    return compile_binary(state, compile_unary, term_ops);
 }
 
-/*
- * Parse logical AND operations.
- */
-static long long parse_logical_and(ArithState *state) {
-    if (state->err) return 0;
-    long long value = parse_bit_or(state);
-    if (state->err) return 0;
-    while (1) {
-        skip_ws(&state->p);
-        if (strncmp(state->p, "&&", 2) == 0) {
-            state->p += 2;
-            long long rhs = parse_bit_or(state);
-            if (state->err) return 0;
-            value = value && rhs;
-        } else break;
-    }
-    return value;
+static int compile_sum(ArithState *state) {
+    return compile_binary(state, compile_term, sum_ops);
 }
 
-/*
- * Parse logical OR operations.
- */
-static long long parse_logical_or(ArithState *state) {
-    if (state->err) return 0;
-    long long value = parse_logical_and(state);
-    if (state->err) return 0;
-    while (1) {
-        skip_ws(&state->p);
-        if (strncmp(state->p, "||", 2) == 0) {
-            state->p += 2;
-            long long rhs = parse_logical_and(state);
-            if (state->err) return 0;
-            value = value || rhs;
-        } else break;
-    }
-    return value;
+static int compile_shift(ArithState *state) {
+    return compile_binary(state, compile_sum, shift_ops);
+}
+
+/* Comparisons bind looser than shifts but tighter than bitwise AND. */
+static int compile_equality(ArithState *state) {
+    return compile_binary(state, compile_shift, equality_ops);
+}
+
+static int compile_bit_and(ArithState *state) {
+    return compile_binary(state, compile_equality, bit_and_ops);
+}
+
+static int compile_bit_xor(ArithState *state) {
+    return compile_binary(state, compile_bit_and, bit_xor_ops);
+}
+
+static int compile_bit_or(ArithState *state) {
+    return compile_binary(state, compile_bit_xor, bit_or_ops);
+}
+
+static int compile_logical_and(ArithState *state) {
+    return compile_binary(state, compile_bit_or, logical_and_ops);
+}
+
+static int compile_logical_or(ArithState *state) {
+    return compile_binary(state, compile_logical_and, logical_or_ops);
 }
 
 /*
- * Parse assignments of the form NAME=expr.
- * Side effect: updates shell variables via set_shell_var().
- * Returns the assigned or computed value and advances *s.
+ * Compile assignments of the form NAME=expr, NAME op= expr and the
+ * increment and decrement operators.  Anything else is a logical_or.
  */
-static long long parse_assignment(ArithState *state) {
-    if (state->err) return 0;
+static int compile_assignment(ArithState *state) {
+    if (state->err) return -1;
     skip_ws(&state->p);
     const char *save = state->p;
     int prefix = 0; char incop = 0;
@@ -516,180 +444,178 @@ static long long parse_assignment(ArithState *state) {
     }
 
     if ((isalpha((unsigned char)*state->p) || *state->p == '_')) {
-        char name[64]; int len = 0;
-        while (isalnum((unsigned char)*state->p) || *state->p == '_') {
-            if (len < (int)sizeof(name) - 1)
-                name[len++] = *state->p;
-            state->p++;
-        }
-        name[len] = '\0';
+        char name[ARITH_NAME_MAX];
+        read_name(state, name);
         skip_ws(&state->p);
-        if (*state->p == '=') {
-            state->p++;
-            long long value = parse_assignment(state);
-            if (state->err) return 0;
-            char buf[32];
-            snprintf(buf, sizeof(buf), "%lld", value);
-            set_shell_var(name, buf);
-            return value;
-        }
-
-        int oplen = 0;
-        enum { OP_NONE, OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD,
-               OP_SHL, OP_SHR, OP_AND, OP_XOR, OP_OR } op = OP_NONE;
-        if (strncmp(state->p, "+=", 2) == 0) { op = OP_ADD; oplen = 2; }
-        else if (strncmp(state->p, "-=", 2) == 0) { op = OP_SUB; oplen = 2; }
-        else if (strncmp(state->p, "*=", 2) == 0) { op = OP_MUL; oplen = 2; }
-        else if (strncmp(state->p, "/=", 2) == 0) { op = OP_DIV; oplen = 2; }
-        else if (strncmp(state->p, "%=", 2) == 0) { op = OP_MOD; oplen = 2; }
-        else if (strncmp(state->p, "<<=", 3) == 0) { op = OP_SHL; oplen = 3; }
-        else if (strncmp(state->p, ">>=", 3) == 0) { op = OP_SHR; oplen = 3; }
-        else if (strncmp(state->p, "&=", 2) == 0) { op = OP_AND; oplen = 2; }
-        else if (strncmp(state->p, "^=", 2) == 0) { op = OP_XOR; oplen = 2; }
-        else if (strncmp(state->p, "|=", 2) == 0) { op = OP_OR; oplen = 2; }
-
-        if (op != OP_NONE) {
-            state->p += oplen;
-            long long rhs = parse_assignment(state);
-            if (state->err) return 0;
-
-            const char *val = get_shell_var(name);
-            if (!val) val = getenv(name);
-            long long cur = 0;
-            if (val && parse_ll(val, &cur) < 0) {
-                if (errno == ERANGE)
-                    arith_set_error("overflow");
-                else
-                    arith_set_error("invalid number");
+        const struct arith_binop *b = NULL;
+        if (*state->p == '=' || (b = match_op(state, compound_ops))) {
+            state->p += b ? strlen(b->tok) : 1;
+            int rhs = compile_assignment(state);
+            if (state->err) return -1;
+            int n = var_node(state, A_ASSIGN, name);
+            if (n >= 0) {
+                state->expr->nodes[n].rhs = rhs;
+                state->expr->nodes[n].assign_op = b ? b->op : A_NONE;
             }
-
-            long long newv = 0;
-            switch (op) {
-                case OP_ADD:
-                    if (add_overflow(cur, rhs, &newv)) {
-                        arith_set_error("overflow");
-                        return 0;
-                    }
-                    break;
-                case OP_SUB:
-                    if (sub_overflow(cur, rhs, &newv)) {
-                        arith_set_error("overflow");
-                        return 0;
-                    }
-                    break;
-                case OP_MUL:
-                    if (mul_overflow(cur, rhs, &newv)) {
-                        arith_set_error("overflow");
-                        return 0;
-                    }
-                    break;
-                case OP_DIV:
-                    if (rhs == 0) {
-                        arith_set_error("divide by zero");
-                        return 0;
-                    }
-                    if (cur == LLONG_MIN && rhs == -1) {
-                        arith_set_error("overflow");
-                        return 0;
-                    }
-                    newv = cur / rhs;
-                    break;
-                case OP_MOD:
-                    if (rhs == 0) {
-                        arith_set_error("divide by zero");
-                        return 0;
-                    }
-                    if (cur == LLONG_MIN && rhs == -1) {
-                        arith_set_error("overflow");
-                        return 0;
-                    }
-                    newv = cur % rhs;
-                    break;
-                case OP_SHL:
-                    if (lshift_overflow(cur, rhs, &newv)) {
-                        arith_set_error("overflow");
-                        return 0;
-                    }
-                    break;
-                case OP_SHR:
-                    if (rshift_overflow(cur, rhs, &newv)) {
-                        arith_set_error("overflow");
-                        return 0;
-                    }
-                    break;
-                case OP_AND:
-                    newv = cur & rhs;
-                    break;
-                case OP_XOR:
-                    newv = cur ^ rhs;
-                    break;
-                case OP_OR:
-                    newv = cur | rhs;
-                    break;
-                default:
-                    break;
-            }
-
-            char buf[32];
-            snprintf(buf, sizeof(buf), "%lld", newv);
-            set_shell_var(name, buf);
-            return newv;
-        }
-
-        /* Retrieve current variable value */
-        const char *val = get_shell_var(name);
-        if (!val) val = getenv(name);
-        long long cur = 0;
-        if (val && parse_ll(val, &cur) < 0) {
-            if (errno == ERANGE)
-                arith_set_error("overflow");
-            else
-                arith_set_error("invalid number");
+            return n;
         }
 
+        int op = A_NONE;
         if (prefix) {
-            long long newv;
-            if (add_overflow(cur, (incop == '+') ? 1 : -1, &newv)) {
-                arith_set_error("overflow");
-                return 0;
-            }
-            char buf[32];
-            snprintf(buf, sizeof(buf), "%lld", newv);
-            set_shell_var(name, buf);
-            return newv;
-        }
-
-        if (strncmp(state->p, "++", 2) == 0 || strncmp(state->p, "--", 2) == 0) {
+            op = A_PREINC;
+        } else if (strncmp(state->p, "++", 2) == 0 || strncmp(state->p, "--", 2) == 0) {
+            op = A_POSTINC;
             incop = state->p[0];
             state->p += 2;
-            long long newv;
-            if (add_overflow(cur, (incop == '+') ? 1 : -1, &newv)) {
-                arith_set_error("overflow");
-                return 0;
-            }
-            char buf[32];
-            snprintf(buf, sizeof(buf), "%lld", newv);
-            set_shell_var(name, buf);
-            return cur; /* postfix returns old value */
+        }
+        if (op != A_NONE) {
+            int n = var_node(state, op, name);
+            if (n >= 0)
+                state->expr->nodes[n].num = (incop == '+') ? 1 : -1;
+            return n;
         }
     }
     state->p = save;
-    return parse_logical_or(state);
+    return compile_logical_or(state);
+}
+
+/* Wrapper for the top-level expression compiler. */
+static int compile_expression(ArithState *state) {
+    return compile_assignment(state);
+}
+
+/* Read the numeric value of variable SLOT; unset variables are zero. */
+static long long slot_value(ArithState *state, int slot) {
+    const char *val = get_slot_var(&state->expr->slots[slot]);
+    long long num = 0;
+    if (val && parse_ll(val, &num) < 0) {
+        if (errno == ERANGE)
+            arith_set_error(state, "overflow");
+        else
+            arith_set_error(state, "invalid number");
+    }
+    return num;
 }
 
-/* Wrapper for the top-level expression parser. */
-static long long parse_expression(ArithState *state) {
-    return parse_assignment(state);
+static void store_value(ArithState *state, int slot, long long value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", value);
+    set_slot_var(&state->expr->slots[slot], buf);
 }
 
 /*
- * Evaluate an arithmetic expression contained in 'expr'.
- * Returns the resulting long long value; does not modify 'expr'.
+ * Apply the binary operator OP to A and B storing the result in *OUT.
+ * Returns an error message or NULL on success.
  */
-long long eval_arith(const char *expr, int *err, char **errmsg) {
-    ArithState st = { .p = expr, .err = 0, .err_msg = "" };
-    current_state = &st;
-    long long result = parse_expression(&st);
+static const char *apply_binop(int op, long long a, long long b, long long *out) {
+    switch (op) {
+        case A_MUL:
+            return mul_overflow(a, b, out) ? "overflow" : NULL;
+        case A_DIV:
+        case A_MOD:
+            if (b == 0)
+                return "divide by zero";
+            if (a == LLONG_MIN && b == -1)
+                return "overflow";
+            *out = (op == A_DIV) ? a / b : a % b;
+            return NULL;
+        case A_ADD:
+            return add_overflow(a, b, out) ? "overflow" : NULL;
+        case A_SUB:
+            return sub_overflow(a, b, out) ? "overflow" : NULL;
+        case A_SHL:
+            return lshift_overflow(a, b, out) ? "overflow" : NULL;
+        case A_SHR:
+            return rshift_overflow(a, b, out) ? "overflow" : NULL;
+        case A_EQ: *out = (a == b); break;
+        case A_NE: *out = (a != b); break;
+        case A_GE: *out = (a >= b); break;
+        case A_LE: *out = (a <= b); break;
+        case A_GT: *out = (a > b); break;
+        case A_LT: *out = (a < b); break;
+        case A_BAND: *out = a & b; break;
+        case A_BXOR: *out = a ^ b; break;
+        case A_BOR: *out = a | b; break;
+        case A_LAND: *out = a && b; break;
+        case A_LOR: *out = a || b; break;
+        default: *out = 0; break;
+    }
+    return NULL;
+}
+
+/*
+ * Evaluate node N of the expression in STATE.  Evaluation stops at the
+ * first error which is recorded in STATE.
+ */
+static long long eval_node(ArithState *state, int n) {
+    const ArithNode *node = &state->expr->nodes[n];
+    long long a, b, result;
+    const char *msg;
+    switch (node->op) {
+        case A_NUM:
+            return node->num;
+        case A_VAR:
+            return slot_value(state, node->slot);
+        case A_NEG:
+        case A_NOT:
+        case A_BNOT:
+            a = eval_node(state, node->lhs);
+            if (state->err) return 0;
+            if (node->op == A_NOT)
+                return !a;
+            if (node->op == A_BNOT)
+                return ~a;
+            if (a == LLONG_MIN) {
+                arith_set_error(state, "overflow");
+                return 0;
+            }
+            return -a;
+        case A_ASSIGN:
+            b = eval_node(state, node->rhs);
+            if (state->err) return 0;
+            result = b;
+            if (node->assign_op != A_NONE) {
+                a = slot_value(state, node->slot);
+                msg = apply_binop(node->assign_op, a, b, &result);
+                if (msg) {
+                    arith_set_error(state, msg);
+                    return 0;
+                }
+            }
+            store_value(state, node->slot, result);
+            return result;
+        case A_PREINC:
+        case A_POSTINC:
+            a = slot_value(state, node->slot);
+            if (add_overflow(a, node->num, &result)) {
+                arith_set_error(state, "overflow");
+                return 0;
+            }
+            store_value(state, node->slot, result);
+            return (node->op == A_PREINC) ? result : a; /* postfix returns old value */
+        default:
+            a = eval_node(state, node->lhs);
+            if (state->err) return 0;
+            b = eval_node(state, node->rhs);
+            if (state->err) return 0;
+            if ((node->op == A_SHL || node->op == A_SHR) &&
+                (b < 0 || b >= (long long)(sizeof(long long) * 8))) {
+                arith_set_error(state, "shift out of range");
+                return 0;
+            }
+            msg = apply_binop(node->op, a, b, &result);
+            if (msg) {
+                arith_set_error(state, msg);
+                return 0;
+            }
+            return result;
+    }
+}
+
+ArithExpr *compile_arith(const char *expr) {
+    ArithExpr *ae = xcalloc(1, sizeof(*ae));
+    ArithState st = { .p = expr, .err = 0, .err_msg = "", .expr = ae };
+    ae->root = compile_expression(&st);
     /* Skip any whitespace the parser left behind. */
     const char *p = st.p;
     skip_ws(&p);
@@ -701,8 +627,30 @@ long long eval_arith(const char *expr, int *err, char **errmsg) {
         skip_ws(&p);
     }
     if (*p != '\0')
-        arith_set_error("syntax error");
-    current_state = NULL;
+        arith_set_error(&st, "syntax error");
+    if (st.err)
+        ae->error = xstrdup(st.err_msg[0] ? st.err_msg : "error");
+    return ae;
+}
+
+void free_arith(ArithExpr *ae) {
+    if (!ae)
+        return;
+    for (int i = 0; i < ae->slot_count; i++)
+        free((char *)ae->slots[i].name);
+    free(ae->slots);
+    free(ae->nodes);
+    free(ae->error);
+    free(ae);
+}
+
+long long eval_compiled_arith(ArithExpr *ae, int *err, char **errmsg) {
+    ArithState st = { .p = NULL, .err = 0, .err_msg = "", .expr = ae };
+    long long result = 0;
+    if (ae->error)
+        arith_set_error(&st, ae->error);
+    else
+        result = eval_node(&st, ae->root);
     if (err)
         *err = st.err;
     if (errmsg)
@@ -718,3 +666,19 @@ long long eval_arith(const char *expr, int *err, char **errmsg) {
     last_status = (result != 0) ? 0 : 1;
     return result;
 }
+
+/*
+ * Evaluate an arithmetic expression contained in 'expr'.
+ * Returns the resulting long long value; does not modify 'expr'.
+ */
+long long eval_arith(const char *expr, int *err, char **errmsg) {
+    size_t h = hash_string(expr);
+    struct arith_cache_entry *e = &arith_cache[h % ARITH_CACHE_SIZE];
+    if (!e->text || strcmp(e->text, expr) != 0) {
+        free(e->text);
+        free_arith(e->expr);
+        e->text = xstrdup(expr);
+        e->expr = compile_arith(expr);
+    }
+    return eval_compiled_arith(e->expr, err, errmsg);
+}
@@ -7,12 +7,24 @@
 #ifndef ARITH_H
 #define ARITH_H
 
+typedef struct ArithExpr ArithExpr;
+
 typedef struct ArithState {
     const char *p;
     int err;
     char err_msg[64];
+    ArithExpr *expr;    /* expression being compiled or evaluated */
 } ArithState;
 
+/*
+ * Compile EXPR into a form that can be evaluated repeatedly without
+ * parsing it again.  Syntax errors are reported when it is evaluated.
+ * Release the result with free_arith().
+ */
+ArithExpr *compile_arith(const char *expr);
+long long eval_compiled_arith(ArithExpr *ae, int *err, char **errmsg);
+void free_arith(ArithExpr *ae);
+/* Evaluate EXPR, reusing its compiled form when it was seen recently. */
 long long eval_arith(const char *expr, int *err, char **errmsg);
 
 #endif /* ARITH_H */
@@ -70,67 +70,39 @@ void apply_array_assignment(const char *name, const char *val, int export_env) {
         return;
 
     set_shell_array(name, vals, count);
-
-    if (export_env) {
-        size_t joinlen = 0;
-        for (int j = 0; j < count; j++)
-            joinlen += strlen(vals[j]) + 1;
-        char *joined = malloc(joinlen + 1);
-        if (!joined) {
-            /* Report allocation failure but still continue after setting
-             * last_status to indicate the error. */
-            perror("malloc");
-            last_status = 1;
-        } else {
-            joined[0] = '\0';
-            for (int j = 0; j < count; j++) {
-                strcat(joined, vals[j]);
-                if (j < count - 1)
-                    strcat(joined, " ");
-            }
-            setenv(name, joined, 1);
-            free(joined);
-        }
-    }
+    if (export_env)
+        set_var_exported(name, 1);
 
     for (int j = 0; j < count; j++)
         free(vals[j]);
     free(vals);
 }
 
-/* Expand a temporary assignment word in-place.  ASSIGN points to a malloc'd
- * string which will be replaced with an expanded version on success. */
-void expand_assignment(char **assign) {
-    if (!assign || !*assign)
-        return;
-    char *eq = strchr(*assign, '=');
-    if (eq) {
-        char *name = strndup(*assign, eq - *assign);
-        char *val = expand_var(eq + 1);
-        if (val) {
-            size_t len = strlen(val);
-            if (len >= 2 && ((val[0] == '\'' && val[len - 1] == '\'') ||
-                             (val[0] == '"' && val[len - 1] == '"'))) {
-                char *trim = strndup(val + 1, len - 2);
-                if (trim) { free(val); val = trim; }
-            }
-        }
-        char *tmp = NULL;
-        if (name && val)
-            xasprintf(&tmp, "%s=%s", name, val);
-        if (tmp) {
-            free(*assign);
-            *assign = tmp;
-        }
-        free(name);
-        free(val);
-    } else {
-        char *new = expand_var(*assign);
-        if (new) {
-            free(*assign);
-            *assign = new;
+/* Expand a temporary assignment word.  Returns a newly allocated string or
+ * NULL when the expansion fails; ASSIGN itself is left untouched. */
+char *expand_assignment(const char *assign) {
+    if (!assign)
+        return NULL;
+    const char *eq = strchr(assign, '=');
+    if (!eq)
+        return expand_var(assign);
+
+    char *name = strndup(assign, eq - assign);
+    char *val = expand_var(eq + 1);
+    if (val) {
+        size_t len = strlen(val);
+        if (len >= 2 && ((val[0] == '\'' && val[len - 1] == '\'') ||
+                         (val[0] == '"' && val[len - 1] == '"'))) {
+            char *trim = strndup(val + 1, len - 2);
+            if (trim) { free(val); val = trim; }
         }
     }
+    char *tmp = NULL;
+    if (name && val)
+        xasprintf(&tmp, "%s=%s", name, val);
+    free(name);
+    free(val);
+    return tmp;
 }
 
 struct assign_backup *backup_assignments(PipelineSegment *pipeline) {
@@ -146,24 +118,13 @@ struct assign_backup *backup_assignments(PipelineSegment *pipeline) {
             continue;
         }
         backs[i].name = strndup(pipeline->assigns[i], eq - pipeline->assigns[i]);
-        if (!backs[i].name) {
-            backs[i].env = backs[i].var = NULL;
-            backs[i].had_env = backs[i].had_var = 0;
-            continue;
-        }
-        const char *oe = getenv(backs[i].name);
-        backs[i].had_env = oe != NULL;
-        backs[i].env = oe ? strdup(oe) : NULL;
-        if (oe && !backs[i].env) {
-            free(backs[i].name);
-            backs[i].name = NULL;
+        if (!backs[i].name)
             continue;
-        }
+        backs[i].exported = get_env_var(backs[i].name) != NULL;
         const char *ov = get_shell_var(backs[i].name);
         backs[i].had_var = ov != NULL;
         backs[i].var = ov ? strdup(ov) : NULL;
         if (ov && !backs[i].var) {
-            free(backs[i].env);
             free(backs[i].name);
             backs[i].name = NULL;
             continue;
@@ -179,23 +140,14 @@ void restore_assignments(PipelineSegment *pipeline, struct assign_backup *backs)
     for (int i = 0; i < pipeline->assign_count; i++) {
         if (!backs[i].name)
             continue;
-        if (backs[i].had_env && backs[i].had_var && backs[i].env && backs[i].var &&
-            strcmp(backs[i].env, backs[i].var) == 0) {
-            export_var(backs[i].name, backs[i].env);
+        if (backs[i].had_var) {
+            set_shell_var(backs[i].name, backs[i].var);
+            set_var_exported(backs[i].name, backs[i].exported);
         } else {
-            if (backs[i].had_env)
-                setenv(backs[i].name, backs[i].env, 1);
-            else
-                unsetenv(backs[i].name);
-            if (backs[i].had_var)
-                set_shell_var(backs[i].name, backs[i].var);
-            else
-                unset_shell_var(backs[i].name);
+            unset_shell_var(backs[i].name);
         }
         free(backs[i].name);
-        free(backs[i].env);
         free(backs[i].var);
     }
     free(backs);
 }
-
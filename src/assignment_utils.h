@@ -11,15 +11,14 @@
 
 struct assign_backup {
     char *name;
-    char *env;
     char *var;
-    int had_env;
     int had_var;
+    int exported;
 };
 
 char **parse_array_values(const char *val, int *count);
 void apply_array_assignment(const char *name, const char *val, int export_env);
-void expand_assignment(char **assign);
+char *expand_assignment(const char *assign);
 struct assign_backup *backup_assignments(PipelineSegment *pipeline);
 void restore_assignments(PipelineSegment *pipeline, struct assign_backup *backs);
 
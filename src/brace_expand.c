@@ -6,7 +6,8 @@
 
 #define _GNU_SOURCE
 #include "brace_expand.h"
-#include "parser.h" /* for MAX_LINE and MAX_TOKENS */
+#include "parser.h" /* for MAX_LINE */
+#include "strarray.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -54,10 +55,8 @@ char **expand_braces(const char *word, int *count_out) {
     strncpy(suffix, rb + 1, sizeof(suffix));
     suffix[sizeof(suffix) - 1] = '\0';
 
-    char **res = malloc(sizeof(char *) * MAX_TOKENS);
-    if (!res)
-        return NULL;
-    int count = 0;
+    StrArray res;
+    strarray_init(&res);
 
     char *dots = strstr(inner, "..");
     if (dots) {
@@ -74,62 +73,56 @@ char **expand_braces(const char *word, int *count_out) {
         long end = strtol(right, &ep2, 10);
         if (*ep1 == '\0' && *ep2 == '\0') {
             int step = start <= end ? 1 : -1;
-            for (long n = start; (step > 0 ? n <= end : n >= end) && count < MAX_TOKENS - 1; n += step) {
+            for (long n = start; step > 0 ? n <= end : n >= end; n += step) {
                 char num[32];
                 snprintf(num, sizeof(num), "%ld", n);
                 size_t len = strlen(prefix) + strlen(num) + strlen(suffix) + 1;
                 char *tmp = malloc(len);
-                if (!tmp) {
-                    for (int i = 0; i < count; i++)
-                        free(res[i]);
-                    free(res);
+                if (!tmp || strarray_push(&res, tmp) == -1) {
+                    free(tmp);
+                    strarray_release(&res);
                     return NULL;
                 }
                 snprintf(tmp, len, "%s%s%s", prefix, num, suffix);
-                res[count++] = tmp;
             }
-            res[count] = NULL;
-            if (count_out)
+            int count = res.count;
+            char **out = strarray_finish(&res);
+            if (out && count_out)
                 *count_out = count;
-            return res;
+            return out;
         }
     }
 
     char *dup = strdup(inner);
-    if (!dup) {
-        free(res);
+    if (!dup)
         return NULL;
-    }
     char *sp = NULL;
     char *tok = strtok_r(dup, ",", &sp);
-    while (tok && count < MAX_TOKENS - 1) {
+    while (tok) {
         size_t len = strlen(prefix) + strlen(tok) + strlen(suffix) + 1;
         char *tmp = malloc(len);
-        if (!tmp) {
+        if (!tmp || strarray_push(&res, tmp) == -1) {
+            free(tmp);
             free(dup);
-            for (int i = 0; i < count; i++)
-                free(res[i]);
-            free(res);
+            strarray_release(&res);
             return NULL;
         }
         snprintf(tmp, len, "%s%s%s", prefix, tok, suffix);
-        res[count++] = tmp;
         tok = strtok_r(NULL, ",", &sp);
     }
     free(dup);
-    if (count == 0) {
-        res[count] = strdup(word);
-        if (!res[count]) {
-            for (int i = 0; i < count; i++)
-                free(res[i]);
-            free(res);
+    if (res.count == 0) {
+        char *cp = strdup(word);
+        if (!cp || strarray_push(&res, cp) == -1) {
+            free(cp);
+            strarray_release(&res);
             return NULL;
         }
-        count++;
     }
-    res[count] = NULL;
-    if (count_out)
+    int count = res.count;
+    char **out = strarray_finish(&res);
+    if (out && count_out)
         *count_out = count;
-    return res;
+    return out;
 }
 
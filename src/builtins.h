@@ -53,11 +53,14 @@ void free_aliases(void);
 typedef struct func_entry {
     char *name;
     char *text;
-    Command *body;
+    Command *body;      /* parsed once at definition time, NULL if uncached */
+    int refs;           /* function table reference plus running calls */
     ListNode node;
 } FuncEntry;
 void define_function(const char *name, Command *body, const char *text);
 FuncEntry *find_function(const char *name);
+/* Drop a reference taken while running FN and free it once unused. */
+void release_function(FuncEntry *fn);
 Command *get_function(const char *name); /* deprecated */
 void remove_function(const char *name);
 void load_functions(void);
@@ -15,6 +15,7 @@
 #include "scriptargs.h"
 #include "vars.h"
 #include "hash.h"
+#include "repl.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,7 +24,6 @@
 #include <limits.h>
 #include <sys/wait.h>
 
-extern FILE *parse_input;
 
 static int prepare_source_args(char **args, int *old_argc, char ***old_argv,
                                int *new_argc)
@@ -67,36 +67,6 @@ static void restore_source_args(int old_argc, char **old_argv, int new_argc)
     getopts_pos = NULL; /* argv replaced; reset getopts pointer */
 }
 
-static void execute_source_file(FILE *input)
-{
-    char line[MAX_LINE];
-    while (read_logical_line(input, line, sizeof(line))) {
-        current_lineno++;
-        if (opt_verbose)
-            printf("%s\n", line);
-        Command *cmds = parse_line(line);
-        if (!cmds || !cmds->pipeline || !cmds->pipeline->argv[0]) {
-            free_commands(cmds);
-            continue;
-        }
-        add_history(line);
-        CmdOp prev = OP_SEMI;
-        for (Command *c = cmds; c; c = c->next) {
-            int run = 1;
-            if (c != cmds) {
-                if (prev == OP_AND)
-                    run = (last_status == 0);
-                else if (prev == OP_OR)
-                    run = (last_status != 0);
-            }
-            if (run)
-                run_pipeline(c, line);
-            prev = c->op;
-        }
-        free_commands(cmds);
-    }
-}
-
 /* Read commands from a file and execute them in the current shell
  * environment. Additional arguments become script parameters. */
 int builtin_source(char **args) {
@@ -105,13 +75,12 @@ int builtin_source(char **args) {
         return 1;
     }
 
-    FILE *prev_input = parse_input;
     FILE *input = NULL;
 
     if (strchr(args[1], '/')) {
         input = fopen(args[1], "r");
     } else {
-        const char *pathenv = getenv("PATH");
+        const char *pathenv = get_env_var("PATH");
         if (pathenv && *pathenv) {
             char *paths = strdup(pathenv);
             if (paths) {
@@ -147,11 +116,9 @@ int builtin_source(char **args) {
         return 1;
     }
 
-    parse_input = input;
-    execute_source_file(input);
+    run_script(input, 0);
     fclose(input);
     restore_source_args(old_argc, old_argv, new_argc);
-    parse_input = prev_input;
     return 1;
 }
 
@@ -188,6 +155,8 @@ int builtin_exec(char **args) {
         fprintf(stderr, "usage: exec command [args...]\n");
         return 1;
     }
+    environ = shell_environ();
+    history_flush();
     execvp(args[1], &args[1]);
     perror(args[1]);
     return 1;
@@ -237,7 +206,7 @@ int builtin_command(char **args) {
             }
             if (is_builtin)
                 continue;
-            const char *pathenv = opt_p ? fallback : getenv("PATH");
+            const char *pathenv = opt_p ? fallback : get_env_var("PATH");
             if (!pathenv || !*pathenv)
                 pathenv = fallback;
             char *paths = strdup(pathenv);
@@ -276,10 +245,11 @@ int builtin_command(char **args) {
         return 1;
     }
 
-    pid_t pid = fork();
+    pid_t pid = shell_fork();
     if (pid == 0) {
         if (opt_p)
-            setenv("PATH", fallback, 1);
+            export_var("PATH", fallback);
+        environ = shell_environ();
         execvp(args[i], &args[i]);
         perror(args[i]);
         _exit(127);
@@ -18,6 +18,7 @@
 #include "dirstack.h"
 #include "shell_state.h"
 #include "util.h"
+#include "vars.h"
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -81,7 +82,7 @@ static const char *resolve_cd_target(const char *dir, int physical, char *buf,
     /* Search CDPATH when the argument does not contain a slash and is not
      * absolute. */
     if (res[0] != '/' && res[0] != '.' && strchr(res, '/') == NULL) {
-        const char *cdpath = getenv("CDPATH");
+        const char *cdpath = get_env_var("CDPATH");
         if (cdpath && *cdpath) {
             char *paths = xstrdup(cdpath);
             for (char *p = strtok(paths, ":"); p; p = strtok(NULL, ":")) {
@@ -163,15 +164,15 @@ static void update_pwd(const char *oldpwd, const char *dir, int physical,
         canonicalize_logical(newpwd, newpwd, pathmax);
     }
 
-    setenv("OLDPWD", oldpwd, 1);
-    setenv("PWD", newpwd, 1);
+    export_var("OLDPWD", oldpwd);
+    export_var("PWD", newpwd);
     free(newpwd);
 }
 
 /* Print the current directory using -P or -L semantics. */
 static void print_pwd(int physical)
 {
-    if (physical || !getenv("PWD")) {
+    if (physical || !get_env_var("PWD")) {
         char *cwd = getcwd(NULL, 0);
         if (cwd) {
             printf("%s\n", cwd);
@@ -180,7 +181,7 @@ static void print_pwd(int physical)
             perror("pwd");
         }
     } else {
-        printf("%s\n", getenv("PWD"));
+        printf("%s\n", get_env_var("PWD"));
     }
 }
 
@@ -213,9 +214,9 @@ int builtin_cd(char **args) {
 
     const char *target;
     if (!args[idx]) {
-        target = getenv("HOME");
+        target = get_env_var("HOME");
     } else if (strcmp(args[idx], "-") == 0) {
-        target = getenv("OLDPWD");
+        target = get_env_var("OLDPWD");
         if (!target) {
             buf = getcwd(NULL, 0);
             if (!buf) {
@@ -244,7 +245,7 @@ int builtin_cd(char **args) {
         return 1;
     }
 
-    const char *oldpwd = getenv("PWD");
+    const char *oldpwd = get_env_var("PWD");
     if (!oldpwd)
         oldpwd = prev;
     update_pwd(oldpwd, dir, physical, pathmax);
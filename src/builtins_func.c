@@ -97,8 +97,7 @@ void load_functions(void)
         Command *cmds = parse_line(line);
         for (Command *c = cmds; c; c = c->next) {
             if (c->type == CMD_FUNCDEF) {
-                define_function(c->var, NULL, c->text);
-                free_commands(c->body);
+                define_function(c->var, c->body, c->text);
                 c->body = NULL;
             }
         }
@@ -107,9 +106,54 @@ void load_functions(void)
     fclose(f);
 }
 
+/*
+ * Parse TEXT into the command tree cached on a function entry.  Bodies
+ * whose parse has side effects are left uncached: here-documents read
+ * input and process substitutions spawn children while parsing, so the
+ * body is only inspected here and run_function() parses those on every
+ * call.  A body that fails to parse is also left uncached so the syntax
+ * error is reported when the function runs, as before.
+ */
+static Command *parse_function_body(const char *text)
+{
+    char *copy = strdup(text);
+    if (!copy)
+        return NULL;
+    int saved_status = last_status;
+    int saved_inspect = parse_inspect;
+    parse_inspect = 1;
+    Command *body = parse_line(copy);
+    parse_inspect = saved_inspect;
+    free(copy);
+    last_status = saved_status;
+    if (has_here_or_proc_subst(body)) {
+        free_commands(body);
+        return NULL;
+    }
+    return body;
+}
+
+/* Free the memory held by function entry F. */
+static void free_function_entry(FuncEntry *f)
+{
+    free(f->name);
+    free(f->text);
+    free_commands(f->body);
+    free(f);
+}
+
+void release_function(FuncEntry *fn)
+{
+    if (--fn->refs == 0)
+        free_function_entry(fn);
+}
+
 /*
  * Add or replace a function definition.  The original text of the
- * function body is kept so save_functions() can write it back verbatim.
+ * function body is kept so save_functions() can write it back verbatim
+ * and the parsed form is cached so calls do not re-parse it.  BODY is
+ * an already parsed tree for TEXT which is taken over, or NULL to parse
+ * TEXT here.
  */
 void define_function(const char *name, Command *body, const char *text)
 {
@@ -130,13 +174,38 @@ void define_function(const char *name, Command *body, const char *text)
                 free_commands(body);
                 return;
             }
+            if (!body)
+                body = parse_function_body(new_text);
+            if (f->refs > 1) {
+                /*
+                 * The function is redefining itself while running.  The
+                 * running call keeps the old entry alive, so install a
+                 * fresh entry and let release_function() free the old one.
+                 */
+                FuncEntry *fn = malloc(sizeof(FuncEntry));
+                if (!fn) {
+                    perror("malloc");
+                    last_status = 1;
+                    free(new_name);
+                    free(new_text);
+                    free_commands(body);
+                    return;
+                }
+                fn->name = new_name;
+                fn->text = new_text;
+                fn->body = body;
+                fn->refs = 1;
+                list_remove(&functions, &f->node);
+                list_append(&functions, &fn->node);
+                release_function(f);
+                return;
+            }
             free(f->name);
             free(f->text);
             free_commands(f->body);
             f->name = new_name;
             f->text = new_text;
-            f->body = NULL;
-            free_commands(body);
+            f->body = body;
             return;
         }
     }
@@ -165,8 +234,8 @@ void define_function(const char *name, Command *body, const char *text)
     }
     fn->name = name_copy;
     fn->text = text_copy;
-    fn->body = NULL;
-    free_commands(body);
+    fn->body = body ? body : parse_function_body(text_copy);
+    fn->refs = 1;
     list_append(&functions, &fn->node);
 }
 
@@ -192,10 +261,7 @@ void remove_function(const char *name)
         FuncEntry *f = LIST_ENTRY(n, FuncEntry, node);
         if (strcmp(f->name, name) == 0) {
             list_remove(&functions, &f->node);
-            free(f->name);
-            free(f->text);
-            free_commands(f->body);
-            free(f);
+            release_function(f);
             return;
         }
     }
@@ -208,10 +274,7 @@ static void free_function_entries(void)
     while (n) {
         ListNode *next = n->next;
         FuncEntry *f = LIST_ENTRY(n, FuncEntry, node);
-        free(f->name);
-        free(f->text);
-        free_commands(f->body);
-        free(f);
+        release_function(f);
         n = next;
     }
     list_init(&functions);
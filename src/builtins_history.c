@@ -12,6 +12,7 @@
 #include "util.h"
 
 #include "shell_state.h"
+#include "vars.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -232,7 +233,7 @@ static int fc_edit_commands(int start, int end, int step, const FcOptions *opts)
     }
 
     const char *editor = opts->editor;
-    const char *tmpdir = getenv("TMPDIR");
+    const char *tmpdir = get_env_var("TMPDIR");
     if (!tmpdir || !*tmpdir)
         tmpdir = "/tmp";
     size_t len = strlen(tmpdir) + sizeof("/vush_fcXXXXXX");
@@ -267,12 +268,13 @@ static int fc_edit_commands(int start, int end, int step, const FcOptions *opts)
     fflush(f);
 
     if (!editor)
-        editor = getenv("FCEDIT");
+        editor = get_env_var("FCEDIT");
     if (!editor || !*editor)
         editor = "ed";
 
-    pid_t pid = fork();
+    pid_t pid = shell_fork();
     if (pid == 0) {
+        environ = shell_environ();
         execlp(editor, editor, template, NULL);
         perror(editor);
         _exit(127);
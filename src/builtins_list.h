@@ -54,6 +54,7 @@ DEF_BUILTIN(TIME, "time", builtin_time)
 DEF_BUILTIN(TIMES, "times", builtin_times)
 DEF_BUILTIN(UMASK, "umask", builtin_umask)
 DEF_BUILTIN(ULIMIT, "ulimit", builtin_ulimit)
+DEF_BUILTIN(VUSHSTAT, "vushstat", builtin_vushstat)
 DEF_BUILTIN(SOURCE, "source", builtin_source)
 DEF_BUILTIN(DOT, ".", builtin_source)
 DEF_BUILTIN(HELP, "help", builtin_help)
@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include "shell_state.h"
+#include "vars.h"
 /* Manage or display command hash table. */
 int builtin_hash(char **args) {
     int i = 1;
@@ -112,6 +113,7 @@ int builtin_help(char **args) {
     printf("  set [-e|-u|-x] Toggle shell options\n");
     printf("  test EXPR ([ EXPR ])  Evaluate a test expression (!, -a, -o)\n");
     printf("  ulimit [-HS] [-a|-c|-d|-f|-m|-n|-s|-t|-u|-v] [limit]  Display or set resource limits\n");
+    printf("  vushstat [-mr] [name...]  Report or reset internal counters\n");
     printf("  eval WORDS  Concatenate arguments and execute the result\n");
     printf("  exec CMD [ARGS]  Replace the shell with CMD\n");
     printf("  source FILE [ARGS...] (. FILE [ARGS...])\n");
@@ -161,7 +163,7 @@ int builtin_type(char **args) {
         }
         if (is_builtin)
             continue;
-        const char *pathenv = getenv("PATH");
+        const char *pathenv = get_env_var("PATH");
         if (!pathenv)
             pathenv = "/bin:/usr/bin";
         char *paths = strdup(pathenv);
@@ -252,7 +252,7 @@ int builtin_read(char **args) {
 
     const char *ifs = get_shell_var("IFS");
     if (!ifs)
-        ifs = getenv("IFS");
+        ifs = get_env_var("IFS");
     char sep = (ifs && *ifs) ? ifs[0] : ' ';
 
     int array_mode = array_name != NULL;
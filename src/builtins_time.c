@@ -13,6 +13,9 @@
 #include <sys/wait.h>
 #include <time.h>
 #include "shell_state.h"
+#include "vars.h"
+#include "util.h"
+#include "stats.h"
 #include <string.h>
 #include <sys/times.h>
 #include <unistd.h>
@@ -58,8 +61,9 @@ int builtin_time_callback(int (*func)(void *), void *data, int posix)
 static int exec_cmd(void *d)
 {
     char **av = ((struct run_data *)d)->argv;
-    pid_t pid = fork();
+    pid_t pid = shell_fork();
     if (pid == 0) {
+        environ = shell_environ();
         execvp(av[0], av);
         perror(av[0]);
         _exit(127);
@@ -124,3 +128,46 @@ int builtin_times(char **args)
     return 1;
 }
 
+
+/* Print one counter of vushstat in the chosen format. */
+static void print_stat(const char *name, unsigned long value, int machine)
+{
+    if (machine)
+        printf("%s=%lu\n", name, value);
+    else
+        printf("%-12s %lu\n", name, value);
+}
+
+/* Report the shell's internal counters, optionally resetting them. */
+int builtin_vushstat(char **args)
+{
+    int machine = 0, reset = 0;
+    int idx = parse_builtin_options(args, "mr", &machine, &reset);
+    if (idx < 0) {
+        fprintf(stderr, "usage: vushstat [-mr] [name...]\n");
+        last_status = 1;
+        return 1;
+    }
+
+    int status = 0;
+    unsigned long value;
+    if (args[idx]) {
+        for (int i = idx; args[i]; i++) {
+            if (stats_get(args[i], &value) < 0) {
+                fprintf(stderr, "vushstat: %s: unknown counter\n", args[i]);
+                status = 1;
+                continue;
+            }
+            print_stat(args[i], value, machine);
+        }
+    } else if (!reset || machine) {
+        for (int i = 0; stats_names[i]; i++) {
+            stats_get(stats_names[i], &value);
+            print_stat(stats_names[i], value, machine);
+        }
+    }
+    if (reset)
+        stats_reset();
+    last_status = status;
+    return 1;
+}
@@ -6,7 +6,7 @@
 
 /*
  * This module implements the builtins used to manipulate shell variables and
- * arrays.  A small linked list stores all shell variables so that both
+ * arrays.  The hash table in vars.c stores all shell variables so that both
  * builtins and expansion code share the same state.  Routines here are
  * responsible for looking up variables, creating or deleting them and keeping
  * array values in sync.  Builtin commands such as `set`, `export`, `read` and
@@ -25,6 +25,7 @@
 #include "vars.h"
 #include "options.h"
 #include "lineedit.h"
+#include "profile.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,7 +47,9 @@ static void list_shell_options(void)
 {
     print_option("allexport", opt_allexport);
     print_option("errexit", opt_errexit);
+    print_option("globstar", opt_globstar);
     print_option("hashall", opt_hashall);
+    print_option("histrank", opt_histrank);
     print_option("ignoreeof", opt_ignoreeof);
     print_option("keyword", opt_keyword);
     print_option("monitor", opt_monitor);
@@ -58,6 +61,7 @@ static void list_shell_options(void)
     print_option("onecmd", opt_onecmd);
     print_option("pipefail", opt_pipefail);
     print_option("privileged", opt_privileged);
+    print_option("profile", opt_profile);
     print_option("posix", opt_posix);
     print_option("emacs", lineedit_mode == LINEEDIT_EMACS);
     print_option("vi", lineedit_mode == LINEEDIT_VI);
@@ -158,6 +162,14 @@ int builtin_set(char **args) {
                 opt_ignoreeof = 1;
             else if (strcmp(args[i+1], "posix") == 0)
                 opt_posix = 1;
+            else if (strcmp(args[i+1], "globstar") == 0)
+                opt_globstar = 1;
+            else if (strcmp(args[i+1], "histrank") == 0)
+                opt_histrank = 1;
+            else if (strcmp(args[i+1], "profile") == 0) {
+                opt_profile = 1;
+                profile_start();
+            }
             else if (strcmp(args[i+1], "vi") == 0)
                 lineedit_mode = LINEEDIT_VI;
             else if (strcmp(args[i+1], "emacs") == 0)
@@ -207,6 +219,12 @@ int builtin_set(char **args) {
                 opt_ignoreeof = 0;
             else if (strcmp(args[i+1], "posix") == 0)
                 opt_posix = 0;
+            else if (strcmp(args[i+1], "globstar") == 0)
+                opt_globstar = 0;
+            else if (strcmp(args[i+1], "histrank") == 0)
+                opt_histrank = 0;
+            else if (strcmp(args[i+1], "profile") == 0)
+                opt_profile = 0;
             else if (strcmp(args[i+1], "vi") == 0)
                 lineedit_mode = LINEEDIT_EMACS;
             else if (strcmp(args[i+1], "emacs") == 0)
@@ -346,8 +364,7 @@ int builtin_unset(char **args) {
 
 static void list_exports(void)
 {
-    extern char **environ;
-    for (char **e = environ; *e; e++) {
+    for (char **e = shell_environ(); *e; e++) {
         char *eq = strchr(*e, '=');
         if (eq) {
             printf("export %.*s='", (int)(eq - *e), *e);
@@ -383,7 +400,7 @@ int builtin_export(char **args) {
     }
 
     if (strcmp(args[1], "-n") == 0 && args[2] && !args[3]) {
-        unset_var(args[2]);
+        set_var_exported(args[2], 0);
         return 1;
     }
 
@@ -0,0 +1,240 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Compiled case statement patterns.
+ */
+
+/*
+ * A case statement with many arms used to call fnmatch() on every pattern
+ * of every arm each time it ran.  The patterns are now sorted into kinds
+ * when the statement is parsed:
+ *
+ *   - literal patterns are stored in a hash table mapping the text to the
+ *     first arm that lists it;
+ *   - patterns using only `*` and `?` are matched by a small backtracking
+ *     matcher, `*` alone matches everything;
+ *   - bracket expressions and escapes still go through fnmatch();
+ *   - patterns containing `$` or a command substitution are expanded each
+ *     time.
+ *
+ * Selecting an arm looks the word up in the hash table and then tries the
+ * remaining patterns in order, stopping at the literal arm found, so the
+ * result is the same as checking every arm from the top.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fnmatch.h>
+
+#include "case_match.h"
+#include "var_expand.h"
+#include "util.h"
+
+typedef enum {
+    CP_ANY,         /* `*` */
+    CP_WILD,        /* only `*` and `?` */
+    CP_FNMATCH,     /* anything else fnmatch() understands */
+    CP_EXPAND,      /* expanded on every use, then a glob */
+    CP_EXPAND_LIT   /* expanded on every use, then compared literally */
+} CasePatKind;
+
+typedef struct {
+    CasePatKind kind;
+    const char *pat;    /* borrowed from the CaseItem */
+    int arm;
+} CasePat;
+
+typedef struct {
+    char *key;
+    int arm;
+} CaseLit;
+
+struct CaseMatch {
+    CaseItem **arms;
+    int narms;
+    CasePat *pats;      /* non-literal patterns in arm order */
+    int npats;
+    CaseLit *lits;      /* open addressed, nlits is a power of two */
+    size_t nlits;
+    int subject_expand;
+};
+
+/* Return non-zero if S needs expansion before it can be matched. */
+static int needs_expand(const char *s) {
+    return strchr(s, '$') || strchr(s, '`');
+}
+
+/* Return a copy of the unquoted pattern S with backslash escapes removed,
+ * or NULL if S contains wildcards. */
+static char *literal_text(const char *s) {
+    char *res = xmalloc(strlen(s) + 1);
+    char *d = res;
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) {
+            *d++ = *++s;
+            continue;
+        }
+        if (*s == '*' || *s == '?' || *s == '[') {
+            free(res);
+            return NULL;
+        }
+        *d++ = *s;
+    }
+    *d = '\0';
+    return res;
+}
+
+/* Add literal KEY for ARM unless an earlier arm already owns it.  KEY is
+ * owned by the table afterwards. */
+static void add_literal(CaseMatch *cm, char *key, int arm) {
+    size_t mask = cm->nlits - 1;
+    for (size_t i = hash_string(key) & mask;; i = (i + 1) & mask) {
+        if (!cm->lits[i].key) {
+            cm->lits[i].key = key;
+            cm->lits[i].arm = arm;
+            return;
+        }
+        if (strcmp(cm->lits[i].key, key) == 0) {
+            free(key);
+            return;
+        }
+    }
+}
+
+/* Return the arm of the literal pattern WORD or INT_MAX. */
+static int find_literal(CaseMatch *cm, const char *word) {
+    if (!cm->nlits)
+        return INT_MAX;
+    size_t mask = cm->nlits - 1;
+    for (size_t i = hash_string(word) & mask; cm->lits[i].key;
+         i = (i + 1) & mask) {
+        if (strcmp(cm->lits[i].key, word) == 0)
+            return cm->lits[i].arm;
+    }
+    return INT_MAX;
+}
+
+/* Match S against P containing only `*` and `?`.  A failed `*` resumes
+ * one character further, which is enough since later stars can absorb
+ * anything an earlier one could. */
+static int wild_match(const char *p, const char *s) {
+    const char *star = NULL, *resume = NULL;
+    while (*s) {
+        if (*p == '*') {
+            star = p++;
+            resume = s;
+        } else if (*p == '?' || *p == *s) {
+            p++;
+            s++;
+        } else if (star) {
+            p = star + 1;
+            s = ++resume;
+        } else {
+            return 0;
+        }
+    }
+    while (*p == '*')
+        p++;
+    return *p == '\0';
+}
+
+CaseMatch *compile_case(CaseItem *items, int subject_expand) {
+    CaseMatch *cm = xcalloc(1, sizeof(*cm));
+    cm->subject_expand = subject_expand;
+    int total = 0;
+    for (CaseItem *ci = items; ci; ci = ci->next) {
+        cm->narms++;
+        total += ci->pattern_count;
+    }
+    cm->arms = xcalloc(cm->narms ? cm->narms : 1, sizeof(*cm->arms));
+    cm->pats = xcalloc(total ? total : 1, sizeof(*cm->pats));
+    size_t want = 1;
+    while (want < (size_t)total * 2)
+        want <<= 1;
+    cm->lits = xcalloc(want, sizeof(*cm->lits));
+    cm->nlits = want;
+
+    int arm = 0;
+    for (CaseItem *ci = items; ci; ci = ci->next, arm++) {
+        cm->arms[arm] = ci;
+        for (int i = 0; i < ci->pattern_count; i++) {
+            const char *pat = ci->patterns[i];
+            int quoted = ci->pattern_quoted && ci->pattern_quoted[i];
+            int expand = !ci->pattern_expand || ci->pattern_expand[i];
+            CasePat *cp = &cm->pats[cm->npats];
+            cp->pat = pat;
+            cp->arm = arm;
+            if (expand && needs_expand(pat)) {
+                cp->kind = quoted ? CP_EXPAND_LIT : CP_EXPAND;
+                cm->npats++;
+                continue;
+            }
+            char *lit = quoted ? xstrdup(pat) : literal_text(pat);
+            if (lit) {
+                add_literal(cm, lit, arm);
+                continue;
+            }
+            if (strcmp(pat, "*") == 0)
+                cp->kind = CP_ANY;
+            else if (strpbrk(pat, "[\\"))
+                cp->kind = CP_FNMATCH;
+            else
+                cp->kind = CP_WILD;
+            cm->npats++;
+        }
+    }
+    return cm;
+}
+
+/* Return non-zero if WORD matches the non-literal pattern CP. */
+static int pat_matches(const CasePat *cp, const char *word) {
+    switch (cp->kind) {
+    case CP_ANY:
+        return 1;
+    case CP_WILD:
+        return wild_match(cp->pat, word);
+    case CP_FNMATCH:
+        return fnmatch(cp->pat, word, 0) == 0;
+    case CP_EXPAND:
+    case CP_EXPAND_LIT: {
+        char *exp = expand_var(cp->pat);
+        if (!exp)
+            return 0;
+        int m = cp->kind == CP_EXPAND_LIT ? strcmp(exp, word) == 0
+                                          : fnmatch(exp, word, 0) == 0;
+        free(exp);
+        return m;
+    }
+    }
+    return 0;
+}
+
+CaseItem *case_select(CaseMatch *cm, const char *word) {
+    char *exp = NULL;
+    if (cm->subject_expand && strpbrk(word, "$`\\~")) {
+        exp = expand_var(word);
+        if (exp)
+            word = exp;
+    }
+    int best = find_literal(cm, word);
+    for (int i = 0; i < cm->npats && cm->pats[i].arm < best; i++) {
+        if (pat_matches(&cm->pats[i], word)) {
+            best = cm->pats[i].arm;
+            break;
+        }
+    }
+    free(exp);
+    return best == INT_MAX ? NULL : cm->arms[best];
+}
+
+void free_case_match(CaseMatch *cm) {
+    if (!cm)
+        return;
+    for (size_t i = 0; i < cm->nlits; i++)
+        free(cm->lits[i].key);
+    free(cm->lits);
+    free(cm->pats);
+    free(cm->arms);
+    free(cm);
+}
@@ -0,0 +1,25 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Compiled case statement patterns.
+ */
+
+#ifndef CASE_MATCH_H
+#define CASE_MATCH_H
+
+#include "parser.h"
+
+typedef struct CaseMatch CaseMatch;
+
+/*
+ * Compile the patterns of ITEMS, built by the parser, into a matcher.
+ * Literal patterns go into a hash table and wildcard patterns are
+ * classified once so selecting an arm does not rescan every pattern.
+ * SUBJECT_EXPAND tells whether the case word needs expansion.
+ */
+CaseMatch *compile_case(CaseItem *items, int subject_expand);
+/* Expand the case word WORD and return the first arm it matches or NULL. */
+CaseItem *case_select(CaseMatch *cm, const char *word);
+void free_case_match(CaseMatch *cm);
+
+#endif /* CASE_MATCH_H */
@@ -6,66 +6,290 @@
 
 #define _GNU_SOURCE
 #include "cmd_subst.h"
-#include "parser.h" /* for MAX_LINE and parse_line */
+#include "parser.h" /* for parse_line */
 #include "execute.h"
 #include "options.h"
+#include "builtins.h"
+#include "func_exec.h"
+#include "vars.h"
+#include "util.h"
+#include <fcntl.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 #include <stdio.h>
+#include <errno.h>
 
+/* Initial size of the capture buffer and the minimum amount of free space
+ * offered to each read() call. */
+#define CAPTURE_CHUNK 65536
+
+unsigned long command_output_count;
+
+/* Read FD until end of file into a newly allocated string.  The buffer
+ * doubles whenever less than CAPTURE_CHUNK bytes remain so large outputs
+ * are collected in few system calls.  All trailing newlines are removed as
+ * required by POSIX.  Returns NULL on allocation failure. */
+static char *read_capture(int fd) {
+    size_t cap = CAPTURE_CHUNK;
+    size_t total = 0;
+    char *buf = malloc(cap);
+    if (!buf)
+        return NULL;
+    for (;;) {
+        if (cap - total < CAPTURE_CHUNK) {
+            char *tmp = realloc(buf, cap * 2);
+            if (!tmp) {
+                free(buf);
+                return NULL;
+            }
+            buf = tmp;
+            cap *= 2;
+        }
+        /* leave room for the terminating NUL */
+        ssize_t n = read(fd, buf + total, cap - total - 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        total += (size_t)n;
+    }
+    while (total > 0 && buf[total - 1] == '\n')
+        total--;
+    buf[total] = '\0';
+    /* give back the unused tail of small captures */
+    char *tmp = realloc(buf, total + 1);
+    return tmp ? tmp : buf;
+}
+
+/* Builtins whose only effects are their output and state restored by
+ * output_in_process(). */
+static const char *const inproc_builtins[] = {
+    ":", "true", "false", "echo", "printf", "pwd", "test", "[", "[[", "let",
+    NULL
+};
+
+/* Nesting of function calls examined before giving up and forking. */
+#define INPROC_MAX_DEPTH 8
+
+static int list_in_process(Command *c, int depth, int in_func, int loops);
+
+/* Return non-zero when SEG can run without leaving the current process.
+ * IN_FUNC is set inside function bodies and LOOPS counts enclosing loops
+ * of the body being examined. */
+static int segment_in_process(PipelineSegment *seg, int depth, int in_func,
+                              int loops) {
+    if (!seg)
+        return 1;
+    if (seg->next)
+        return 0;
+    const char *name = seg->argv[0];
+    if (!name)
+        return 1; /* assignments only */
+    for (int i = 0; inproc_builtins[i]; i++) {
+        if (strcmp(name, inproc_builtins[i]) == 0)
+            return 1;
+    }
+    if (in_func && (strcmp(name, "local") == 0 || strcmp(name, "return") == 0))
+        return 1;
+    if (loops && (strcmp(name, "break") == 0 || strcmp(name, "continue") == 0))
+        return 1;
+    for (int i = 0; i < BI_COUNT; i++) {
+        if (strcmp(name, builtin_table[i].name) == 0)
+            return 0;
+    }
+    FuncEntry *fn = find_function(name);
+    if (!fn || !fn->body || depth >= INPROC_MAX_DEPTH)
+        return 0;
+    return list_in_process(fn->body, depth + 1, 1, 0);
+}
+
+/* Return non-zero when every command in C only uses constructs, builtins
+ * and functions that can run in the shell process. */
+static int list_in_process(Command *c, int depth, int in_func, int loops) {
+    for (; c; c = c->next) {
+        if (c->background || c->time_pipeline)
+            return 0;
+        int ok = 0;
+        switch (c->type) {
+        case CMD_PIPELINE:
+            ok = segment_in_process(c->pipeline, depth, in_func, loops);
+            break;
+        case CMD_IF:
+            ok = list_in_process(c->cond, depth, in_func, loops) &&
+                 list_in_process(c->body, depth, in_func, loops) &&
+                 list_in_process(c->else_part, depth, in_func, loops);
+            break;
+        case CMD_WHILE:
+        case CMD_UNTIL:
+            ok = list_in_process(c->cond, depth, in_func, loops) &&
+                 list_in_process(c->body, depth, in_func, loops + 1);
+            break;
+        case CMD_FOR:
+        case CMD_FOR_ARITH:
+            ok = list_in_process(c->body, depth, in_func, loops + 1);
+            break;
+        case CMD_CASE:
+            ok = 1;
+            for (CaseItem *ci = c->cases; ci && ok; ci = ci->next)
+                ok = list_in_process(ci->body, depth, in_func, loops);
+            break;
+        case CMD_GROUP:
+            ok = list_in_process(c->group, depth, in_func, loops);
+            break;
+        case CMD_COND:
+        case CMD_ARITH:
+            ok = 1;
+            break;
+        default:
+            break;
+        }
+        if (!ok)
+            return 0;
+    }
+    return 1;
+}
+
+/* Open an anonymous file to collect in-process output. */
+static int capture_file(void) {
+#ifdef HAVE_MEMFD_CREATE
+    int fd = memfd_create("vush-subst", MFD_CLOEXEC);
+    if (fd >= 0)
+        return fd;
+#endif
+    FILE *f = tmpfile();
+    if (!f)
+        return -1;
+    int fd2 = fcntl(fileno(f), F_DUPFD_CLOEXEC, 0);
+    fclose(f);
+    return fd2;
+}
+
+/*
+ * Run C in the current shell with stdout sent to an anonymous file and
+ * store what it wrote in *OUT.  The shell state, loop and return flags
+ * and every variable changed by C are restored afterwards so the
+ * substitution behaves as if it had run in a subshell.  Returns 0 without
+ * running anything when the output file cannot be set up.
+ */
+static int output_in_process(Command *c, const char *cmd, char **out) {
+    int fd = capture_file();
+    if (fd < 0)
+        return 0;
+    fflush(stdout);
+    int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (saved_out < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+        if (saved_out >= 0)
+            close(saved_out);
+        close(fd);
+        return 0;
+    }
+
+    ShellState saved_state = shell_state;
+    int saved_break = loop_break;
+    int saved_continue = loop_continue;
+    int saved_depth = loop_depth;
+    int saved_return = func_return;
+    void *mark = checkpoint_shell_vars();
+
+    run_command_list(c, cmd);
+
+    rollback_shell_vars(mark);
+    shell_state = saved_state;
+    loop_break = saved_break;
+    loop_continue = saved_continue;
+    loop_depth = saved_depth;
+    func_return = saved_return;
+
+    fflush(stdout);
+    dup2(saved_out, STDOUT_FILENO);
+    close(saved_out);
+    *out = NULL;
+    if (lseek(fd, 0, SEEK_SET) == 0)
+        *out = read_capture(fd);
+    close(fd);
+    return 1;
+}
 
 /* Execute CMD and capture its stdout using the shell itself so that shell
- * variables and functions are visible.  The command's output is returned as a
- * newly allocated string with any trailing newline removed. */
+ * variables and functions are visible.  Commands built only from builtins
+ * without lasting effects and such functions run in-process; anything else
+ * runs in a forked child.  The command's output is returned as a newly
+ * allocated string with all trailing newlines removed. */
 char *command_output(const char *cmd) {
+    Command *c = NULL;
+    int parsed = 0;
+    command_output_count++;
+    /* here-documents and process substitutions act while parsing, so the
+     * first parse only examines the command and leaves those to the child */
+    int saved_need_more = parse_need_more;
+    int saved_inspect = parse_inspect;
+    char *copy = strdup(cmd);
+    parse_inspect = 1;
+    c = copy ? parse_line(copy) : NULL;
+    parse_inspect = saved_inspect;
+    free(copy);
+    parse_need_more = saved_need_more;
+    if (has_here_or_proc_subst(c)) {
+        free_commands(c);
+        c = NULL;
+    } else {
+        parsed = 1;
+        char *res;
+        if (c && !opt_errexit && !opt_hashall && !proc_subs_pending() &&
+            list_in_process(c, 0, 0, 0) && output_in_process(c, cmd, &res)) {
+            free_commands(c);
+            return res;
+        }
+    }
+
     int saved_notify = opt_notify;
     opt_notify = 0;
 
     int pipefd[2];
     if (pipe(pipefd) != 0) {
         opt_notify = saved_notify;
+        free_commands(c);
         return NULL;
     }
 
-    pid_t pid = fork();
+    pid_t pid = shell_fork();
     if (pid == 0) {
         signal(SIGINT, SIG_DFL);
         close(pipefd[0]);
         dup2(pipefd[1], STDOUT_FILENO);
         close(pipefd[1]);
-        char *copy = strdup(cmd);
-        Command *c = copy ? parse_line(copy) : NULL;
-        free(copy);
+        if (!parsed) {
+            char *copy = strdup(cmd);
+            c = copy ? parse_line(copy) : NULL;
+            free(copy);
+        }
         if (c) {
             run_command_list(c, cmd);
             free_commands(c);
         }
-        exit(last_status);
+        /* _exit so stdio does not rewind a script file shared with the
+         * parent while flushing its input buffers */
+        fflush(stdout);
+        _exit(last_status);
     } else if (pid > 0) {
         close(pipefd[1]);
-        char out[MAX_LINE];
-        size_t total = 0;
-        ssize_t n;
-        while ((n = read(pipefd[0], out + total, sizeof(out) - 1 - total)) > 0) {
-            total += (size_t)n;
-            if (total >= sizeof(out) - 1)
-                break;
-        }
+        char *ret = read_capture(pipefd[0]);
         close(pipefd[0]);
         waitpid(pid, NULL, 0);
         opt_notify = saved_notify;
-        if (total > 0 && out[total - 1] == '\n')
-            total--;
-        out[total] = '\0';
-        char *ret = strdup(out);
+        free_commands(c);
         return ret;
     } else {
         close(pipefd[0]);
         close(pipefd[1]);
         opt_notify = saved_notify;
+        free_commands(c);
         return NULL;
     }
 }
@@ -88,8 +312,8 @@ char *parse_substitution(char **p) {
         depth = 1;
     }
 
-    char cmd[MAX_LINE];
-    int clen = 0;
+    const char *start = *p;
+    size_t clen = 0;
     while (**p) {
         if (is_dollar) {
             if (**p == '(') {
@@ -106,8 +330,7 @@ char *parse_substitution(char **p) {
             break;
         }
 
-        if (clen < MAX_LINE - 1)
-            cmd[clen++] = **p;
+        clen++;
         (*p)++;
     }
 
@@ -116,10 +339,11 @@ char *parse_substitution(char **p) {
         return NULL;
     }
 
-    cmd[clen] = '\0';
-    char *res = command_output(cmd);
-    if (!res)
+    char *cmd = strndup(start, clen);
+    if (!cmd)
         return NULL;
+    char *res = command_output(cmd);
+    free(cmd);
     return res;
 }
 
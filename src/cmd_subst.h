@@ -7,6 +7,10 @@
 #ifndef CMD_SUBST_H
 #define CMD_SUBST_H
 
+/* Number of command substitutions run so far.  Callers caching file system
+ * state during expansion compare it to notice substitutions in between. */
+extern unsigned long command_output_count;
+
 char *command_output(const char *cmd);
 char *parse_substitution(char **p);
 
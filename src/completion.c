@@ -20,6 +20,7 @@
 #include <limits.h>
 #include "shell_state.h"
 #include "util.h"
+#include "vars.h"
 
 static int cmpstr(const void *a, const void *b) {
     const char *aa = *(const char **)a;
@@ -120,7 +121,7 @@ static char **collect_matches(const char *prefix, int prefix_len, int *countp) {
         closedir(d);
     }
 
-    const char *path = getenv("PATH");
+    const char *path = get_env_var("PATH");
     if (path && arr.items) {
         char *pdup = xstrdup(path);
         char *saveptr = NULL;
@@ -17,7 +17,6 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <string.h>
-#include <fnmatch.h>
 
 #include "control.h"
 #include "execute.h"
@@ -27,6 +26,9 @@
 #include "arith.h"
 #include "util.h"
 #include "var_expand.h"
+#include "case_match.h"
+#include "options.h"
+#include "profile.h"
 
 
 int exec_if(Command *cmd, const char *line) {
@@ -52,6 +54,8 @@ int exec_while(Command *cmd, const char *line) {
         }
         if (last_status != 0)
             break;
+        if (opt_profile)
+            profile_iteration();
         run_command_list(cmd->body, line);
         if (loop_break) { loop_break--; break; }
         if (loop_continue) {
@@ -80,6 +84,8 @@ int exec_until(Command *cmd, const char *line) {
         }
         if (last_status == 0)
             break;
+        if (opt_profile)
+            profile_iteration();
         run_command_list(cmd->body, line);
         if (loop_break) { loop_break--; break; }
         if (loop_continue) {
@@ -97,6 +103,9 @@ int exec_until(Command *cmd, const char *line) {
 int exec_for(Command *cmd, const char *line) {
     loop_depth++;
     char *last = NULL;
+    /* the fields of each word live until its iterations are done */
+    Arena fa;
+    arena_init(&fa);
     for (int i = 0; i < cmd->word_count; i++) {
         char *word = cmd->words[i];
         char *exp = cmd->word_expand ?
@@ -106,36 +115,34 @@ int exec_for(Command *cmd, const char *line) {
         int count = 0;
         char **fields;
         if (cmd->word_quoted && cmd->word_quoted[i]) {
-            fields = malloc(2 * sizeof(char *));
-            if (!fields) { free(exp); loop_depth--; free(last); return last_status; }
-            fields[0] = exp;
+            fields = arena_alloc(&fa, 2 * sizeof(char *));
+            fields[0] = arena_own(&fa, exp);
             fields[1] = NULL;
             count = 1;
         } else {
-            fields = split_fields(exp, &count);
-            free(exp);
+            fields = split_fields(exp, &count, &fa);
         }
         for (int fi = 0; fi < count; fi++) {
             char *w = fields[fi];
             if (cmd->var) {
+                /* the loop variable is exported; with the environment
+                 * built lazily this only flags it */
                 set_shell_var(cmd->var, w);
-                setenv(cmd->var, w, 1);
+                set_var_exported(cmd->var, 1);
                 free(last);
                 last = strdup(w);
                 if (!last)
                     perror("strdup");
             }
+            if (opt_profile)
+                profile_iteration();
             run_command_list(cmd->body, line);
             if (loop_break) break;
             if (loop_continue) {
                 if (--loop_continue) {
-                    for (int fj = fi; fj < count; fj++)
-                        free(fields[fj]);
-                    free(fields);
-                    if (cmd->var && last) {
+                    arena_release(&fa);
+                    if (cmd->var && last)
                         set_shell_var(cmd->var, last);
-                        setenv(cmd->var, last, 1);
-                    }
                     free(last);
                     loop_depth--;
                     return last_status;
@@ -143,15 +150,11 @@ int exec_for(Command *cmd, const char *line) {
                 continue;
             }
         }
-        for (int fj = 0; fj < count; fj++)
-            free(fields[fj]);
-        free(fields);
+        arena_release(&fa);
         if (loop_break) { loop_break--; break; }
     }
-    if (cmd->var && last) {
+    if (cmd->var && last)
         set_shell_var(cmd->var, last);
-        setenv(cmd->var, last, 1);
-    }
     free(last);
     loop_depth--;
     return last_status;
@@ -163,7 +166,7 @@ int exec_select(Command *cmd, const char *line) {
     while (1) {
         for (int i = 0; i < cmd->word_count; i++)
             printf("%d) %s\n", i + 1, cmd->words[i]);
-        const char *ps3 = getenv("PS3");
+        const char *ps3 = get_env_var("PS3");
         fputs(ps3 ? ps3 : "? ", stdout);
         fflush(stdout);
         if (!fgets(input, sizeof(input), stdin))
@@ -173,7 +176,9 @@ int exec_select(Command *cmd, const char *line) {
             continue;
         }
         if (cmd->var)
-            setenv(cmd->var, cmd->words[choice - 1], 1);
+            export_var(cmd->var, cmd->words[choice - 1]);
+        if (opt_profile)
+            profile_iteration();
         run_command_list(cmd->body, line);
         if (loop_break) { loop_break--; break; }
         if (loop_continue) {
@@ -188,13 +193,25 @@ int exec_select(Command *cmd, const char *line) {
     return last_status;
 }
 
+/*
+ * Evaluate TEXT using the compiled form cached in *PROG, compiling it the
+ * first time the command runs.
+ */
+static long long run_arith(ArithExpr **prog, const char *text, int *err,
+                           char **msg) {
+    if (!*prog)
+        *prog = compile_arith(text);
+    return eval_compiled_arith(*prog, err, msg);
+}
+
 int exec_for_arith(Command *cmd, const char *line) {
     (void)line;
     int err = 0;
     char *msg = NULL;
     loop_depth++;
 
-    eval_arith(cmd->arith_init ? cmd->arith_init : "0", &err, &msg);
+    run_arith(&cmd->arith_prog[0], cmd->arith_init ? cmd->arith_init : "0",
+              &err, &msg);
     if (err) {
         if (msg) {
             fprintf(stderr, "arith: %s\n", msg);
@@ -208,7 +225,9 @@ int exec_for_arith(Command *cmd, const char *line) {
 
     while (1) {
         err = 0;
-        long cond = eval_arith(cmd->arith_cond ? cmd->arith_cond : "1", &err, &msg);
+        long cond = run_arith(&cmd->arith_prog[1],
+                              cmd->arith_cond ? cmd->arith_cond : "1",
+                              &err, &msg);
         if (err) {
             if (msg) {
                 fprintf(stderr, "arith: %s\n", msg);
@@ -219,6 +238,8 @@ int exec_for_arith(Command *cmd, const char *line) {
         if (cond == 0)
             break;
 
+        if (opt_profile)
+            profile_iteration();
         run_command_list(cmd->body, line);
         if (loop_break) { loop_break--; break; }
         if (loop_continue) {
@@ -227,7 +248,8 @@ int exec_for_arith(Command *cmd, const char *line) {
                 return last_status;
             }
             err = 0;
-            eval_arith(cmd->arith_update ? cmd->arith_update : "0", &err, &msg);
+            run_arith(&cmd->arith_prog[2],
+                      cmd->arith_update ? cmd->arith_update : "0", &err, &msg);
             if (err) {
                 if (msg) {
                     fprintf(stderr, "arith: %s\n", msg);
@@ -239,7 +261,8 @@ int exec_for_arith(Command *cmd, const char *line) {
         }
 
         err = 0;
-        eval_arith(cmd->arith_update ? cmd->arith_update : "0", &err, &msg);
+        run_arith(&cmd->arith_prog[2],
+                  cmd->arith_update ? cmd->arith_update : "0", &err, &msg);
         if (err) {
             if (msg) {
                 fprintf(stderr, "arith: %s\n", msg);
@@ -253,37 +276,23 @@ int exec_for_arith(Command *cmd, const char *line) {
     return last_status;
 }
 
+/* Run the first arm matching the case word and any arms it falls through
+ * to with ;&.  The compiled matcher picks the arm without trying every
+ * pattern in turn. */
 int exec_case(Command *cmd, const char *line) {
-    int fall = 0;
-    for (CaseItem *ci = cmd->cases; ci; ci = ci->next) {
-        if (fall) {
-            run_command_list(ci->body, line);
-            if (!ci->fall_through)
-                break;
-            fall = ci->fall_through;
-            continue;
-        }
-
-        int matched = 0;
-        for (int i = 0; ci->patterns && ci->patterns[i]; i++) {
-            /* ci->patterns is NULL terminated */
-            if (fnmatch(ci->patterns[i], cmd->var, 0) == 0) {
-                matched = 1;
-                break;
-            }
-        }
-        if (matched) {
-            run_command_list(ci->body, line);
-            if (!ci->fall_through)
-                break;
-            fall = ci->fall_through;
-        }
+    if (!cmd->case_match)
+        cmd->case_match = compile_case(cmd->cases, 1);
+    for (CaseItem *ci = case_select(cmd->case_match, cmd->var); ci;
+         ci = ci->next) {
+        run_command_list(ci->body, line);
+        if (!ci->fall_through)
+            break;
     }
     return last_status;
 }
 
 int exec_subshell(Command *cmd, const char *line) {
-    pid_t pid = fork();
+    pid_t pid = shell_fork();
     if (pid == 0) {
         signal(SIGINT, SIG_DFL);
         run_command_list(cmd->group, line);
@@ -328,7 +337,8 @@ int exec_arith(Command *cmd, const char *line) {
     (void)line;
     int err = 0;
     char *msg = NULL;
-    long val = eval_arith(cmd->text ? cmd->text : "0", &err, &msg);
+    long val = run_arith(&cmd->arith_prog[0], cmd->text ? cmd->text : "0",
+                         &err, &msg);
     if (err) {
         if (msg) {
             fprintf(stderr, "arith: %s\n", msg);
@@ -17,6 +17,7 @@
  */
 #define _GNU_SOURCE
 #include "dirstack.h"
+#include "vars.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -73,7 +74,7 @@ void dirstack_print(void) {
     if (cwd) {
         pwd = cwd;
     } else {
-        pwd = getenv("PWD");
+        pwd = get_env_var("PWD");
         if (!pwd)
             pwd = "";
     }
@@ -113,7 +114,7 @@ void update_pwd_env(const char *oldpwd) {
         return;
     if (!oldpwd)
         oldpwd = "";
-    setenv("OLDPWD", oldpwd, 1);
-    setenv("PWD", cwd, 1);
+    export_var("OLDPWD", oldpwd);
+    export_var("PWD", cwd);
     free(cwd);
 }
@@ -38,6 +38,7 @@
 #include "redir.h"
 #include "assignment_utils.h"
 #include "control.h"
+#include "profile.h"
 
 
 int loop_break = 0;
@@ -92,12 +93,13 @@ static int exec_pipeline(Command *cmd, const char *line) {
 
 /*
  * Define a shell function.  The body of the command becomes the new
- * function definition and last_status is preserved.
+ * function definition and last_status is preserved.  A parsed body is
+ * handed over to the function table; later runs of the same definition
+ * (inside a loop or another function) re-parse the saved text.
  */
 static int exec_funcdef(Command *cmd, const char *line) {
     (void)line;
-    define_function(cmd->var, NULL, cmd->text);
-    free_commands(cmd->body);
+    define_function(cmd->var, cmd->body, cmd->text);
     cmd->body = NULL;
     return last_status;
 }
@@ -117,6 +119,10 @@ int run_pipeline(Command *cmd, const char *line) {
                 hash_add(seg->argv[0]);
         }
     }
+    ProfileMark mark;
+    mark.active = 0;
+    if (opt_profile)
+        profile_enter(&mark, cmd);
     int r = 0;
     switch (cmd->type) {
     case CMD_PIPELINE:
@@ -152,6 +158,8 @@ int run_pipeline(Command *cmd, const char *line) {
         last_status = (last_status == 0 ? 1 : 0);
         r = last_status;
     }
+    if (mark.active)
+        profile_leave(&mark);
     return r;
 }
 
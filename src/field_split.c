@@ -4,115 +4,172 @@
  * Field splitting after expansions.
  */
 
+/*
+ * The expanded text is handed to the caller's arena and the fields are
+ * carved out of it in place, so splitting a large command substitution
+ * costs one array and no copies.  The IFS classification is kept between
+ * calls and only rebuilt when the value of IFS changes.  Runs of ordinary
+ * characters are skipped with memchr() when IFS is a single character and
+ * eight bytes at a time for the default IFS.
+ */
 #define _GNU_SOURCE
 #include "var_expand.h"
 #include "vars.h"
-#include "strarray.h"
-#include "cleanup.h"
+#include "util.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-char **split_fields(const char *text, int *count_out) {
-    if (count_out)
-        *count_out = 0;
+typedef enum {
+    IFS_DEFAULT,    /* space, tab and newline */
+    IFS_SINGLE,     /* one character */
+    IFS_GENERAL
+} IfsKind;
 
-    const char *ifs = get_shell_var("IFS");
-    if (!ifs)
-        ifs = getenv("IFS");
-    if (!ifs)
-        ifs = " \t\n";
+typedef struct {
+    char *ifs;              /* value the tables were built for */
+    IfsKind kind;
+    char ws[256];           /* IFS white space: runs form one delimiter */
+    char delim[256];        /* any IFS character */
+} IfsTable;
 
-    if (!*ifs) {
-        char **res = malloc(2 * sizeof(char *));
-        if (!res)
-            return NULL;
-        res[0] = strdup(text);
-        if (!res[0]) {
-            free(res);
-            return NULL;
-        }
-        res[1] = NULL;
-        if (count_out)
-            *count_out = 1;
-        return res;
-    }
+static IfsTable ifs_cache;
 
-    char ws_tab[256] = {0};
-    char other_tab[256] = {0};
+/* Return the tables for IFS, rebuilding them only if IFS changed. */
+static const IfsTable *ifs_table(const char *ifs) {
+    IfsTable *t = &ifs_cache;
+    if (t->ifs && strcmp(t->ifs, ifs) == 0)
+        return t;
+    free(t->ifs);
+    t->ifs = xstrdup(ifs);
+    memset(t->ws, 0, sizeof(t->ws));
+    memset(t->delim, 0, sizeof(t->delim));
+    int n = 0;
     for (const char *p = ifs; *p; p++) {
         unsigned char c = (unsigned char)*p;
         if (c == ' ' || c == '\t' || c == '\n')
-            ws_tab[c] = 1;
-        else
-            other_tab[c] = 1;
+            t->ws[c] = 1;
+        if (!t->delim[c])
+            n++;
+        t->delim[c] = 1;
+    }
+    if (n == 3 && t->ws[' '] && t->ws['\t'] && t->ws['\n'])
+        t->kind = IFS_DEFAULT;
+    else if (n == 1)
+        t->kind = IFS_SINGLE;
+    else
+        t->kind = IFS_GENERAL;
+    return t;
+}
+
+#define ONES  ((uint64_t)0x0101010101010101ULL)
+#define HIGHS ((uint64_t)0x8080808080808080ULL)
+/* non-zero if any byte of V is zero */
+#define HAS_ZERO(v) (((v) - ONES) & ~(v) & HIGHS)
+
+/* Return the first space, tab or newline in [P, END) or END. */
+static char *next_default_delim(char *p, char *end) {
+    while (end - p >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        if (HAS_ZERO(v ^ (ONES * ' ')) | HAS_ZERO(v ^ (ONES * '\t')) |
+            HAS_ZERO(v ^ (ONES * '\n')))
+            break;
+        p += 8;
+    }
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n')
+        p++;
+    return p;
+}
+
+/* Return the first IFS character in [P, END) or END. */
+static char *next_delim(const IfsTable *t, char *p, char *end) {
+    switch (t->kind) {
+    case IFS_DEFAULT:
+        return next_default_delim(p, end);
+    case IFS_SINGLE: {
+        char *d = memchr(p, t->ifs[0], end - p);
+        return d ? d : end;
+    }
+    case IFS_GENERAL:
+        break;
     }
+    while (p < end && !t->delim[(unsigned char)*p])
+        p++;
+    return p;
+}
 
-    CLEANUP_FREE char *dup = strdup(text);
-    if (!dup)
-        return NULL;
-    char *p = dup;
-    char *field_start = dup;
-    CLEANUP_STRARRAY StrArray arr;
-    strarray_init(&arr);
+/* Walk the fields of the LEN bytes at S and return how many there are.
+ * When FIELDS is not NULL the start of each field is stored there and its
+ * delimiter overwritten with a terminator. */
+static int scan_fields(char *s, size_t len, const IfsTable *t, char **fields) {
+    int n = 0;
+    char *end = s + len;
+    char *p = s;
+    char *field_start = s;
     int last_nonspace = 0;
 
-    while (*p) {
-        unsigned char c = (unsigned char)*p;
-        if (ws_tab[c]) {
-            if (p > field_start) {
-                char save = *p;
-                *p = '\0';
-                char *dup_field = strdup(field_start);
-                if (!dup_field || strarray_push(&arr, dup_field) == -1) {
-                    free(dup_field);
-                    goto fail;
+    while (p < end) {
+        p = next_delim(t, p, end);
+        if (p == end)
+            break;
+        if (t->ws[(unsigned char)*p]) {
+            char *stop = p;
+            while (p < end && t->ws[(unsigned char)*p])
+                p++;
+            if (stop > field_start) {
+                if (fields) {
+                    fields[n] = field_start;
+                    *stop = '\0';
                 }
-                *p = save;
+                n++;
             }
-            while (ws_tab[(unsigned char)*p])
-                p++;
-            field_start = p;
             last_nonspace = 0;
-            continue;
-        } else if (other_tab[c]) {
-            char save = *p;
-            *p = '\0';
-            char *dup_field = strdup(field_start);
-            if (!dup_field || strarray_push(&arr, dup_field) == -1) {
-                free(dup_field);
-                goto fail;
+        } else {
+            if (fields) {
+                fields[n] = field_start;
+                *p = '\0';
             }
-            *p = save;
+            n++;
             p++;
-            field_start = p;
             last_nonspace = 1;
-            continue;
         }
-        last_nonspace = 0;
-        p++;
+        field_start = p;
     }
 
-    if (p > field_start || last_nonspace) {
-        char *dup_field = strdup(field_start);
-        if (!dup_field || strarray_push(&arr, dup_field) == -1) {
-            free(dup_field);
-            goto fail;
-        }
+    if (end > field_start || last_nonspace) {
+        if (fields)
+            fields[n] = field_start;
+        n++;
     }
+    return n;
+}
 
-    free(dup);
+char **split_fields(char *text, int *count_out, Arena *arena) {
+    const char *ifs = get_shell_var("IFS");
+    if (!ifs)
+        ifs = get_env_var("IFS");
+    if (!ifs)
+        ifs = " \t\n";
 
-    int cnt = arr.count;
-    char **res = strarray_finish(&arr);
-    if (!res)
-        goto fail_alloc;
+    arena_own(arena, text);
+    if (!*ifs) {
+        char **res = arena_alloc(arena, 2 * sizeof(char *));
+        res[0] = text;
+        res[1] = NULL;
+        if (count_out)
+            *count_out = 1;
+        return res;
+    }
+
+    const IfsTable *t = ifs_table(ifs);
+    size_t len = strlen(text);
+    /* count first so the array is sized exactly, then split in place */
+    int cnt = scan_fields(text, len, t, NULL);
+    char **res = arena_alloc(arena, (size_t)(cnt + 1) * sizeof(char *));
+    scan_fields(text, len, t, res);
+    res[cnt] = NULL;
     if (count_out)
         *count_out = cnt;
     return res;
-
-fail:
-fail_alloc:
-    if (count_out)
-        *count_out = 0;
-    return NULL;
 }
@@ -9,7 +9,9 @@
  *
  * Shell functions are stored as parsed command lists and are executed when
  * the executor encounters their name in a pipeline.  The caller passes the
- * function's command list along with the argument vector that invoked it.  The
+ * function's table entry along with the argument vector that invoked it.
+ * The entry's cached command tree is reused by every call; only bodies the
+ * table declined to cache are parsed from their text on each invocation.  The
  * arguments are duplicated so that `$0`, `$1`, etc. within the body expand
  * properly.  After the call returns these temporary values are discarded and
  * the previous script arguments are restored.
@@ -24,6 +26,8 @@
 #include "builtins.h"
 #include "vars.h"
 #include "util.h"
+#include "options.h"
+#include "profile.h"
 
 
 int func_return = 0;
@@ -31,14 +35,16 @@ int func_return = 0;
 /*
  * Execute a shell function.
  *
- * body - parsed list of commands forming the function body
+ * fn   - function table entry holding the parsed body
  * args - argv array where args[0] is the function name and the rest are
  *        parameters passed by the caller
  *
  * The current script arguments are saved and replaced with duplicates of
  * 'args'. script_argc becomes the number of parameters so that positional
- * expansions like $1 work. run_command_list() then executes 'body'. After it
- * finishes, the original script_argv and script_argc values are restored.
+ * expansions like $1 work. run_command_list() then executes the body. A
+ * reference on 'fn' is held meanwhile so the body stays valid even if the
+ * function redefines or unsets itself. After it finishes, the original
+ * script_argv and script_argc values are restored.
  *
  * Returns the exit status of the function body or 1 if memory allocation
  * fails during setup.
@@ -72,10 +78,24 @@ int run_function(FuncEntry *fn, char **args) {
         return 1;
     }
     func_return = 0;
-    Command *body = parse_line(strdup(fn->text));
+    int profiled = opt_profile;
+    if (profiled)
+        profile_call(args[0]);
+    fn->refs++;
+    Command *body = fn->body;
+    Command *parsed = NULL;
+    if (!body) {
+        char *copy = strdup(fn->text);
+        parsed = copy ? parse_line(copy) : NULL;
+        free(copy);
+        body = parsed;
+    }
     if (body)
         run_command_list(body, fn->text);
-    free_commands(body);
+    free_commands(parsed);
+    if (profiled)
+        profile_return();
+    release_function(fn);
     pop_local_scope();
     for (int i = 0; i < argc; i++)
         free(script_argv[i]);
@@ -15,7 +15,7 @@
 #include "builtins.h"
 
 extern int func_return;
-/* Execute parsed function BODY with argument vector ARGS and return its exit status. */
+/* Execute function FN with argument vector ARGS and return its exit status. */
 int run_function(FuncEntry *fn, char **args);
 
 #endif /* FUNC_EXEC_H */
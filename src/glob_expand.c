@@ -0,0 +1,491 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Pathname expansion.
+ */
+
+/*
+ * Pathname expansion without glob(3).
+ *
+ * glob(3) reopens and rescans every directory for every word, so a command
+ * such as `rm a*.log b*.log c*.log` reads the same directory three times.
+ * Here directory listings are read once into a per-command GlobCache and
+ * all patterns are matched against the cached names.  On Linux the entries
+ * are fetched with getdents64 into a large buffer and the d_type it reports
+ * lets the walker skip non-directories without calling stat().
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "glob_expand.h"
+#include "cmd_subst.h"
+#include "options.h"
+#include "stats.h"
+#include "util.h"
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define USE_GETDENTS64 1
+#endif
+
+/* Size of the buffer handed to each getdents64 call. */
+#define GLOB_DENTS_BUF 65536
+
+struct glob_ent {
+    size_t name;          /* offset of the name in GlobDir.names */
+    unsigned char type;   /* DT_* value or DT_UNKNOWN */
+};
+
+struct GlobDir {
+    char *path;           /* directory as passed to open() */
+    char *names;          /* NUL separated entry names */
+    size_t names_len;
+    size_t names_cap;
+    struct glob_ent *ents;
+    size_t count;
+    size_t cap;
+    struct GlobDir *next;
+};
+
+void glob_cache_init(GlobCache *cache) {
+    cache->buckets = NULL;
+    cache->nbuckets = 0;
+    cache->count = 0;
+    cache->subst_gen = command_output_count;
+}
+
+static void free_dir(struct GlobDir *d) {
+    free(d->path);
+    free(d->names);
+    free(d->ents);
+    free(d);
+}
+
+void glob_cache_release(GlobCache *cache) {
+    for (size_t i = 0; i < cache->nbuckets; i++) {
+        struct GlobDir *d = cache->buckets[i];
+        while (d) {
+            struct GlobDir *n = d->next;
+            free_dir(d);
+            d = n;
+        }
+    }
+    free(cache->buckets);
+    glob_cache_init(cache);
+}
+
+/* Append entry NAME of LEN bytes with TYPE to D.  Returns -1 on failure. */
+static int dir_add(struct GlobDir *d, const char *name, size_t len,
+                   unsigned char type) {
+    if (d->count == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 32;
+        struct glob_ent *tmp = realloc(d->ents, cap * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        d->ents = tmp;
+        d->cap = cap;
+    }
+    if (d->names_len + len + 1 > d->names_cap) {
+        size_t cap = d->names_cap ? d->names_cap : 512;
+        while (d->names_len + len + 1 > cap)
+            cap *= 2;
+        char *tmp = realloc(d->names, cap);
+        if (!tmp)
+            return -1;
+        d->names = tmp;
+        d->names_cap = cap;
+    }
+    memcpy(d->names + d->names_len, name, len + 1);
+    d->ents[d->count].name = d->names_len;
+    d->ents[d->count].type = type;
+    d->count++;
+    d->names_len += len + 1;
+    return 0;
+}
+
+#ifdef USE_GETDENTS64
+struct dirent64_raw {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* Read the entries of PATH into D.  Returns -1 on failure. */
+static int read_dir(struct GlobDir *d, const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    char *buf = malloc(GLOB_DENTS_BUF);
+    if (!buf) {
+        close(fd);
+        return -1;
+    }
+    long n;
+    int rc = 0;
+    while ((n = syscall(SYS_getdents64, fd, buf, GLOB_DENTS_BUF)) > 0) {
+        for (long off = 0; off < n;) {
+            struct dirent64_raw *e = (struct dirent64_raw *)(buf + off);
+            if (dir_add(d, e->d_name, strlen(e->d_name), e->d_type) < 0) {
+                rc = -1;
+                break;
+            }
+            off += e->d_reclen;
+        }
+        if (rc < 0)
+            break;
+    }
+    if (n < 0)
+        rc = -1;
+    free(buf);
+    close(fd);
+    return rc;
+}
+#else
+/* Read the entries of PATH into D.  Returns -1 on failure. */
+static int read_dir(struct GlobDir *d, const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir)
+        return -1;
+    struct dirent *e;
+    int rc = 0;
+    while ((e = readdir(dir))) {
+#ifdef DT_UNKNOWN
+        unsigned char type = e->d_type;
+#else
+        unsigned char type = 0;
+#endif
+        if (dir_add(d, e->d_name, strlen(e->d_name), type) < 0) {
+            rc = -1;
+            break;
+        }
+    }
+    closedir(dir);
+    return rc;
+}
+#endif
+
+/* Return the cached listing of directory PATH, reading it on first use.
+ * Directories that cannot be read are cached as empty. */
+static struct GlobDir *cache_dir(GlobCache *cache, const char *path) {
+    if (cache->nbuckets) {
+        struct GlobDir *d = cache->buckets[hash_string(path) % cache->nbuckets];
+        for (; d; d = d->next)
+            if (strcmp(d->path, path) == 0)
+                return d;
+    }
+    if (cache->count >= cache->nbuckets * 2) {
+        size_t nb = cache->nbuckets ? cache->nbuckets * 4 : 16;
+        struct GlobDir **b = calloc(nb, sizeof(*b));
+        if (!b)
+            return NULL;
+        for (size_t i = 0; i < cache->nbuckets; i++) {
+            struct GlobDir *d = cache->buckets[i];
+            while (d) {
+                struct GlobDir *n = d->next;
+                size_t h = hash_string(d->path) % nb;
+                d->next = b[h];
+                b[h] = d;
+                d = n;
+            }
+        }
+        free(cache->buckets);
+        cache->buckets = b;
+        cache->nbuckets = nb;
+    }
+    struct GlobDir *d = calloc(1, sizeof(*d));
+    if (!d)
+        return NULL;
+    d->path = strdup(path);
+    if (!d->path) {
+        free(d);
+        return NULL;
+    }
+    if (read_dir(d, path) < 0)
+        d->count = 0;
+    size_t h = hash_string(path) % cache->nbuckets;
+    d->next = cache->buckets[h];
+    cache->buckets[h] = d;
+    cache->count++;
+    return d;
+}
+
+/* Return non-zero when the pattern component S of LEN bytes contains an
+ * unescaped wildcard. */
+static int has_meta(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\\' && i + 1 < len)
+            i++;
+        else if (s[i] == '*' || s[i] == '?')
+            return 1;
+        else if (s[i] == '[' && memchr(s + i + 1, ']', len - i - 1))
+            return 1;
+    }
+    return 0;
+}
+
+/* One '/' separated pattern component. */
+struct glob_comp {
+    char *name;
+    int sep;              /* '/' characters written before it */
+};
+
+/* Pattern split into its components.  The separators are counted so that
+ * matches repeat them as written, as glob(3) does; trailing ones still
+ * yield a single '/'. */
+struct glob_pat {
+    struct glob_comp *comps;
+    int ncomps;
+    int absolute;         /* leading '/' characters */
+    int trailing_slash;
+};
+
+/* Growable path buffer shared by the walker. */
+struct glob_path {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+/* Append SEP '/' characters and then NAME to P.  Returns the previous
+ * length so the caller can truncate back to it. */
+static size_t path_push(struct glob_path *p, int sep, const char *name,
+                        int *err) {
+    size_t old = p->len;
+    size_t nlen = strlen(name);
+    if (p->len + sep + nlen + 1 > p->cap) {
+        size_t cap = p->cap ? p->cap : 256;
+        while (p->len + sep + nlen + 1 > cap)
+            cap *= 2;
+        char *tmp = realloc(p->buf, cap);
+        if (!tmp) {
+            *err = 1;
+            return old;
+        }
+        p->buf = tmp;
+        p->cap = cap;
+    }
+    while (sep-- > 0)
+        p->buf[p->len++] = '/';
+    memcpy(p->buf + p->len, name, nlen + 1);
+    p->len += nlen;
+    return old;
+}
+
+static void path_pop(struct glob_path *p, size_t len) {
+    p->len = len;
+    if (p->buf)
+        p->buf[len] = '\0';
+}
+
+/* Return non-zero if the entry at PATH with type TYPE is a directory.
+ * When FOLLOW is zero symbolic links are never treated as directories. */
+static int is_dir(const char *path, unsigned char type, int follow) {
+    if (type == DT_DIR)
+        return 1;
+    if (type != DT_UNKNOWN && (type != DT_LNK || !follow))
+        return 0;
+    struct stat st;
+    if ((follow ? stat(path, &st) : lstat(path, &st)) != 0)
+        return 0;
+    return S_ISDIR(st.st_mode);
+}
+
+struct glob_walk {
+    GlobCache *cache;
+    struct glob_pat *pat;
+    struct glob_path path;
+    StrArray *out;
+    int err;
+};
+
+/* Record the current path as a match. */
+static void add_match(struct glob_walk *w, unsigned char type) {
+    const char *p = w->path.len ? w->path.buf : ".";
+    size_t len = strlen(p);
+    if (w->pat->trailing_slash && !is_dir(p, type, 1))
+        return;
+    char *m = malloc(len + 2);
+    if (!m) {
+        w->err = 1;
+        return;
+    }
+    memcpy(m, p, len + 1);
+    if (w->pat->trailing_slash && (len == 0 || m[len - 1] != '/')) {
+        m[len] = '/';
+        m[len + 1] = '\0';
+    }
+    if (strarray_push(w->out, m) == -1) {
+        free(m);
+        w->err = 1;
+    }
+}
+
+static void walk(struct glob_walk *w, int idx);
+
+/* Match `**` at component IDX: zero or more directories below the current
+ * path, the first joined to it with SEP separators.  Hidden directories and
+ * symbolic links are not descended into. */
+static void walk_globstar(struct glob_walk *w, int idx, int sep) {
+    int last = idx + 1 == w->pat->ncomps;
+    if (!last)
+        walk(w, idx + 1);
+    struct GlobDir *d = cache_dir(w->cache, w->path.len ? w->path.buf : ".");
+    if (!d) {
+        w->err = 1;
+        return;
+    }
+    for (size_t i = 0; i < d->count && !w->err; i++) {
+        const char *name = d->names + d->ents[i].name;
+        if (name[0] == '.')
+            continue;
+        unsigned char type = d->ents[i].type;
+        size_t old = path_push(&w->path, sep, name, &w->err);
+        if (w->err)
+            return;
+        if (last)
+            add_match(w, type);
+        if (is_dir(w->path.buf, type, 0))
+            walk_globstar(w, idx, 1);
+        path_pop(&w->path, old);
+    }
+}
+
+/* Match pattern components from IDX onward below the current path. */
+static void walk(struct glob_walk *w, int idx) {
+    struct glob_pat *pat = w->pat;
+    if (idx == pat->ncomps) {
+        add_match(w, DT_UNKNOWN);
+        return;
+    }
+    const char *comp = pat->comps[idx].name;
+    int sep = pat->comps[idx].sep;
+    int last = idx + 1 == pat->ncomps;
+
+    if (opt_globstar && strcmp(comp, "**") == 0) {
+        walk_globstar(w, idx, sep);
+        return;
+    }
+
+    if (!has_meta(comp, strlen(comp))) {
+        char *lit = strdup(comp);
+        if (!lit) {
+            w->err = 1;
+            return;
+        }
+        char *dst = lit;
+        for (const char *s = comp; *s; s++) {
+            if (*s == '\\' && s[1])
+                s++;
+            *dst++ = *s;
+        }
+        *dst = '\0';
+        size_t old = path_push(&w->path, sep, lit, &w->err);
+        free(lit);
+        if (w->err)
+            return;
+        struct stat st;
+        if (!last || lstat(w->path.buf, &st) == 0)
+            walk(w, idx + 1);
+        path_pop(&w->path, old);
+        return;
+    }
+
+    struct GlobDir *d = cache_dir(w->cache, w->path.len ? w->path.buf : ".");
+    if (!d) {
+        w->err = 1;
+        return;
+    }
+    for (size_t i = 0; i < d->count && !w->err; i++) {
+        const char *name = d->names + d->ents[i].name;
+        if (fnmatch(comp, name, FNM_PERIOD) != 0)
+            continue;
+        unsigned char type = d->ents[i].type;
+        /* only directories and links to them can hold further matches */
+        if (!last && type != DT_DIR && type != DT_LNK && type != DT_UNKNOWN)
+            continue;
+        size_t old = path_push(&w->path, sep, name, &w->err);
+        if (w->err)
+            return;
+        if (last)
+            add_match(w, type);
+        else
+            walk(w, idx + 1);
+        path_pop(&w->path, old);
+    }
+}
+
+static int cmp_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int glob_expand(GlobCache *cache, const char *pattern, StrArray *out) {
+    struct glob_pat pat = { NULL, 0, 0, 0 };
+    shell_stats.globs++;
+    char *copy = strdup(pattern);
+    if (!copy)
+        return -1;
+    size_t plen = strlen(copy);
+    pat.comps = malloc((plen / 2 + 2) * sizeof(*pat.comps));
+    if (!pat.comps) {
+        free(copy);
+        return -1;
+    }
+    char *s = copy;
+    while (*s == '/') {
+        s++;
+        pat.absolute++;
+    }
+    int sep = 0;
+    while (*s) {
+        pat.comps[pat.ncomps].name = s;
+        pat.comps[pat.ncomps++].sep = sep;
+        while (*s && *s != '/')
+            s++;
+        for (sep = 0; *s == '/'; sep++)
+            *s++ = '\0';
+    }
+    pat.trailing_slash = sep > 0;
+
+    /* a command substitution may have changed the file system */
+    if (cache->subst_gen != command_output_count)
+        glob_cache_release(cache);
+    struct glob_walk w = { cache, &pat, { NULL, 0, 0 }, out, 0 };
+    int start = out->count;
+    if (pat.absolute)
+        path_push(&w.path, pat.absolute, "", &w.err);
+    if (!w.err && pat.ncomps)
+        walk(&w, 0);
+    free(w.path.buf);
+    free(pat.comps);
+    free(copy);
+
+    if (w.err) {
+        while (out->count > start)
+            free(out->items[--out->count]);
+        return -1;
+    }
+    int n = out->count - start;
+    qsort(out->items + start, n, sizeof(char *), cmp_paths);
+    /* overlapping `**` components can reach a path twice */
+    int j = start;
+    for (int i = start; i < out->count; i++) {
+        if (j > start && strcmp(out->items[j - 1], out->items[i]) == 0)
+            free(out->items[i]);
+        else
+            out->items[j++] = out->items[i];
+    }
+    out->count = j;
+    return j - start;
+}
@@ -0,0 +1,41 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Pathname expansion.
+ */
+
+#ifndef GLOB_EXPAND_H
+#define GLOB_EXPAND_H
+
+#include <stddef.h>
+#include "strarray.h"
+
+struct GlobDir;
+
+/*
+ * Directory listings read while expanding the words of one command.  Each
+ * directory is read at most once so several patterns naming the same
+ * directory share a single scan.  The listings are dropped automatically
+ * when a command substitution runs in between.
+ */
+typedef struct {
+    struct GlobDir **buckets;
+    size_t nbuckets;
+    size_t count;
+    unsigned long subst_gen;
+} GlobCache;
+
+/* Prepare CACHE for use.  No memory is allocated until a directory is read. */
+void glob_cache_init(GlobCache *cache);
+/* Release every listing held by CACHE. */
+void glob_cache_release(GlobCache *cache);
+
+/*
+ * Expand PATTERN against the file system and append the matching paths in
+ * sorted order to OUT.  A `**` component matches any number of directories
+ * when the globstar option is enabled.  Returns the number of paths added,
+ * 0 when nothing matched or -1 on allocation failure.
+ */
+int glob_expand(GlobCache *cache, const char *pattern, StrArray *out);
+
+#endif /* GLOB_EXPAND_H */
@@ -6,6 +6,21 @@
 
 /*
  * Simple command hashing for faster lookups.
+ *
+ * Remembered commands live in a chained hash table keyed by name.  The
+ * entries are also linked in insertion order so `hash` lists them the
+ * way they were added.
+ *
+ * Resolving a name that is not cached consults a per-directory index of
+ * the PATH entries.  Each index holds the sorted file names of one
+ * directory together with the directory's modification time; it is
+ * rebuilt when that time changes.  The whole cache is dropped when the
+ * value of PATH differs from the one the indexes were built for.
+ *
+ * When fexecve() is available an open descriptor is kept for recently
+ * used commands so children can execute them without another path walk.
+ * At most HASH_FD_MAX descriptors stay open; the least recently used one
+ * is closed when a new one is needed.
  */
 #define _GNU_SOURCE
 #include "hash.h"
@@ -15,73 +30,287 @@
 #include <stdio.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "util.h"
+#include "list.h"
+#include "vars.h"
 #include "shell_state.h"
+#include "stats.h"
+
+#define HASH_FD_MAX 16
+#define HASH_MIN_BUCKETS 32
 
 struct hash_entry {
     char *name;
     char *path;
+    unsigned int hash;
     int fd;
-    struct hash_entry *next;
+    struct hash_entry *next;  /* bucket chain */
+    ListNode node;            /* insertion order */
+    ListNode lru;             /* open descriptors, most recent first */
 };
 
-static struct hash_entry *hash_list = NULL;
+struct dir_index {
+    char *dir;
+    struct timespec mtime;
+    char **names;             /* sorted directory entries */
+    size_t count;
+    int valid;
+};
 
-/* Search PATH for NAME and return a newly allocated full path or NULL. */
-static char *search_path(const char *name) {
-    const char *pathenv = getenv("PATH");
+static struct hash_entry **hash_buckets = NULL;
+static size_t hash_nbuckets = 0;
+static size_t hash_count = 0;
+static List hash_order;
+static List fd_lru;
+static int fd_open = 0;
+
+static struct dir_index *dir_indexes = NULL;
+static size_t dir_count = 0;
+static char *indexed_path = NULL;
+
+/* Close the descriptor held by E and drop it from the LRU list. */
+static void entry_close_fd(struct hash_entry *e) {
+    if (e->fd < 0)
+        return;
+    close(e->fd);
+    e->fd = -1;
+    list_remove(&fd_lru, &e->lru);
+    fd_open--;
+}
+
+/*
+ * Mark E as the most recently used command.  When fexecve() is available
+ * its descriptor is (re)opened, evicting the least recently used one if
+ * HASH_FD_MAX descriptors are already open.
+ */
+static void entry_touch(struct hash_entry *e) {
+#ifdef HAVE_FEXECVE
+    if (e->fd >= 0) {
+        list_remove(&fd_lru, &e->lru);
+    } else {
+        if (fd_open >= HASH_FD_MAX && fd_lru.tail)
+            entry_close_fd(LIST_ENTRY(fd_lru.tail, struct hash_entry, lru));
+        e->fd = open(e->path, O_RDONLY | O_CLOEXEC);
+        if (e->fd < 0)
+            return;
+        fd_open++;
+    }
+    /* push to the front of the LRU list */
+    e->lru.prev = NULL;
+    e->lru.next = fd_lru.head;
+    if (fd_lru.head)
+        fd_lru.head->prev = &e->lru;
+    else
+        fd_lru.tail = &e->lru;
+    fd_lru.head = &e->lru;
+#else
+    (void)e;
+#endif
+}
+
+static void free_entry(struct hash_entry *e) {
+    entry_close_fd(e);
+    free(e->name);
+    free(e->path);
+    free(e);
+}
+
+static void free_dir_indexes(void) {
+    for (size_t i = 0; i < dir_count; i++) {
+        for (size_t j = 0; j < dir_indexes[i].count; j++)
+            free(dir_indexes[i].names[j]);
+        free(dir_indexes[i].names);
+        free(dir_indexes[i].dir);
+    }
+    free(dir_indexes);
+    dir_indexes = NULL;
+    dir_count = 0;
+    free(indexed_path);
+    indexed_path = NULL;
+}
+
+/* Return the current PATH or the default search path. */
+static const char *current_path(void) {
+    const char *pathenv = get_shell_var("PATH");
+    if (!pathenv)
+        pathenv = get_env_var("PATH");
     if (!pathenv || !*pathenv)
         pathenv = "/bin:/usr/bin";
-    char *paths = strdup(pathenv);
-    if (!paths)
-        return NULL;
-    char *save = NULL;
-    char *dir = strtok_r(paths, ":", &save);
-    char *result = NULL;
-    while (dir) {
-        const char *d = *dir ? dir : ".";
-        char *full = NULL;
-        if (xasprintf(&full, "%s/%s", d, name) < 0) {
-            result = NULL;
-            break;
+    return pathenv;
+}
+
+/*
+ * Split PATH into the directory index list.  Empty components mean the
+ * current directory as usual.  Returns 0 on success.
+ */
+static int build_dir_list(const char *pathenv) {
+    size_t n = 1;
+    for (const char *p = pathenv; *p; p++)
+        if (*p == ':')
+            n++;
+    dir_indexes = calloc(n, sizeof(*dir_indexes));
+    indexed_path = strdup(pathenv);
+    if (!dir_indexes || !indexed_path) {
+        free_dir_indexes();
+        return -1;
+    }
+    const char *start = pathenv;
+    for (size_t i = 0; i < n; i++) {
+        const char *end = strchr(start, ':');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+        dir_indexes[i].dir = len ? strndup(start, len) : strdup(".");
+        if (!dir_indexes[i].dir) {
+            dir_count = i;
+            free_dir_indexes();
+            return -1;
         }
-        if (access(full, X_OK) == 0) {
-            result = full;
-            break;
+        dir_count = i + 1;
+        start = end ? end + 1 : start + len;
+    }
+    return 0;
+}
+
+/*
+ * Drop all cached state when PATH changed since the indexes were built.
+ * Command entries resolved through the old PATH are forgotten as well.
+ */
+static void check_path_change(void) {
+    const char *pathenv = current_path();
+    if (indexed_path && strcmp(indexed_path, pathenv) == 0)
+        return;
+    if (indexed_path)
+        hash_clear();
+    if (build_dir_list(pathenv) < 0)
+        perror("hash");
+}
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Re-read the entries of DI when its directory changed on disk. */
+static int refresh_dir_index(struct dir_index *di) {
+    struct stat st;
+    if (stat(di->dir, &st) != 0) {
+        di->valid = 0;
+        return -1;
+    }
+    if (di->valid && st.st_mtim.tv_sec == di->mtime.tv_sec &&
+        st.st_mtim.tv_nsec == di->mtime.tv_nsec)
+        return 0;
+
+    for (size_t j = 0; j < di->count; j++)
+        free(di->names[j]);
+    free(di->names);
+    di->names = NULL;
+    di->count = 0;
+    di->valid = 0;
+
+    DIR *d = opendir(di->dir);
+    if (!d)
+        return -1;
+    size_t cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        if (ent->d_name[0] == '.' &&
+            (!ent->d_name[1] || (ent->d_name[1] == '.' && !ent->d_name[2])))
+            continue;
+        if (di->count == cap) {
+            size_t nc = cap ? cap * 2 : 64;
+            char **tmp = realloc(di->names, nc * sizeof(char *));
+            if (!tmp)
+                goto fail;
+            di->names = tmp;
+            cap = nc;
         }
+        di->names[di->count] = strdup(ent->d_name);
+        if (!di->names[di->count])
+            goto fail;
+        di->count++;
+    }
+    closedir(d);
+    qsort(di->names, di->count, sizeof(char *), cmp_name);
+    di->mtime = st.st_mtim;
+    di->valid = 1;
+    return 0;
+
+fail:
+    closedir(d);
+    for (size_t j = 0; j < di->count; j++)
+        free(di->names[j]);
+    free(di->names);
+    di->names = NULL;
+    di->count = 0;
+    return -1;
+}
+
+/* Return non-zero when directory DI may contain NAME. */
+static int dir_may_contain(struct dir_index *di, const char *name) {
+    /* relative entries depend on the working directory, so never index them */
+    if (di->dir[0] != '/')
+        return 1;
+    if (refresh_dir_index(di) != 0)
+        return !di->valid && access(di->dir, F_OK) == 0;
+    return bsearch(&name, di->names, di->count, sizeof(char *), cmp_name) != NULL;
+}
+
+/* Search PATH for NAME and return a newly allocated full path or NULL. */
+static char *search_path(const char *name) {
+    check_path_change();
+    for (size_t i = 0; i < dir_count; i++) {
+        struct dir_index *di = &dir_indexes[i];
+        if (!dir_may_contain(di, name))
+            continue;
+        char *full = NULL;
+        if (xasprintf(&full, "%s/%s", di->dir, name) < 0)
+            return NULL;
+        if (access(full, X_OK) == 0)
+            return full;
         free(full);
-        dir = strtok_r(NULL, ":", &save);
     }
-    free(paths);
-    return result;
+    return NULL;
 }
 
-const char *hash_lookup(const char *name, int *fd) {
-    for (struct hash_entry *e = hash_list; e; e = e->next) {
-        if (strcmp(e->name, name) == 0) {
-            if (fd)
-                *fd = e->fd;
-            return e->path;
-        }
+static struct hash_entry *find_entry(const char *name) {
+    if (!hash_nbuckets)
+        return NULL;
+    unsigned int h = hash_string(name);
+    for (struct hash_entry *e = hash_buckets[h & (hash_nbuckets - 1)]; e; e = e->next) {
+        if (e->hash == h && strcmp(e->name, name) == 0)
+            return e;
     }
     return NULL;
 }
 
-int hash_add(const char *name) {
-    if (strchr(name, '/'))
+/* Double the bucket array once the table holds more entries than buckets. */
+static int grow_buckets(void) {
+    size_t nb = hash_nbuckets ? hash_nbuckets * 2 : HASH_MIN_BUCKETS;
+    struct hash_entry **b = calloc(nb, sizeof(*b));
+    if (!b)
         return -1;
-    if (hash_lookup(name, NULL))
-        return 0;
-    char *path = search_path(name);
-    if (!path)
-        return -1;
-    char *resolved = realpath(path, NULL);
-    if (resolved) {
-        free(path);
-        path = resolved;
+    for (size_t i = 0; i < hash_nbuckets; i++) {
+        struct hash_entry *e = hash_buckets[i];
+        while (e) {
+            struct hash_entry *next = e->next;
+            size_t idx = e->hash & (nb - 1);
+            e->next = b[idx];
+            b[idx] = e;
+            e = next;
+        }
     }
-    int fd = open(path, O_RDONLY | O_CLOEXEC);
-    if (fd < 0) {
+    free(hash_buckets);
+    hash_buckets = b;
+    hash_nbuckets = nb;
+    return 0;
+}
+
+/* Insert NAME resolved to PATH, taking ownership of PATH. */
+static int insert_entry(const char *name, char *path) {
+    if (hash_count >= hash_nbuckets && grow_buckets() < 0) {
+        perror("calloc");
+        last_status = 1;
         free(path);
         return -1;
     }
@@ -91,7 +320,6 @@ int hash_add(const char *name) {
         perror("malloc");
         last_status = 1;
         free(path);
-        close(fd);
         return -1;
     }
     e->name = strdup(name);
@@ -99,39 +327,92 @@ int hash_add(const char *name) {
         perror("strdup");
         last_status = 1;
         free(path);
-        close(fd);
         free(e);
         return -1;
     }
     e->path = path;
-#ifdef HAVE_FEXECVE
-    e->fd = fd;
-#else
-    close(fd);
     e->fd = -1;
-#endif
-    e->next = hash_list;
-    hash_list = e;
+    e->hash = hash_string(name);
+    size_t idx = e->hash & (hash_nbuckets - 1);
+    e->next = hash_buckets[idx];
+    hash_buckets[idx] = e;
+    list_append(&hash_order, &e->node);
+    hash_count++;
+    entry_touch(e);
     return 0;
 }
 
+const char *hash_lookup(const char *name, int *fd) {
+    check_path_change();
+    struct hash_entry *e = find_entry(name);
+    stats_hash_lookup(e != NULL);
+    if (!e)
+        return NULL;
+    if (fd)
+        *fd = e->fd;
+    return e->path;
+}
+
+int hash_search(const char *name, char *buf, size_t size) {
+    if (strchr(name, '/'))
+        return -1;
+    const char *p = current_path();
+    for (;;) {
+        const char *end = strchrnul(p, ':');
+        int len = (int)(end - p);
+        int n = len ? snprintf(buf, size, "%.*s/%s", len, p, name)
+                    : snprintf(buf, size, "%s", name);
+        if (n >= 0 && (size_t)n < size && access(buf, X_OK) == 0)
+            return 0;
+        if (!*end)
+            return -1;
+        p = end + 1;
+    }
+}
+
+int hash_add(const char *name) {
+    if (strchr(name, '/'))
+        return -1;
+    check_path_change();
+    struct hash_entry *e = find_entry(name);
+    if (e) {
+        entry_touch(e);
+        return 0;
+    }
+    char *path = search_path(name);
+    if (!path)
+        return -1;
+    char *resolved = realpath(path, NULL);
+    if (resolved) {
+        free(path);
+        path = resolved;
+    }
+    return insert_entry(name, path);
+}
+
 void hash_clear(void) {
-    struct hash_entry *e = hash_list;
-    while (e) {
-        struct hash_entry *n = e->next;
-        free(e->name);
-        free(e->path);
-        if (e->fd >= 0)
-            close(e->fd);
-        free(e);
-        e = n;
+    ListNode *n = hash_order.head;
+    while (n) {
+        ListNode *next = n->next;
+        free_entry(LIST_ENTRY(n, struct hash_entry, node));
+        n = next;
     }
-    hash_list = NULL;
+    list_init(&hash_order);
+    list_init(&fd_lru);
+    fd_open = 0;
+    free(hash_buckets);
+    hash_buckets = NULL;
+    hash_nbuckets = 0;
+    hash_count = 0;
+    free_dir_indexes();
 }
 
 void hash_print(void) {
-    for (struct hash_entry *e = hash_list; e; e = e->next)
+    check_path_change();
+    LIST_FOR_EACH(n, &hash_order) {
+        struct hash_entry *e = LIST_ENTRY(n, struct hash_entry, node);
         printf("%s %s\n", e->name, e->path);
+    }
 }
 
 int hash_add_path(const char *name, const char *path) {
@@ -139,57 +420,29 @@ int hash_add_path(const char *name, const char *path) {
         return -1;
     if (strchr(name, '/'))
         return -1;
-    if (hash_lookup(name, NULL))
+    check_path_change();
+    if (find_entry(name))
         return 0;
     char *real = realpath(path, NULL);
     char *p = real ? real : strdup(path);
     if (!p)
         return -1;
-    int fd = open(p, O_RDONLY | O_CLOEXEC);
-    if (fd < 0) {
-        free(p);
-        return -1;
-    }
-    struct hash_entry *e = malloc(sizeof(struct hash_entry));
-    if (!e) {
+    if (access(p, F_OK) != 0) {
         free(p);
-        close(fd);
         return -1;
     }
-    e->name = strdup(name);
-    if (!e->name) {
-        perror("strdup");
-        last_status = 1;
-        free(p);
-        close(fd);
-        free(e);
-        return -1;
-    }
-    e->path = p;
-#ifdef HAVE_FEXECVE
-    e->fd = fd;
-#else
-    close(fd);
-    e->fd = -1;
-#endif
-    e->next = hash_list;
-    hash_list = e;
-    return 0;
+    return insert_entry(name, p);
 }
 
 void hash_remove(const char *name) {
-    struct hash_entry **pp = &hash_list;
-    while (*pp) {
-        struct hash_entry *e = *pp;
-        if (strcmp(e->name, name) == 0) {
-            *pp = e->next;
-            free(e->name);
-            free(e->path);
-            if (e->fd >= 0)
-                close(e->fd);
-            free(e);
-            return;
-        }
+    struct hash_entry *e = find_entry(name);
+    if (!e)
+        return;
+    struct hash_entry **pp = &hash_buckets[e->hash & (hash_nbuckets - 1)];
+    while (*pp != e)
         pp = &(*pp)->next;
-    }
+    *pp = e->next;
+    list_remove(&hash_order, &e->node);
+    hash_count--;
+    free_entry(e);
 }
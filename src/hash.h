@@ -7,12 +7,19 @@
 #ifndef HASH_H
 #define HASH_H
 
+#include <stddef.h>
+
 /* Command lookup caching. */
 
 /* Return cached path for NAME or NULL if not cached.
  * When FD is non-NULL the associated file descriptor is stored in *FD. */
 const char *hash_lookup(const char *name, int *fd);
 
+/* Search the shell's PATH for NAME the way execvp() would, without caching
+ * it or reading the directory indexes, and store the full path in BUF of
+ * SIZE bytes.  Returns 0 on success or -1 when not found. */
+int hash_search(const char *name, char *buf, size_t size);
+
 /* Add NAME to the cache by searching PATH.  Returns 0 on success. */
 int hash_add(const char *name);
 
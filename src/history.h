@@ -10,11 +10,11 @@
 /*
  * Command history interface.
  *
- * History lines are kept in an in-memory doubly linked list.  Every command
- * entered by the user becomes a ``HistEntry`` which stores the command text
- * and an incrementing identifier.  The newest entry is appended to the end of
- * the list and when the history grows beyond the configured limit the oldest
- * element is discarded.
+ * History lines are kept in memory as variable-length records in a ring
+ * buffer.  Every command entered by the user becomes an entry identified by
+ * its position, 1 being the oldest.  The newest entry is appended to the end
+ * and when the history grows beyond the configured limit the oldest entry is
+ * discarded.
  *
  * For persistence the list is synchronised with a history file determined by
  * ``$VUSH_HISTFILE`` (falling back to ``$HOME/.vush_history``).  New entries
@@ -38,6 +38,9 @@ void print_history(void);
 /* Load the history file into memory. */
 void load_history(void);
 
+/* Write commands still buffered for the history file. */
+void history_flush(void);
+
 /* Step backwards through history and return the previous command or NULL. */
 const char *history_prev(void);
 
@@ -62,6 +65,9 @@ void history_reset_search(void);
 /* Remove all history entries and truncate the history file. */
 void clear_history(void);
 
+/* Free the in-memory history without touching the history file. */
+void free_history(void);
+
 /* Delete the entry with identifier ID from the list and history file. */
 void delete_history_entry(int id);
 
@@ -4,45 +4,140 @@
  * Loading and saving the history file.
  */
 
+/*
+ * New commands are collected in ``pending`` and written with a single
+ * write() on a descriptor opened with O_APPEND that stays open for the life
+ * of the shell.  The buffer is flushed once it holds HIST_BATCH bytes, when
+ * an interactive shell is about to wait for input, before ``exec`` and when
+ * the shell exits, so scripts that record every line cost one write per
+ * batch rather than an open, a write and a close per command.
+ *
+ * Only the shell that loaded the file writes to it.  Subshells inherit the
+ * buffer and the list but must not flush the one or rewrite the file from
+ * the other, as `exit` in a subshell would.
+ *
+ * Loading maps the file and walks back from its end to the oldest line that
+ * will be kept, so only the tail of a long history is read.  The file is
+ * rewritten only when it holds more lines than the file limit allows.
+ */
 #define _GNU_SOURCE
 #include "history.h"
-#include "parser.h" /* for MAX_LINE */
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "util.h"
 #include "state_paths.h"
 #include "error.h"
 #include "shell_state.h"
+#include "strbuf.h"
 
 /* functions from history_list.c */
-void history_add_entry(const char *cmd, int save_file);
+void history_load_entry(const char *cmd, size_t len);
+void history_limits(int *mem, int *file);
 void history_list_iter(void (*cb)(const char *cmd, void *arg), void *arg);
-void history_renumber(void);
 
+/* buffered bytes that trigger a write */
+#define HIST_BATCH 4096
+
+static int hist_fd = -1;
+static char *hist_fd_path;  /* file ``hist_fd`` refers to */
+static StrBuf pending;      /* lines not written yet */
+static pid_t owner;         /* the shell that loaded the file */
+static int unterminated;    /* the loaded file lacks its final newline */
+
+/* Write the buffered lines to ``hist_fd``. */
+static void write_pending(void) {
+    size_t off = 0;
+    while (off < pending.len) {
+        ssize_t n = write(hist_fd, pending.data + off, pending.len - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "warning: failed to write history file\n");
+            last_status = 1;
+            break;
+        }
+        off += (size_t)n;
+    }
+    pending.len = 0;
+}
+
+/* Non-zero in forked children of the shell that loaded the history. */
+static int in_subshell(void) {
+    return owner && getpid() != owner;
+}
+
+/* Drop the buffered lines, which are already part of the in-memory list. */
+static void discard_pending(void) {
+    if (pending.data)
+        pending.len = 0;
+}
+
+void history_flush(void) {
+    if (hist_fd < 0 || !pending.data || pending.len == 0 || in_subshell())
+        return;
+    write_pending();
+}
+
+/* Open PATH for appending unless ``hist_fd`` already refers to it. */
+static int open_history_fd(const char *path) {
+    if (hist_fd >= 0 && strcmp(hist_fd_path, path) == 0)
+        return 0;
+    history_flush();
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -1;
+    /* keep clear of the low descriptors scripts redirect */
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    if (high >= 0) {
+        close(fd);
+        fd = high;
+    }
+    if (hist_fd >= 0)
+        close(hist_fd);
+    free(hist_fd_path);
+    hist_fd = fd;
+    hist_fd_path = xstrdup(path);
+    if (!pending.data) {
+        strbuf_init(&pending, HIST_BATCH);
+        atexit(history_flush);
+    }
+    return 0;
+}
 
 /*
  * Append ``cmd`` as a single line to the on-disk history file.  This is used
  * whenever a new command is entered so that the file mirrors the in-memory
- * list.
+ * list.  The line is buffered and written with the next batch.
  */
 void history_file_append(const char *cmd) {
+    if (in_subshell())
+        return;
     char *path = get_history_file();
     if (!path) {
         fprintf(stderr, "warning: unable to determine history file location\n");
         return;
     }
-    FILE *f = fopen(path, "a");
-    if (!f) {
+    if (open_history_fd(path) < 0) {
         fprintf(stderr, "warning: unable to open history file for appending\n");
         last_status = 1;
         free(path);
         return;
     }
     free(path);
-    fprintf(f, "%s\n", cmd);
-    fclose(f);
+    if (unterminated) {
+        strbuf_appendc(&pending, '\n');
+        unterminated = 0;
+    }
+    strbuf_appends(&pending, cmd);
+    strbuf_appendc(&pending, '\n');
+    if (pending.len >= HIST_BATCH)
+        write_pending();
 }
 
 /* Context used when rewriting the entire history file.  ``error`` is set to 1
@@ -61,10 +156,14 @@ static void rewrite_cb(const char *cmd, void *arg) {
 
 /*
  * Rewrite the history file so that it contains exactly the commands stored in
- * memory.  This is called after deletions or when the in-memory limit differs
- * from the file limit.
+ * memory.  This is called after deletions or when the file holds more lines
+ * than its limit.  Buffered lines are part of the list and written with it.
  */
 void history_file_rewrite(void) {
+    if (in_subshell())
+        return;
+    discard_pending();
+    unterminated = 0;
     char *path = get_history_file();
     if (!path) {
         fprintf(stderr, "warning: unable to determine history file location\n");
@@ -91,6 +190,10 @@ void history_file_rewrite(void) {
 
 /* Remove all contents from the history file. */
 void history_file_clear(void) {
+    if (in_subshell())
+        return;
+    discard_pending();
+    unterminated = 0;
     char *path = get_history_file();
     if (!path) {
         fprintf(stderr, "warning: unable to determine history file location\n");
@@ -104,27 +207,70 @@ void history_file_clear(void) {
 
 /*
  * Read the on-disk history file and populate the in-memory list.  Each line
- * becomes a ``HistEntry``.  After loading the IDs are renumbered and the file
- * rewritten to enforce size limits.
+ * becomes one entry, however long it is.  Only the lines that fit in memory
+ * are read; when the file holds more than its limit it is rewritten with
+ * the loaded entries.
  */
 void load_history(void) {
+    owner = getpid();
     char *path = get_history_file();
     if (!path) {
         fprintf(stderr, "warning: unable to determine history file location\n");
         return;
     }
-    FILE *f = fopen(path, "r");
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
     free(path);
-    if (!f)
+    if (fd < 0)
         return;
-    char line[MAX_LINE];
-    while (fgets(line, sizeof(line), f)) {
-        size_t len = strlen(line);
-        if (len && line[len - 1] == '\n')
-            line[len - 1] = '\0';
-        history_add_entry(line, 0);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    size_t size = (size_t)st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+
+    int mem_limit, file_limit;
+    history_limits(&mem_limit, &file_limit);
+    int keep = mem_limit < file_limit ? mem_limit : file_limit;
+
+    /* the text ends before the newline terminating the last line */
+    const char *stop = map + size;
+    if (stop[-1] == '\n')
+        stop--;
+    else
+        unterminated = 1;
+    /* walk back over at most FILE_LIMIT lines noting where the KEEP
+     * newest ones start */
+    const char *start = map;
+    const char *p = stop;
+    int lines = 0;
+    int too_long = 0;
+    for (;;) {
+        const char *nl = memrchr(map, '\n', (size_t)(p - map));
+        lines++;
+        if (lines == keep)
+            start = nl ? nl + 1 : map;
+        if (!nl)
+            break;
+        if (lines == file_limit) {
+            too_long = 1;
+            break;
+        }
+        p = nl;
+    }
+
+    for (const char *line = start; line <= stop; ) {
+        const char *nl = memchr(line, '\n', (size_t)(stop - line));
+        if (!nl)
+            nl = stop;
+        history_load_entry(line, (size_t)(nl - line));
+        line = nl + 1;
     }
-    fclose(f);
-    history_renumber();
-    history_file_rewrite();
+    munmap(map, size);
+    if (too_long)
+        history_file_rewrite();
 }
@@ -7,21 +7,39 @@
 /*
  * Command history management routines.
  *
- * History is kept in a list of ``HistEntry`` nodes.  New
- * commands are appended to the end and each entry is assigned an incrementing
- * identifier.  When the number of stored entries exceeds ``max_history`` the
- * oldest entry at ``head`` is discarded.  The history is optionally persisted
- * to ``$VUSH_HISTFILE`` (or ``$HOME/.vush_history`` if unset) so entries can be
- * reloaded across shell sessions.
+ * The text of every command is kept in one ring buffer of bytes, each line
+ * stored with its terminator right after the previous one and wrapping to
+ * the start of the buffer when the end is reached.  A second ring of
+ * ``HistRec`` records indexes the lines from oldest to newest, so entry
+ * identifiers, which are simply positions starting at 1, map to their text
+ * in constant time and lines of any length are kept whole.  Dropping the
+ * oldest entry only advances both rings; the buffer is grown, and the lines
+ * compacted, when a new line does not fit in the free space between the
+ * newest and the oldest line.  Space left by deleted entries is reused once
+ * the oldest line moves past it.
+ *
+ * When the number of stored entries exceeds ``max_history`` the oldest one is
+ * discarded.  The history is optionally persisted to ``$VUSH_HISTFILE`` (or
+ * ``$HOME/.vush_history`` if unset) so entries can be reloaded across shell
+ * sessions.
  *
  * The interactive cursor (`cursor`) tracks navigation through the list for the
  * up/down history commands while `search_cursor` remembers the last match when
- * searching.  Searches walk the list in either direction looking for a command
- * substring.
+ * searching.  Both hold entry positions and -1 when unset.
+ *
+ * Substring searches are incremental.  Each record carries two 64-bit
+ * signatures with a bit set for every byte and every pair of adjacent bytes
+ * of its line, so a fresh search only compares the text of entries whose
+ * signatures cover those of the term.  The entries found are kept, and when
+ * the term grows, as it does with every key typed at the Ctrl-R prompt, only
+ * they are checked again.  The sets found for the shorter terms stay on a
+ * stack so deleting a character returns to the previous one.  Any change to
+ * the list discards them.  With `set -o histrank` reverse searches offer
+ * each distinct matching command once, most frequently used first.
 */
 #define _GNU_SOURCE
 #include "history.h"
-#include "parser.h" /* for MAX_LINE */
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,59 +47,147 @@
 #include "common.h"
 #include "util.h"
 #include "error.h"
-#include "list.h"
+#include "options.h"
+#include "strbuf.h"
+#include "vars.h"
+
+#define HIST_MIN_TEXT 4096
+#define HIST_MIN_RECS 64
+
+/* Location of one command line in ``text``. */
+typedef struct {
+    size_t off;            /* offset of the first byte */
+    size_t len;            /* length without the terminator */
+    uint64_t bytes;        /* signature of the bytes in the line */
+    uint64_t pairs;        /* signature of adjacent byte pairs */
+} HistRec;
+
+/* Entries containing a search term of ``term_len`` bytes, oldest first. */
+typedef struct {
+    size_t term_len;
+    int *pos;
+    int count;
+    int *ranked;           /* distinct commands for histrank, or NULL */
+    int nranked;
+} MatchSet;
+
+static char *text;         /* ring buffer holding the lines */
+static size_t text_cap;
+static HistRec *recs;      /* ring of records, oldest at ``rec_first`` */
+static int rec_cap;
+static int rec_first;
+static int history_size = 0;
 
-/* Node stored for each command line.  ``cmd`` holds the literal line text and
- * ``id`` is a monotonically increasing identifier used by ``history_get_by_id``
- * and related helpers.  The ``node`` field links entries in the global history
- * list.
- */
-typedef struct HistEntry {
-    int id;                /* numerical identifier for this entry */
-    char cmd[MAX_LINE];    /* command line string */
-    ListNode node;         /* links the entry into ``history`` */
-} HistEntry;
+static unsigned long history_gen; /* bumped whenever entries change */
 
-static List history;
+static int cursor = -1;
+static int search_cursor = -1;
+static int rank_cursor = -1;       /* index into the ranked matches */
+static MatchSet *match_sets;       /* one per prefix of ``search_term`` */
+static int nmatch_sets;
+static int match_sets_cap;
+static StrBuf search_term;
+static unsigned long match_gen;    /* history_gen the sets belong to */
+static int skip_next = 0;
+static int max_history = MAX_HISTORY;
+static int max_file_history = MAX_HISTORY;
 
-/* Return the next history entry after ``e`` or NULL when at the tail. */
-static inline HistEntry *entry_next(HistEntry *e) {
-    return e->node.next ? LIST_ENTRY(e->node.next, HistEntry, node) : NULL;
+/* Return the record of the entry at POS, 0 being the oldest. */
+static HistRec *rec_at(int pos) {
+    return &recs[(rec_first + pos) % rec_cap];
 }
 
-/* Return the previous history entry before ``e`` or NULL when at the head. */
-static inline HistEntry *entry_prev(HistEntry *e) {
-    return e->node.prev ? LIST_ENTRY(e->node.prev, HistEntry, node) : NULL;
+/* Return the text of the entry at POS. */
+static const char *entry_text(int pos) {
+    return text + rec_at(pos)->off;
 }
 
-/* Convenience wrappers to obtain the first and last history entries. */
-static inline HistEntry *history_head(void) {
-    return history.head ? LIST_ENTRY(history.head, HistEntry, node) : NULL;
+/* Move the lines into a buffer of CAP bytes, back to back from offset 0. */
+static int text_resize(size_t cap) {
+    char *buf = malloc(cap);
+    RETURN_IF_ERR_RET(!buf, "malloc", -1);
+    size_t off = 0;
+    for (int i = 0; i < history_size; i++) {
+        HistRec *r = rec_at(i);
+        memcpy(buf + off, text + r->off, r->len + 1);
+        r->off = off;
+        off += r->len + 1;
+    }
+    free(text);
+    text = buf;
+    text_cap = cap;
+    return 0;
 }
 
-static inline HistEntry *history_tail(void) {
-    return history.tail ? LIST_ENTRY(history.tail, HistEntry, node) : NULL;
+/* Return the offset where SIZE bytes can be stored after the newest line,
+ * growing the buffer when they do not fit.  Returns (size_t)-1 on failure. */
+static size_t text_reserve(size_t size) {
+    if (history_size == 0) {
+        if (size > text_cap && text_resize(size > HIST_MIN_TEXT ?
+                                           size : HIST_MIN_TEXT) < 0)
+            return (size_t)-1;
+        return 0;
+    }
+    size_t first = rec_at(0)->off;
+    HistRec *last = rec_at(history_size - 1);
+    size_t end = last->off + last->len + 1;
+    if (last->off >= first) {
+        /* not wrapped: free space after the newest line and before the oldest */
+        if (text_cap - end >= size)
+            return end;
+        if (first >= size)
+            return 0;
+    } else if (first - end >= size) {
+        return end;
+    }
+    size_t used = 0;
+    for (int i = 0; i < history_size; i++)
+        used += rec_at(i)->len + 1;
+    size_t cap = text_cap * 2;
+    while (cap < used + size)
+        cap *= 2;
+    if (text_resize(cap) < 0)
+        return (size_t)-1;
+    return used;
 }
-static HistEntry *cursor = NULL;
-static HistEntry *search_cursor = NULL;
-static int next_id = 1;
-static int skip_next = 0;
-static int history_size = 0;
-static int max_history = MAX_HISTORY;
-static int max_file_history = MAX_HISTORY;
 
-/*
- * Assign sequential numeric identifiers to each stored entry starting at 1.
- * This is used after loading or deleting entries to keep IDs contiguous.
- */
-void history_renumber(void)
-{
-    int id = 1;
-    for (ListNode *n = history.head; n; n = n->next) {
-        HistEntry *e = LIST_ENTRY(n, HistEntry, node);
-        e->id = id++;
+/* Make room for one more record. */
+static int recs_reserve(void) {
+    if (history_size < rec_cap)
+        return 0;
+    int cap = rec_cap ? rec_cap * 2 : HIST_MIN_RECS;
+    HistRec *tmp = malloc((size_t)cap * sizeof(*tmp));
+    RETURN_IF_ERR_RET(!tmp, "malloc", -1);
+    for (int i = 0; i < history_size; i++)
+        tmp[i] = *rec_at(i);
+    free(recs);
+    recs = tmp;
+    rec_cap = cap;
+    rec_first = 0;
+    return 0;
+}
+
+/* Adjust a cursor for the removal of the entry at POS. */
+static int cursor_after_remove(int c, int pos) {
+    if (c > pos)
+        return c - 1;
+    if (c == pos && c >= history_size)
+        return -1;
+    return c;
+}
+
+/* Remove the entry at POS, keeping the later ones in order. */
+static void remove_entry(int pos) {
+    if (pos == 0) {
+        rec_first = (rec_first + 1) % rec_cap;
+    } else {
+        for (int i = pos; i < history_size - 1; i++)
+            *rec_at(i) = *rec_at(i + 1);
     }
-    next_id = id;
+    history_size--;
+    history_gen++;
+    cursor = cursor_after_remove(cursor, pos);
+    search_cursor = cursor_after_remove(search_cursor, pos);
 }
 
 /*
@@ -99,18 +205,17 @@ static void history_init(void) {
     static int inited = 0;
     if (inited)
         return;
-    list_init(&history);
-    const char *env = getenv("VUSH_HISTSIZE");
+    const char *env = get_env_var("VUSH_HISTSIZE");
     if (!env)
-        env = getenv("HISTSIZE");
+        env = get_env_var("HISTSIZE");
     if (env) {
         long val = strtol(env, NULL, 10);
         if (val > 0)
             max_history = (int)val;
     }
-    const char *fenv = getenv("VUSH_HISTFILESIZE");
+    const char *fenv = get_env_var("VUSH_HISTFILESIZE");
     if (!fenv)
-        fenv = getenv("HISTFILESIZE");
+        fenv = get_env_var("HISTFILESIZE");
     if (fenv) {
         long val = strtol(fenv, NULL, 10);
         if (val > 0)
@@ -121,49 +226,85 @@ static void history_init(void) {
     inited = 1;
 }
 
+/* Compute the byte and byte pair signatures of the LEN bytes at S. */
+static void signature(const char *s, size_t len, uint64_t *bytes,
+                      uint64_t *pairs) {
+    uint64_t b = 0, p = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        b |= (uint64_t)1 << (c & 63);
+        if (i + 1 < len) {
+            uint32_t h = (c * 0x9E3779B1u) ^ (unsigned char)s[i + 1];
+            p |= (uint64_t)1 << ((h * 0x85EBCA6Bu) >> 26);
+        }
+    }
+    *bytes = b;
+    *pairs = p;
+}
+
+/* Copy the LEN bytes at CMD after the newest line as the newest entry. */
+static int store_entry(const char *cmd, size_t len) {
+    if (recs_reserve() < 0)
+        return -1;
+    size_t off = text_reserve(len + 1);
+    if (off == (size_t)-1)
+        return -1;
+    memcpy(text + off, cmd, len);
+    text[off + len] = '\0';
+    HistRec *r = &recs[(rec_first + history_size) % rec_cap];
+    r->off = off;
+    r->len = len;
+    signature(cmd, len, &r->bytes, &r->pairs);
+    history_size++;
+    history_gen++;
+    return 0;
+}
+
 /*
- * Internal helper to append an entry to the history list.  When
- * ``save_file`` is non-zero the entry is also appended to the history file.
- */
-/*
- * Add a command to the in-memory list.  ``cmd`` is copied into a new
- * ``HistEntry`` which becomes the new tail.  When ``save_file`` is true the
- * line is also appended to the on-disk history file via
+ * Add a command to the in-memory list.  ``cmd`` is copied after the newest
+ * line in the text buffer and becomes the newest entry.  When ``save_file``
+ * is true the line is also appended to the on-disk history file via
  * ``history_file_append``.  Older entries are pruned when the configured
  * limits are exceeded.
  */
 void history_add_entry(const char *cmd, int save_file) {
     history_init();
-    HistEntry *e = malloc(sizeof(HistEntry));
-    RETURN_IF_ERR_RET(!e, "malloc", );
-    e->id = next_id++;
-    strncpy(e->cmd, cmd, MAX_LINE - 1);
-    e->cmd[MAX_LINE - 1] = '\0';
-    e->node.next = NULL;
-    list_append(&history, &e->node);
-    history_size++;
+    if (store_entry(cmd, strlen(cmd)) < 0)
+        return;
 
-    if (history_size > max_history) {
-        HistEntry *old = LIST_ENTRY(history.head, HistEntry, node);
-        list_remove(&history, &old->node);
-        free(old);
-        history_size--;
-    }
+    if (history_size > max_history)
+        remove_entry(0);
 
     if (save_file)
         history_file_append(cmd);
 
-    while (history_size > max_file_history) {
-        HistEntry *old = LIST_ENTRY(history.head, HistEntry, node);
-        list_remove(&history, &old->node);
-        free(old);
-        history_size--;
-    }
+    while (history_size > max_file_history)
+        remove_entry(0);
 
     if (save_file && (history_size > max_history || history_size > max_file_history))
         history_file_rewrite();
 }
 
+/*
+ * Add the LEN bytes at CMD, a line read from the history file, without
+ * writing it back.  The oldest entries are dropped beyond the limits.
+ */
+void history_load_entry(const char *cmd, size_t len) {
+    history_init();
+    if (store_entry(cmd, len) < 0)
+        return;
+    while (history_size > max_history || history_size > max_file_history)
+        remove_entry(0);
+}
+
+/* Store the number of entries kept in memory and in the history file in
+ * *MEM and *FILE. */
+void history_limits(int *mem, int *file) {
+    history_init();
+    *mem = max_history;
+    *file = max_file_history;
+}
+
 /*
  * Record a new command in the history file and in-memory list.
  * Returns nothing.  If the global flag `skip_next` is set the command
@@ -182,11 +323,8 @@ void add_history(const char *cmd) {
  * Returns nothing.
  */
 void print_history(void) {
-    history_renumber();
-    LIST_FOR_EACH(n, &history) {
-        HistEntry *e = LIST_ENTRY(n, HistEntry, node);
-        printf("%d %s\n", e->id, e->cmd);
-    }
+    for (int i = 0; i < history_size; i++)
+        printf("%d %s\n", i + 1, entry_text(i));
 }
 
 
@@ -195,14 +333,13 @@ void print_history(void) {
  * Returns NULL when there is no earlier entry.
  */
 const char *history_prev(void) {
-    HistEntry *tail_e = history_tail();
-    if (!tail_e)
+    if (history_size == 0)
         return NULL;
-    if (!cursor)
-        cursor = tail_e;
-    else if (entry_prev(cursor))
-        cursor = entry_prev(cursor);
-    return cursor ? cursor->cmd : NULL;
+    if (cursor < 0)
+        cursor = history_size - 1;
+    else if (cursor > 0)
+        cursor--;
+    return entry_text(cursor);
 }
 
 /*
@@ -210,13 +347,13 @@ const char *history_prev(void) {
  * Returns NULL when there is no later entry.
  */
 const char *history_next(void) {
-    if (!cursor)
+    if (cursor < 0)
         return NULL;
-    if (entry_next(cursor))
-        cursor = entry_next(cursor);
+    if (cursor + 1 < history_size)
+        cursor++;
     else
-        cursor = NULL;
-    return cursor ? cursor->cmd : NULL;
+        cursor = -1;
+    return cursor >= 0 ? entry_text(cursor) : NULL;
 }
 
 /*
@@ -224,25 +361,162 @@ const char *history_next(void) {
  * Returns nothing.
  */
 void history_reset_cursor(void) {
-    cursor = NULL;
+    cursor = -1;
+}
+
+/* Free the match sets above the first KEEP. */
+static void drop_match_sets(int keep) {
+    while (nmatch_sets > keep) {
+        MatchSet *m = &match_sets[--nmatch_sets];
+        free(m->pos);
+        free(m->ranked);
+    }
+}
+
+/*
+ * Return the entries containing TERM.  When TERM extends the term of the
+ * last set found they are picked from that set; otherwise the signatures
+ * select the entries to compare.  Returns NULL when memory runs out.
+ */
+static MatchSet *find_matches(const char *term) {
+    size_t len = strlen(term);
+    if (match_gen != history_gen) {
+        drop_match_sets(0);
+        match_gen = history_gen;
+    }
+    size_t same = 0;
+    while (same < search_term.len && same < len &&
+           search_term.data[same] == term[same])
+        same++;
+    while (nmatch_sets && match_sets[nmatch_sets - 1].term_len > same)
+        drop_match_sets(nmatch_sets - 1);
+    if (nmatch_sets && match_sets[nmatch_sets - 1].term_len == len)
+        return &match_sets[nmatch_sets - 1];
+
+    if (nmatch_sets == match_sets_cap) {
+        int cap = match_sets_cap ? match_sets_cap * 2 : 16;
+        MatchSet *tmp = realloc(match_sets, (size_t)cap * sizeof(*tmp));
+        RETURN_IF_ERR_RET(!tmp, "realloc", NULL);
+        match_sets = tmp;
+        match_sets_cap = cap;
+    }
+    MatchSet *prev = nmatch_sets ? &match_sets[nmatch_sets - 1] : NULL;
+    int max = prev ? prev->count : history_size;
+    int *pos = malloc((size_t)(max ? max : 1) * sizeof(*pos));
+    RETURN_IF_ERR_RET(!pos, "malloc", NULL);
+    int n = 0;
+    if (prev) {
+        for (int i = 0; i < prev->count; i++)
+            if (strstr(entry_text(prev->pos[i]), term))
+                pos[n++] = prev->pos[i];
+    } else {
+        uint64_t bytes, pairs;
+        signature(term, len, &bytes, &pairs);
+        for (int i = 0; i < history_size; i++) {
+            HistRec *r = rec_at(i);
+            if ((r->bytes & bytes) == bytes && (r->pairs & pairs) == pairs &&
+                r->len >= len && strstr(text + r->off, term))
+                pos[n++] = i;
+        }
+    }
+
+    if (!search_term.data)
+        strbuf_init(&search_term, 64);
+    search_term.len = 0;
+    strbuf_append(&search_term, term, len);
+    MatchSet *m = &match_sets[nmatch_sets++];
+    m->term_len = len;
+    m->pos = pos;
+    m->count = n;
+    m->ranked = NULL;
+    m->nranked = 0;
+    return m;
+}
+
+typedef struct {
+    int pos;               /* newest entry with this text */
+    int uses;
+} RankItem;
+
+static int by_text_newest(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    int c = strcmp(entry_text(x), entry_text(y));
+    return c ? c : y - x;
+}
+
+static int by_rank(const void *a, const void *b) {
+    const RankItem *x = a, *y = b;
+    if (x->uses != y->uses)
+        return y->uses - x->uses;
+    return y->pos - x->pos;
+}
+
+/* Order the distinct commands of M by use count, then by recency. */
+static int rank_matches(MatchSet *m) {
+    if (m->ranked || m->count == 0)
+        return 0;
+    int *sorted = malloc((size_t)m->count * sizeof(*sorted));
+    RankItem *items = malloc((size_t)m->count * sizeof(*items));
+    if (!sorted || !items) {
+        perror("malloc");
+        free(sorted);
+        free(items);
+        return -1;
+    }
+    memcpy(sorted, m->pos, (size_t)m->count * sizeof(*sorted));
+    qsort(sorted, (size_t)m->count, sizeof(*sorted), by_text_newest);
+    int n = 0;
+    for (int i = 0; i < m->count; i++) {
+        if (n && strcmp(entry_text(items[n - 1].pos),
+                        entry_text(sorted[i])) == 0) {
+            items[n - 1].uses++;
+            continue;
+        }
+        items[n].pos = sorted[i];
+        items[n].uses = 1;
+        n++;
+    }
+    qsort(items, (size_t)n, sizeof(*items), by_rank);
+    for (int i = 0; i < n; i++)
+        sorted[i] = items[i].pos;
+    free(items);
+    m->ranked = sorted;
+    m->nranked = n;
+    return 0;
 }
 
 /*
  * Search backward for a history entry containing 'term'.
  * Returns the matched command or NULL if none is found.  Subsequent calls
- * continue searching from the previous match.
+ * continue searching from the previous match.  With histrank the matches
+ * come in rank order instead.
  */
 const char *history_search_prev(const char *term) {
-    if (!term || !*term || !history_tail())
+    if (!term || !*term || history_size == 0)
         return NULL;
-    HistEntry *start = search_cursor ? entry_prev(search_cursor) : history_tail();
-    for (HistEntry *e = start; e; e = entry_prev(e)) {
-        if (strstr(e->cmd, term)) {
-            search_cursor = e;
-            return e->cmd;
-        }
+    MatchSet *m = find_matches(term);
+    if (!m)
+        return NULL;
+    if (opt_histrank) {
+        if (rank_matches(m) < 0 || rank_cursor + 1 >= m->nranked)
+            return NULL;
+        search_cursor = m->ranked[++rank_cursor];
+        return entry_text(search_cursor);
     }
-    return NULL;
+    /* the last match before the cursor */
+    int limit = search_cursor >= 0 ? search_cursor : history_size;
+    int lo = 0, hi = m->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (m->pos[mid] < limit)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+    search_cursor = m->pos[lo - 1];
+    return entry_text(search_cursor);
 }
 
 /*
@@ -250,69 +524,73 @@ const char *history_search_prev(const char *term) {
  * if one exists.  Returns the matched command or NULL if none is found.
  */
 const char *history_search_next(const char *term) {
-    if (!term || !*term || !history_head())
+    if (!term || !*term || history_size == 0)
         return NULL;
-    HistEntry *start = search_cursor ? entry_next(search_cursor) : history_head();
-    for (HistEntry *e = start; e; e = entry_next(e)) {
-        if (strstr(e->cmd, term)) {
-            search_cursor = e;
-            return e->cmd;
-        }
+    MatchSet *m = find_matches(term);
+    if (!m)
+        return NULL;
+    /* the first match after the cursor */
+    int lo = 0, hi = m->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (m->pos[mid] <= search_cursor)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    return NULL;
+    if (lo == m->count)
+        return NULL;
+    search_cursor = m->pos[lo];
+    return entry_text(search_cursor);
 }
 
 /*
- * Clear the search cursor used by history_search_prev/next.
+ * Clear the search cursor used by history_search_prev/next.  The matches
+ * found so far are kept for the next term.
  * Returns nothing.
  */
 void history_reset_search(void) {
-    search_cursor = NULL;
+    search_cursor = -1;
+    rank_cursor = -1;
 }
 
 /*
- * Remove all history entries from memory and truncate the history file.
+ * Release the in-memory history list.  The history file is left alone.
  * Returns nothing.
  */
-void clear_history(void) {
-    ListNode *n = history.head;
-    while (n) {
-        ListNode *next = n->next;
-        HistEntry *e = LIST_ENTRY(n, HistEntry, node);
-        free(e);
-        n = next;
-    }
-    list_init(&history);
-    cursor = search_cursor = NULL;
-    next_id = 1;
+void free_history(void) {
+    free(text);
+    free(recs);
+    text = NULL;
+    recs = NULL;
+    text_cap = 0;
+    rec_cap = 0;
+    rec_first = 0;
+    cursor = search_cursor = rank_cursor = -1;
     history_size = 0;
+    history_gen++;
+    drop_match_sets(0);
+}
 
+/*
+ * Remove all history entries from memory and truncate the history file.
+ * Returns nothing.
+ */
+void clear_history(void) {
+    free_history();
     history_file_clear();
 }
 
 /*
- * Delete the history entry with the given identifier.  The history file
- * is rewritten to reflect the removal.  Returns nothing.
+ * Delete the history entry with the given identifier.  Later entries move
+ * down by one and the history file is rewritten to reflect the removal.
+ * Returns nothing.
  */
 void delete_history_entry(int id) {
     history_init();
-    HistEntry *e = history_head();
-    while (e && e->id != id)
-        e = entry_next(e);
-    if (!e)
+    if (id < 1 || id > history_size)
         return;
-
-    list_remove(&history, &e->node);
-
-    if (cursor == e)
-        cursor = entry_next(e);
-    if (search_cursor == e)
-        search_cursor = entry_next(e);
-
-    free(e);
-    history_size--;
-
-    history_renumber();
+    remove_entry(id - 1);
     history_file_rewrite();
 }
 
@@ -321,17 +599,15 @@ void delete_history_entry(int id) {
  * file.  Has no effect when history is empty.
  */
 void delete_last_history_entry(void) {
-    HistEntry *t = history_tail();
-    if (t)
-        delete_history_entry(t->id);
+    if (history_size > 0)
+        delete_history_entry(history_size);
 }
 
 /*
  * Return the most recently added command or NULL if history is empty.
  */
 const char *history_last(void) {
-    HistEntry *t = history_tail();
-    return t ? t->cmd : NULL;
+    return history_size > 0 ? entry_text(history_size - 1) : NULL;
 }
 
 /*
@@ -342,9 +618,9 @@ const char *history_find_prefix(const char *prefix) {
     if (!prefix || !*prefix)
         return NULL;
     size_t len = strlen(prefix);
-    for (HistEntry *e = history_tail(); e; e = entry_prev(e)) {
-        if (strncmp(e->cmd, prefix, len) == 0)
-            return e->cmd;
+    for (int i = history_size - 1; i >= 0; i--) {
+        if (strncmp(entry_text(i), prefix, len) == 0)
+            return entry_text(i);
     }
     return NULL;
 }
@@ -353,11 +629,9 @@ const char *history_find_prefix(const char *prefix) {
  * Retrieve the command with identifier ID or NULL if no such entry exists.
  */
 const char *history_get_by_id(int id) {
-    for (HistEntry *e = history_head(); e; e = entry_next(e)) {
-        if (e->id == id)
-            return e->cmd;
-    }
-    return NULL;
+    if (id < 1 || id > history_size)
+        return NULL;
+    return entry_text(id - 1);
 }
 
 /*
@@ -366,12 +640,9 @@ const char *history_get_by_id(int id) {
  * when the requested entry does not exist.
  */
 const char *history_get_relative(int offset) {
-    if (offset <= 0)
+    if (offset <= 0 || offset > history_size)
         return NULL;
-    HistEntry *e = history_tail();
-    while (e && --offset > 0)
-        e = entry_prev(e);
-    return e ? e->cmd : NULL;
+    return entry_text(history_size - offset);
 }
 
 /*
@@ -424,9 +695,7 @@ char *history_all_words(void) {
 
 /* Iterate over all history entries, invoking CB for each command. */
 void history_list_iter(void (*cb)(const char *cmd, void *arg), void *arg) {
-    LIST_FOR_EACH(n, &history) {
-        HistEntry *e = LIST_ENTRY(n, HistEntry, node);
-        cb(e->cmd, arg);
-    }
+    for (int i = 0; i < history_size; i++)
+        cb(entry_text(i), arg);
 }
 
@@ -25,108 +25,85 @@
 #include "execute.h"
 #include "util.h"
 #include "cmd_subst.h"
+#include "strbuf.h"
 
 
-/* Append STR to OUT reallocating as needed. Returns 0 on allocation failure. */
-static int append_str(char **out, size_t *len, const char *str) {
-    size_t slen = strlen(str);
-    char *tmp = realloc(*out, *len + slen + 1);
-    if (!tmp)
-        return 0;
-    *out = tmp;
-    memcpy(*out + *len, str, slen);
-    *len += slen;
-    (*out)[*len] = '\0';
-    return 1;
-}
-
 /* Try to expand a command substitution at *P and append the result to OUT. */
-static int handle_cmd_sub(const char **p, char **out, size_t *outlen) {
+static int handle_cmd_sub(const char **p, StrBuf *out) {
     const char *s = *p;
     if (*s == '`' || (*s == '$' && s[1] == '(' && s[2] != '(')) {
-        char *dup = strdup(s);
-        if (!dup)
-            return -1;
-        char *dp = dup;
+        /* parse_substitution() only advances the pointer */
+        char *dp = (char *)s;
         char *sub = parse_substitution(&dp);
-        if (sub && dp > dup) {
-            size_t consumed = (size_t)(dp - dup);
-            *p += consumed;
-            if (!append_str(out, outlen, sub)) {
-                free(sub);
-                free(dup);
-                return -1;
+        if (sub && dp > s) {
+            *p = dp;
+            if (out->len == 0) {
+                /* adopt the capture rather than copying large outputs */
+                free(out->data);
+                out->len = strlen(sub);
+                out->cap = out->len + 1;
+                out->data = sub;
+                return 1;
             }
+            strbuf_appends(out, sub);
             free(sub);
-            free(dup);
             return 1;
         }
-        free(dup);
+        free(sub);
     }
     return 0;
 }
 
+/* Expand the LEN bytes at S with expand_simple() and append the result to
+ * OUT.  Returns 1 or -1 when expansion failed. */
+static int append_simple(const char *s, size_t len, StrBuf *out) {
+    char buf[MAX_LINE];
+    if (len >= sizeof(buf))
+        len = sizeof(buf) - 1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    char *exp = expand_simple(buf);
+    if (!exp)
+        return -1;
+    strbuf_appends(out, exp);
+    free(exp);
+    return 1;
+}
+
 /* Try to expand an arithmetic expression starting at *P.  The expression
  * is captured using gather_dbl_parens() so nested parentheses are handled
  * correctly. */
-static int handle_arith(const char **p, char **out, size_t *outlen) {
+static int handle_arith(const char **p, StrBuf *out) {
     const char *s = *p;
     if (*s == '$' && s[1] == '(' && s[2] == '(') {
-        char *dup = strdup(s + 1); /* after '$' */
-        if (dup) {
-            char *dp = dup;
-            char *body = gather_dbl_parens(&dp);
-            if (body) {
-                size_t consumed = (size_t)(dp - dup) + 1; /* include '$' */
-                char buf[MAX_LINE];
-                if (consumed >= sizeof(buf))
-                    consumed = sizeof(buf) - 1;
-                memcpy(buf, s, consumed);
-                buf[consumed] = '\0';
-                char *exp = expand_simple(buf);
-                if (!exp || !append_str(out, outlen, exp)) {
-                    free(exp);
-                    free(body);
-                    free(dup);
-                    return -1;
-                }
-                free(exp);
-                free(body);
-                *p += consumed;
-                free(dup);
-                return 1;
-            }
-            free(dup);
+        char *dp = (char *)s + 1; /* after '$', only advanced */
+        char *body = gather_dbl_parens(&dp);
+        if (body) {
+            free(body);
+            size_t consumed = (size_t)(dp - s);
+            if (consumed >= MAX_LINE)
+                consumed = MAX_LINE - 1;
+            if (append_simple(s, consumed, out) < 0)
+                return -1;
+            *p += consumed;
+            return 1;
         }
     }
     return 0;
 }
 
 /* Try to expand a parameter reference at *P. */
-static int handle_param(const char **p, char **out, size_t *outlen) {
+static int handle_param(const char **p, StrBuf *out) {
     const char *s = *p;
     if (*s != '$')
         return 0;
 
     const char *start = s;
+    size_t len = 0;
     if (s[1] == '{') {
         const char *end = strchr(s + 2, '}');
-        if (end) {
-            size_t len = (size_t)(end - start + 1);
-            char buf[MAX_LINE];
-            if (len >= sizeof(buf))
-                len = sizeof(buf) - 1;
-            memcpy(buf, start, len);
-            buf[len] = '\0';
-            char *exp = expand_simple(buf);
-            if (!exp || !append_str(out, outlen, exp)) {
-                free(exp);
-                return -1;
-            }
-            free(exp);
-            *p += len;
-            return 1;
-        }
+        if (end)
+            len = (size_t)(end - start + 1);
     } else {
         const char *q = s + 1;
         if (*q == '#' || *q == '?' || *q == '*' || *q == '@' ||
@@ -140,24 +117,17 @@ static int handle_param(const char **p, char **out, size_t *outlen) {
             while (*q && (isalnum((unsigned char)*q) || *q == '_'))
                 q++;
         }
-        if (q > s + 1) {
-            size_t len = (size_t)(q - start);
-            char buf[MAX_LINE];
-            if (len >= sizeof(buf))
-                len = sizeof(buf) - 1;
-            memcpy(buf, start, len);
-            buf[len] = '\0';
-            char *exp = expand_simple(buf);
-            if (!exp || !append_str(out, outlen, exp)) {
-                free(exp);
-                return -1;
-            }
-            free(exp);
-            *p += len;
-            return 1;
-        }
+        if (q > s + 1)
+            len = (size_t)(q - start);
     }
-    return 0;
+    if (!len)
+        return 0;
+    if (len >= MAX_LINE)
+        len = MAX_LINE - 1;
+    if (append_simple(start, len, out) < 0)
+        return -1;
+    *p += len;
+    return 1;
 }
 
 /* Expand TOKEN which may contain multiple variable or command substitutions. */
@@ -189,58 +159,53 @@ char *expand_var(const char *token) {
         return strndup(token + 1, tlen - 2);
     }
     if (tlen >= 2 && token[0] == '"' && token[tlen - 1] == '"') {
-        size_t innerlen = tlen - 2;
-        if (innerlen >= MAX_LINE)
-            innerlen = MAX_LINE - 1;
-        char inner[MAX_LINE];
-        memcpy(inner, token + 1, innerlen);
-        inner[innerlen] = '\0';
+        char *inner = strndup(token + 1, tlen - 2);
+        if (!inner)
+            return NULL;
         char *res = expand_var(inner);
+        free(inner);
         if (!res)
             return NULL;
-        size_t rlen = strlen(res);
-        char *quoted = malloc(rlen + 3);
-        if (!quoted) {
-            free(res);
-            return NULL;
-        }
-        quoted[0] = '"';
-        memcpy(quoted + 1, res, rlen + 1);
-        quoted[rlen + 1] = '"';
-        quoted[rlen + 2] = '\0';
+        StrBuf quoted;
+        strbuf_init(&quoted, strlen(res) + 2);
+        strbuf_appendc(&quoted, '"');
+        strbuf_appends(&quoted, res);
+        strbuf_appendc(&quoted, '"');
         free(res);
-        return quoted;
+        return strbuf_finish(&quoted);
     }
 
-    char *out = xcalloc(1, 1);
-    size_t outlen = 0;
+    /* literal text is copied in runs and the buffer doubles as it grows,
+     * so a long word costs a handful of allocations rather than one per
+     * byte */
+    StrBuf out;
+    strbuf_init(&out, tlen);
 
     const char *p = token;
     while (*p) {
-        int r = handle_cmd_sub(&p, &out, &outlen);
-        if (r < 0) { free(out); return NULL; }
-        if (r > 0) continue;
-
-        r = handle_arith(&p, &out, &outlen);
-        if (r < 0) { free(out); return NULL; }
-        if (r > 0) continue;
-
-        r = handle_param(&p, &out, &outlen);
-        if (r < 0) { free(out); return NULL; }
-        if (r > 0) continue;
-
-        if (*p == '$') {
-            if (!append_str(&out, &outlen, "$")) { free(out); return NULL; }
-            p++;
+        size_t run = strcspn(p, "$`");
+        if (run) {
+            strbuf_append(&out, p, run);
+            p += run;
             continue;
         }
 
-        char ch[2] = {*p, '\0'};
-        if (!append_str(&out, &outlen, ch)) { free(out); return NULL; }
-        p++;
+        int r = handle_cmd_sub(&p, &out);
+        if (r == 0)
+            r = handle_arith(&p, &out);
+        if (r == 0)
+            r = handle_param(&p, &out);
+        if (r < 0) {
+            strbuf_release(&out);
+            return NULL;
+        }
+        if (r > 0)
+            continue;
+
+        strbuf_appendc(&out, *p++);
     }
 
-    return out;
+    return strbuf_finish(&out);
 }
 
 /* Perform history expansion on LINE when it begins with '!'. Returns a new
@@ -12,6 +12,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "cmd_subst.h"
+#include "strbuf.h"
+#include "vars.h"
 static char *parse_quoted_word(char **p, int *quoted, int *do_expand_out);
 static char *parse_ansi_quoted_word(char **p, int *quoted, int *do_expand_out);
 
@@ -102,18 +104,17 @@ static char *read_redirect_token(char **p) {
     return NULL;
 }
 
-/* Consume a backslash escape from *p and append the escaped character to BUF.
+/* Consume a backslash escape from *p and append the escaped character to SB.
  * FIRST indicates whether this is the first character of the token and thus
  * controls whether variable expansion should occur. DO_EXPAND is updated
  * accordingly. */
-static void read_backslash_escape(char **p, char buf[], int *len,
+static void read_backslash_escape(char **p, StrBuf *sb,
                                  int *first, int *do_expand,
                                  int disable_first) {
     (*p)++; /* move past the backslash */
     if (!**p) {
         /* dangling backslash at end of input */
-        if (*len < MAX_LINE - 1)
-            buf[(*len)++] = '\\';
+        strbuf_appendc(sb, '\\');
         *first = 0;
         return;
     }
@@ -121,18 +122,15 @@ static void read_backslash_escape(char **p, char buf[], int *len,
     if (!disable_first &&
         (**p == '$' || **p == '`' || **p == '"' || **p == '\\')) {
         /* within double quotes drop the backslash */
-        if (*len < MAX_LINE - 1)
-            buf[(*len)++] = **p;
+        strbuf_appendc(sb, **p);
         (*p)++;
         *first = 0;
         return;
     }
 
     /* default behavior: preserve backslash */
-    if (*len < MAX_LINE - 1)
-        buf[(*len)++] = '\\';
-    if (*len < MAX_LINE - 1)
-        buf[(*len)++] = **p;
+    strbuf_appendc(sb, '\\');
+    strbuf_appendc(sb, **p);
     if (*first && disable_first && (**p == '$' || **p == '`'))
         *do_expand = 0;
     (*p)++;
@@ -140,19 +138,19 @@ static void read_backslash_escape(char **p, char buf[], int *len,
 }
 
 /* Attempt to read a ${...} braced expansion. Returns 1 when consumed. */
-static int read_braced_expansion(char **p, char buf[], int *len) {
+static int read_braced_expansion(char **p, StrBuf *sb) {
     const char *start = *p;
     if (!(**p == '$' && *(*p + 1) == '{'))
         return 0;
 
-    if (*len < MAX_LINE - 1) buf[(*len)++] = *(*p)++; /* $ */
-    if (*len < MAX_LINE - 1) buf[(*len)++] = *(*p)++; /* { */
-    while (**p && **p != '}' && *len < MAX_LINE - 1) {
-        buf[(*len)++] = **p;
+    strbuf_appendc(sb, *(*p)++); /* $ */
+    strbuf_appendc(sb, *(*p)++); /* { */
+    while (**p && **p != '}') {
+        strbuf_appendc(sb, **p);
         (*p)++;
     }
     if (**p == '}') {
-        if (*len < MAX_LINE - 1) buf[(*len)++] = *(*p)++;
+        strbuf_appendc(sb, *(*p)++);
         return 1;
     }
     /* unmatched, reset pointer for error */
@@ -173,12 +171,12 @@ static int is_end_dquote(int c) {
 }
 
 /* Read characters for a simple token using IS_END as the terminator predicate.
- * Characters are copied into BUF while tracking quoting state.  No variable
+ * Characters are appended to SB while tracking quoting state.  No variable
  * or command substitution is performed here so that expansion can be delayed
  * until execution time.  DO_EXPAND is set to zero when quoting prevents
  * expansion.  Returns 0 on success or -1 on errors. */
-static int read_simple_token(char **p, int (*is_end)(int), char buf[],
-                             int *len, int *do_expand, int disable_first) {
+static int read_simple_token(char **p, int (*is_end)(int), StrBuf *sb,
+                             int *do_expand, int disable_first) {
     int first = 1;
     int in_assign = 0;
 
@@ -191,14 +189,8 @@ static int read_simple_token(char **p, int (*is_end)(int), char buf[],
             parse_need_more = 1;
             return -1;
         }
-        if (*len < MAX_LINE - 1)
-            buf[(*len)++] = '$';
-        size_t l = (size_t)(dp - (*p + 1)); /* length of "((expr))" */
-        size_t avail = (size_t)(MAX_LINE - 1 - *len);
-        if (l > avail)
-            l = avail;
-        memcpy(buf + *len, *p + 1, l);
-        *len += l;
+        strbuf_appendc(sb, '$');
+        strbuf_append(sb, *p + 1, (size_t)(dp - (*p + 1))); /* "((expr))" */
         *p = dp;
         free(body);
         return 0;
@@ -206,27 +198,21 @@ static int read_simple_token(char **p, int (*is_end)(int), char buf[],
 
     while (**p && !is_end((unsigned char)**p)) {
         if (!in_assign && **p == '=') {
-            if (*len < MAX_LINE - 1)
-                buf[(*len)++] = **p;
+            strbuf_appendc(sb, **p);
             (*p)++;
             in_assign = 1;
             first = 0;
             continue;
         }
         if (**p == '$' && *(*p + 1) == '(' && *(*p + 2) == '(') {
-            if (*len < MAX_LINE - 1) buf[(*len)++] = *(*p)++; /* '$' */
+            strbuf_appendc(sb, *(*p)++); /* '$' */
             char *dp = *p; /* points at "((" */
             char *body = gather_dbl_parens(&dp);
             if (!body) {
                 parse_need_more = 1;
                 return -1;
             }
-            size_t l = (size_t)(dp - *p); /* length of "((expr))" */
-            size_t avail = (size_t)(MAX_LINE - 1 - *len);
-            if (l > avail)
-                l = avail;
-            memcpy(buf + *len, *p, l);
-            *len += l;
+            strbuf_append(sb, *p, (size_t)(dp - *p)); /* "((expr))" */
             *p = dp;
             free(body);
             first = 0;
@@ -237,8 +223,7 @@ static int read_simple_token(char **p, int (*is_end)(int), char buf[],
             char *part = parse_ansi_quoted_word(p, &q, &de);
             if (!part)
                 return -1;
-            for (int ci = 0; part[ci] && *len < MAX_LINE - 1; ci++)
-                buf[(*len)++] = part[ci];
+            strbuf_appends(sb, part);
             free(part);
             *do_expand = 0;
             first = 0;
@@ -250,12 +235,11 @@ static int read_simple_token(char **p, int (*is_end)(int), char buf[],
             char *part = parse_quoted_word(p, &q, &de);
             if (!part)
                 return -1;
-            if (quote == '\'' && in_assign && *len > 0 && buf[*len - 1] != '=') {
-                if (*len < MAX_LINE - 1)
-                    buf[(*len)++] = '\'';
+            if (quote == '\'' && in_assign && sb->len > 0 &&
+                sb->data[sb->len - 1] != '=') {
+                strbuf_appendc(sb, '\'');
             }
-            for (int ci = 0; part[ci] && *len < MAX_LINE - 1; ci++)
-                buf[(*len)++] = part[ci];
+            strbuf_appends(sb, part);
             free(part);
             *do_expand = 0;
             first = 0;
@@ -265,9 +249,9 @@ static int read_simple_token(char **p, int (*is_end)(int), char buf[],
             int depth = 0;
             int closed = 0;
             char startc = **p;
-            if (*len < MAX_LINE - 1) buf[(*len)++] = *(*p)++;
+            strbuf_appendc(sb, *(*p)++);
             if (startc == '$') {
-                if (*len < MAX_LINE - 1) buf[(*len)++] = *(*p)++; /* '(' */
+                strbuf_appendc(sb, *(*p)++); /* '(' */
                 depth = 1;
             }
             while (**p && ((startc == '`' && **p != '`') ||
@@ -277,14 +261,14 @@ static int read_simple_token(char **p, int (*is_end)(int), char buf[],
                     else if (**p == ')') {
                         depth--;
                         if (depth == 0) {
-                            if (*len < MAX_LINE - 1) buf[(*len)++] = **p;
+                            strbuf_appendc(sb, **p);
                             (*p)++;
                             closed = 1;
                             break;
                         }
                     }
                 }
-                if (*len < MAX_LINE - 1) buf[(*len)++] = **p;
+                strbuf_appendc(sb, **p);
                 (*p)++;
             }
             if (!closed && !**p) {
@@ -294,7 +278,7 @@ static int read_simple_token(char **p, int (*is_end)(int), char buf[],
             }
             if (startc == '`') {
                 if (**p == '`') {
-                    if (*len < MAX_LINE - 1) buf[(*len)++] = *(*p)++;
+                    strbuf_appendc(sb, *(*p)++);
                     closed = 1;
                 } else if (!closed) {
                     fprintf(stderr, "syntax error: unmatched '`'\n");
@@ -316,56 +300,50 @@ static int read_simple_token(char **p, int (*is_end)(int), char buf[],
                     parse_need_more = 0;
                     return -1;
                 }
-                char tmp[MAX_LINE];
-                size_t seglen = (size_t)(end - start);
-                if (seglen > MAX_LINE - 3)
-                    seglen = MAX_LINE - 3;
-                tmp[0] = '"';
-                memcpy(tmp + 1, start, seglen);
-                tmp[1 + seglen] = '"';
-                tmp[2 + seglen] = '\0';
-                char *tp = tmp;
+                StrBuf tmp;
+                strbuf_init(&tmp, (size_t)(end - start) + 2);
+                strbuf_appendc(&tmp, '"');
+                strbuf_append(&tmp, start, (size_t)(end - start));
+                strbuf_appendc(&tmp, '"');
+                char *tp = tmp.data;
                 int q = 0; int de = 1;
                 char *part = parse_quoted_word(&tp, &q, &de);
+                strbuf_release(&tmp);
                 if (!part)
                     return -1;
-                if (*len < MAX_LINE - 1)
-                    buf[(*len)++] = '"';
-                for (int ci = 0; part[ci] && *len < MAX_LINE - 1; ci++)
-                    buf[(*len)++] = part[ci];
-                if (*len < MAX_LINE - 1)
-                    buf[(*len)++] = '"';
+                strbuf_appendc(sb, '"');
+                strbuf_appends(sb, part);
+                strbuf_appendc(sb, '"');
                 free(part);
                 *p = end + 2; /* skip closing \" */
                 *do_expand = de;
                 first = 0;
                 continue;
             }
-            read_backslash_escape(p, buf, len, &first, do_expand,
+            read_backslash_escape(p, sb, &first, do_expand,
                                  disable_first);
             continue;
         }
-        if (read_braced_expansion(p, buf, len)) {
+        if (read_braced_expansion(p, sb)) {
             first = 0;
             continue;
         }
         if (**p == '$' && strchr("#?*@-$!", *(*p + 1))) {
-            if (*len < MAX_LINE - 1) buf[(*len)++] = *(*p)++; /* '$' */
-            if (*len < MAX_LINE - 1) buf[(*len)++] = *(*p)++;
+            strbuf_appendc(sb, *(*p)++); /* '$' */
+            strbuf_appendc(sb, *(*p)++);
             first = 0;
             continue;
         }
         if (**p == '$' && (isalnum((unsigned char)*(*p + 1)))) {
-            if (*len < MAX_LINE - 1)
-                buf[(*len)++] = *(*p)++; /* '$' */
-            while (**p && isalnum((unsigned char)**p) && *len < MAX_LINE - 1) {
-                buf[(*len)++] = **p;
+            strbuf_appendc(sb, *(*p)++); /* '$' */
+            while (**p && isalnum((unsigned char)**p)) {
+                strbuf_appendc(sb, **p);
                 (*p)++;
             }
             first = 0;
             continue;
         }
-        if (*len < MAX_LINE - 1) buf[(*len)++] = **p;
+        strbuf_appendc(sb, **p);
         (*p)++;
         first = 0;
     }
@@ -376,17 +354,19 @@ static int read_simple_token(char **p, int (*is_end)(int), char buf[],
  * set and DO_EXPAND_OUT receives whether expansion should occur.  Returns the
  * resulting allocated string or NULL on syntax errors. */
 static char *parse_quoted_word(char **p, int *quoted, int *do_expand_out) {
-    char buf[MAX_LINE];
-    int len = 0;
+    StrBuf sb;
     int do_expand = 1;
     char quote = **p;
     *quoted = 1;
     if (quote == '\'') {
         do_expand = 0;
         (*p)++;
-        while (**p && **p != quote && len < MAX_LINE - 1)
-            buf[len++] = *(*p)++;
+        const char *start = *p;
+        while (**p && **p != quote)
+            (*p)++;
         if (**p == quote) {
+            strbuf_init(&sb, (size_t)(*p - start));
+            strbuf_append(&sb, start, (size_t)(*p - start));
             (*p)++;
         } else if (**p == '\0') {
             fprintf(stderr, "syntax error: unmatched '%c'\n", quote);
@@ -398,64 +378,67 @@ static char *parse_quoted_word(char **p, int *quoted, int *do_expand_out) {
         }
     } else {
         (*p)++;
-        if (read_simple_token(p, is_end_dquote, buf, &len, &do_expand,
-                              0) < 0)
+        strbuf_init(&sb, 64);
+        if (read_simple_token(p, is_end_dquote, &sb, &do_expand, 0) < 0) {
+            strbuf_release(&sb);
             return NULL;
+        }
         if (**p == quote) {
             (*p)++;
         } else if (**p == '\0') {
             fprintf(stderr, "syntax error: unmatched '\"'\n");
             parse_need_more = 0;
+            strbuf_release(&sb);
             return NULL;
         } else {
             fprintf(stderr, "syntax error: unmatched '\"'\n");
+            strbuf_release(&sb);
             return NULL;
         }
     }
-    buf[len] = '\0';
     if (do_expand_out) *do_expand_out = do_expand;
-    return strdup(buf);
+    return strbuf_finish(&sb);
 }
 
 /* Parse an ANSI-C quoted word starting at *p of the form $'...'.  QUOTED is
  * set and DO_EXPAND_OUT receives whether expansion should occur (always 0).
  * Returns the resulting allocated string or NULL on syntax errors. */
 static char *parse_ansi_quoted_word(char **p, int *quoted, int *do_expand_out) {
-    char buf[MAX_LINE];
-    int len = 0;
+    StrBuf sb;
     int do_expand = 0;
     *quoted = 1;
     *p += 2; /* skip $' */
-    while (**p && **p != '\'' && len < MAX_LINE - 1) {
+    strbuf_init(&sb, 64);
+    while (**p && **p != '\'') {
         if (**p == '\\' && (*p)[1]) {
             (*p)++;
             char c = **p;
             switch (c) {
-            case 'n': buf[len++] = '\n'; break;
-            case 't': buf[len++] = '\t'; break;
-            case 'r': buf[len++] = '\r'; break;
-            case 'b': buf[len++] = '\b'; break;
-            case 'a': buf[len++] = '\a'; break;
-            case 'f': buf[len++] = '\f'; break;
-            case 'v': buf[len++] = '\v'; break;
-            case '\\': buf[len++] = '\\'; break;
-            case '\'': buf[len++] = '\''; break;
-            case '"': buf[len++] = '"'; break;
+            case 'n': strbuf_appendc(&sb, '\n'); break;
+            case 't': strbuf_appendc(&sb, '\t'); break;
+            case 'r': strbuf_appendc(&sb, '\r'); break;
+            case 'b': strbuf_appendc(&sb, '\b'); break;
+            case 'a': strbuf_appendc(&sb, '\a'); break;
+            case 'f': strbuf_appendc(&sb, '\f'); break;
+            case 'v': strbuf_appendc(&sb, '\v'); break;
+            case '\\': strbuf_appendc(&sb, '\\'); break;
+            case '\'': strbuf_appendc(&sb, '\''); break;
+            case '"': strbuf_appendc(&sb, '"'); break;
             case '0': {
                 int val = 0, cnt = 0;
                 while (cnt < 3 && (*p)[1] >= '0' && (*p)[1] <= '7') {
                     (*p)++; cnt++; val = val * 8 + (**p - '0');
                 }
-                buf[len++] = (char)val;
+                strbuf_appendc(&sb, (char)val);
                 break;
             }
             default:
-                buf[len++] = '\\';
-                buf[len++] = c;
+                strbuf_appendc(&sb, '\\');
+                strbuf_appendc(&sb, c);
                 break;
             }
         } else {
-            buf[len++] = **p;
+            strbuf_appendc(&sb, **p);
         }
         (*p)++;
     }
@@ -464,22 +447,21 @@ static char *parse_ansi_quoted_word(char **p, int *quoted, int *do_expand_out) {
     } else if (**p == '\0') {
         fprintf(stderr, "syntax error: unmatched '\''\n");
         parse_need_more = 0;
+        strbuf_release(&sb);
         return NULL;
     } else {
         fprintf(stderr, "syntax error: unmatched '\''\n");
+        strbuf_release(&sb);
         return NULL;
     }
-    buf[len] = '\0';
     if (do_expand_out) *do_expand_out = do_expand;
-    return strdup(buf);
+    return strbuf_finish(&sb);
 }
 
 /* Read the next shell token from *p performing necessary expansions.
  * QUOTED is set when the token was quoted.  The returned string is
  * dynamically allocated and *p is advanced past the token. */
 char *read_token(char **p, int *quoted, int *do_expand_out) {
-    char buf[MAX_LINE];
-    int len = 0;
     int do_expand = parse_noexpand ? 0 : 1;
     *quoted = 0;
     char *redir = read_redirect_token(p);
@@ -497,12 +479,14 @@ char *read_token(char **p, int *quoted, int *do_expand_out) {
         if (do_expand_out) *do_expand_out = do_expand;
         return res;
     }
-    if (read_simple_token(p, is_end_unquoted, buf, &len, &do_expand,
-                          1) < 0)
+    StrBuf sb;
+    strbuf_init(&sb, 64);
+    if (read_simple_token(p, is_end_unquoted, &sb, &do_expand, 1) < 0) {
+        strbuf_release(&sb);
         return NULL;
-    buf[len] = '\0';
-    char *res = strdup(buf);
-    if (getenv("VUSH_DEBUG"))
+    }
+    char *res = strbuf_finish(&sb);
+    if (get_env_var("VUSH_DEBUG"))
         fprintf(stderr, "read_token: '%s'\n", res);
     if (do_expand_out) *do_expand_out = do_expand;
     return res;
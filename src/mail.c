@@ -10,6 +10,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include "mail.h"
+#include "vars.h"
 
 struct MailEntry {
     char *path;
@@ -65,8 +66,8 @@ void free_mail_list(void)
 /* Check each configured mailbox and print a notice when new mail exists. */
 void check_mail(void)
 {
-    char *mpath = getenv("MAILPATH");
-    char *mail = getenv("MAIL");
+    const char *mpath = get_env_var("MAILPATH");
+    const char *mail = get_env_var("MAIL");
     char *list[64];
     int count = 0;
 
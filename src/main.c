@@ -42,6 +42,8 @@
 #include "startup.h"
 #include "mail.h"
 #include "repl.h"
+#include "profile.h"
+#include "stats.h"
 
 
 ShellState shell_state = {
@@ -50,19 +52,25 @@ ShellState shell_state = {
 };
 
 #include "options.h"
+#include "vars.h"
 
 int main(int argc, char **argv) {
 
     FILE *input = stdin;
     char *dash_c = NULL;
 
+    stats_init();
+
+    extern char **environ;
+    import_environment(environ);
+
     /* Always expose the running shell as $SHELL */
-    setenv("SHELL", argv[0], 1);
+    export_var("SHELL", argv[0]);
 
-    if (!getenv("PWD")) {
+    if (!get_env_var("PWD")) {
         char *cwd = getcwd(NULL, 0);
         if (cwd) {
-            setenv("PWD", cwd, 1);
+            export_var("PWD", cwd);
             free(cwd);
         }
     }
@@ -124,6 +132,13 @@ int main(int argc, char **argv) {
     sigaction(SIGCHLD, &sa_chld, NULL);
     init_signal_handling();
 
+    /* a report file named in the environment profiles the whole run */
+    const char *profile = get_env_var("VUSH_PROFILE");
+    if (profile && *profile) {
+        opt_profile = 1;
+        profile_start();
+    }
+
     load_history();
     load_aliases();
     load_functions();
@@ -132,7 +147,7 @@ int main(int argc, char **argv) {
     if (!opt_privileged)
         rc_ran = process_startup_file(input);
 
-    const char *envfile = getenv("ENV");
+    const char *envfile = get_env_var("ENV");
     int env_ran = 0;
     if (envfile && *envfile)
         env_ran = process_rc_file(envfile, input);
@@ -147,7 +162,8 @@ int main(int argc, char **argv) {
     if (input != stdin)
         fclose(input);
     run_exit_trap();
-    clear_history();
+    history_flush();
+    free_history();
     dirstack_clear();
     if (script_argv) {
         for (int i = 0; i <= script_argc; i++)
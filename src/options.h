@@ -26,6 +26,9 @@
 #define opt_onecmd    (shell_state.opt_onecmd)
 #define opt_hashall   (shell_state.opt_hashall)
 #define opt_keyword   (shell_state.opt_keyword)
+#define opt_globstar  (shell_state.opt_globstar)
+#define opt_profile   (shell_state.opt_profile)
+#define opt_histrank  (shell_state.opt_histrank)
 #define current_lineno (shell_state.current_lineno)
 #define parent_pid    (shell_state.parent_pid)
 
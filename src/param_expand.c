@@ -16,7 +16,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fnmatch.h>
 #include <ctype.h>
 #include <pwd.h>
 #include <unistd.h>
@@ -25,13 +24,13 @@
 #include "util.h"
 #include "shell_state.h"
 #include "cmd_subst.h"
+#include "pattern.h"
+#include "strbuf.h"
 
 static char *expand_tilde(const char *token);
 static char *lookup_passwd_home(const char *user);
 static char *expand_arith(const char *token);
 static char *expand_array_element(const char *name, const char *idxstr);
-static int find_glob_substring(const char *text, const char *pat,
-                               size_t *start, size_t *len);
 static char *apply_modifier(const char *name, const char *val, const char *p);
 static char *quote_value(const char *val);
 static char *expand_length(const char *name);
@@ -41,7 +40,7 @@ static char *expand_plain_var(const char *name);
 
 /* Lookup a user's home directory by parsing the passwd file directly. */
 static char *lookup_passwd_home(const char *user) {
-    const char *passwd = getenv("NSS_WRAPPER_PASSWD");
+    const char *passwd = get_env_var("NSS_WRAPPER_PASSWD");
     if (!passwd || !*passwd)
         passwd = "/etc/passwd";
     FILE *fp = fopen(passwd, "r");
@@ -83,7 +82,7 @@ static char *expand_tilde(const char *token) {
     const char *home = NULL;
     char *home_alloc = NULL;
     if (*rest == '/' || *rest == '\0') {
-        home = getenv("HOME");
+        home = get_env_var("HOME");
     } else {
         const char *slash = strchr(rest, '/');
         size_t len = slash ? (size_t)(slash - rest) : strlen(rest);
@@ -109,7 +108,7 @@ static char *expand_tilde(const char *token) {
         }
         rest = slash ? slash : rest + len;
     }
-    if (!home) home = getenv("HOME");
+    if (!home) home = get_env_var("HOME");
     if (!home) home = "";
     size_t home_len = strlen(home);
     size_t rest_len = strlen(rest);
@@ -174,7 +173,7 @@ static char *expand_array_element(const char *name, const char *idxstr) {
             }
             return joined;
         }
-        const char *val = getenv(name);
+        const char *val = get_env_var(name);
         if (!val) val = "";
         return strdup(val);
     } else {
@@ -185,7 +184,7 @@ static char *expand_array_element(const char *name, const char *idxstr) {
                 return strdup(arr[idx]);
             return strdup("");
         }
-        const char *val = getenv(name);
+        const char *val = get_env_var(name);
         if (!val) val = "";
 
         return strdup(val);
@@ -232,27 +231,6 @@ static char *quote_value(const char *val) {
     return res;
 }
 
-static int find_glob_substring(const char *text, const char *pat,
-                               size_t *start, size_t *len) {
-    size_t tlen = strlen(text);
-    char buf[MAX_LINE];
-    for (size_t i = 0; i < tlen; i++) {
-        size_t remain = tlen - i;
-        for (size_t l = remain; l > 0; l--) {
-            if (l >= sizeof(buf))
-                continue;
-            memcpy(buf, text + i, l);
-            buf[l] = '\0';
-            if (fnmatch(pat, buf, 0) == 0) {
-                if (start) *start = i;
-                if (len) *len = l;
-                return 1;
-            }
-        }
-    }
-    return 0;
-}
-
 static char *apply_modifier(const char *name, const char *val, const char *p) {
     if (*p == ':' && (p[1] == '-' || p[1] == '=' || p[1] == '+')) {
         char op = p[1];
@@ -266,8 +244,6 @@ static char *apply_modifier(const char *name, const char *val, const char *p) {
         if (op == '=') {
             if (!val || val[0] == '\0') {
                 set_shell_var(name, wexp);
-                if (getenv(name))
-                    setenv(name, wexp, 1);
                 val = wexp;
             }
         }
@@ -315,39 +291,28 @@ static char *apply_modifier(const char *name, const char *val, const char *p) {
         const char *repl = sep + 1;
         if (!pattern) return strdup(val ? val : "");
         if (!val) val = "";
+        PatternInfo pi;
+        if (pattern_compile(&pi, pattern) < 0) {
+            free(pattern);
+            return NULL;
+        }
         size_t vlen = strlen(val);
         size_t rlen = strlen(repl);
-        size_t cap = vlen * (rlen ? rlen : 1) + 1;
-        char *res = malloc(cap);
-        if (!res) { free(pattern); return NULL; }
-        size_t out = 0;
         size_t pos = 0;
-        while (pos < vlen) {
-            size_t s, l;
-            if (find_glob_substring(val + pos, pattern, &s, &l)) {
-                memcpy(res + out, val + pos, s);
-                out += s;
-                memcpy(res + out, repl, rlen);
-                out += rlen;
-                pos += s + l;
-                if (!global)
-                    break;
-            } else {
-                size_t rest = vlen - pos;
-                memcpy(res + out, val + pos, rest);
-                out += rest;
-                pos = vlen;
-            }
-        }
-        if (pos < vlen) {
-            memcpy(res + out, val + pos, vlen - pos);
-            out += vlen - pos;
+        StrBuf res;
+        strbuf_init(&res, vlen);
+        size_t s, l;
+        while (pos < vlen && pattern_search(&pi, val + pos, vlen - pos, &s, &l)) {
+            strbuf_append(&res, val + pos, s);
+            strbuf_append(&res, repl, rlen);
+            pos += s + l;
+            if (!global)
+                break;
         }
-        res[out] = '\0';
+        strbuf_append(&res, val + pos, vlen - pos);
+        pattern_free(&pi);
         free(pattern);
-        char *ret = strdup(res);
-        free(res);
-        return ret ? ret : strdup("");
+        return strbuf_finish(&res);
     } else if (*p == ':' && isdigit((unsigned char)p[1])) {
         if (!val) {
             if (opt_nounset) {
@@ -383,57 +348,17 @@ static char *apply_modifier(const char *name, const char *val, const char *p) {
         const char *pattern = p + 1;
         if (!val) val = "";
         size_t vlen = strlen(val);
-        if (op == '#') {
-            if (!longest) {
-                for (size_t i = 0; i <= vlen; i++) {
-                    char *pref = strndup(val, i);
-                    if (!pref) break;
-                    int m = fnmatch(pattern, pref, 0);
-                    free(pref);
-                    if (m == 0)
-                        return strdup(val + i);
-                }
-            } else {
-                for (size_t i = vlen;; i--) {
-                    char *pref = strndup(val, i);
-                    if (!pref) break;
-                    int m = fnmatch(pattern, pref, 0);
-                    free(pref);
-                    if (m == 0)
-                        return strdup(val + i);
-                    if (i == 0)
-                        break;
-                }
-            }
-            return strdup(val);
-        } else {
-            if (!longest) {
-                for (size_t i = 0; i <= vlen; i++) {
-                    char *suf = strdup(val + vlen - i);
-                    if (!suf) break;
-                    int m = fnmatch(pattern, suf, 0);
-                    free(suf);
-                    if (m == 0) {
-                        char *res = strndup(val, vlen - i);
-                        return res ? res : strdup("");
-                    }
-                }
-            } else {
-                for (size_t i = vlen;; i--) {
-                    char *suf = strdup(val + vlen - i);
-                    if (!suf) break;
-                    int m = fnmatch(pattern, suf, 0);
-                    free(suf);
-                    if (m == 0) {
-                        char *res = strndup(val, vlen - i);
-                        return res ? res : strdup("");
-                    }
-                    if (i == 0)
-                        break;
-                }
-            }
+        PatternInfo pi;
+        if (pattern_compile(&pi, pattern) < 0)
+            return NULL;
+        long l = pattern_anchored(&pi, val, vlen, op == '%', longest);
+        pattern_free(&pi);
+        if (l < 0)
             return strdup(val);
-        }
+        if (op == '#')
+            return strdup(val + l);
+        char *res = strndup(val, vlen - l);
+        return res ? res : strdup("");
     } else {
         if (!val) {
             if (opt_nounset) {
@@ -449,7 +374,7 @@ static char *apply_modifier(const char *name, const char *val, const char *p) {
 
 static char *expand_length(const char *name) {
     const char *val = get_shell_var(name);
-    if (!val) val = getenv(name);
+    if (!val) val = get_env_var(name);
     if (!val) {
         if (opt_nounset) {
             fprintf(stderr, "%s: unbound variable\n", name);
@@ -476,7 +401,7 @@ static char *expand_braced(const char *inner) {
         var[vn] = '\0';
 
         const char *name = get_shell_var(var);
-        if (!name) name = getenv(var);
+        if (!name) name = get_env_var(var);
         if (!name) {
             if (opt_nounset) {
                 fprintf(stderr, "%s: unbound variable\n", var);
@@ -489,7 +414,7 @@ static char *expand_braced(const char *inner) {
         const char *val = NULL;
         if (*name) {
             val = get_shell_var(name);
-            if (!val) val = getenv(name);
+            if (!val) val = get_env_var(name);
         }
 
         if (*p == '@' && p[1]) {
@@ -536,7 +461,7 @@ static char *expand_braced(const char *inner) {
         return expand_array_element(name, idxstr);
     } else {
         val = get_shell_var(name);
-        if (!val) val = getenv(name);
+        if (!val) val = get_env_var(name);
     }
 
     if (*p == '@' && p[1]) {
@@ -640,7 +565,7 @@ static char *expand_special(const char *token) {
         if (!script_argv || script_argc == 0)
             return strdup("");
         const char *ifs = get_shell_var("IFS");
-        if (!ifs) ifs = getenv("IFS");
+        if (!ifs) ifs = get_env_var("IFS");
         char sep = (ifs && *ifs) ? ifs[0] : ' ';
         size_t len = 0;
         for (int i = 1; i <= script_argc; i++)
@@ -685,7 +610,7 @@ static char *expand_special(const char *token) {
 
 static char *expand_plain_var(const char *name) {
     const char *val = get_shell_var(name);
-    if (!val) val = getenv(name);
+    if (!val) val = get_env_var(name);
     if (!val) {
         if (opt_nounset) {
             fprintf(stderr, "%s: unbound variable\n", name);
@@ -8,88 +8,267 @@
  * Main parser entry points linking the helper modules.
  */
 #include "parser.h"
+#include "arith.h"
+#include "case_match.h"
+#include "util.h"
+#include "options.h"
+#include "stats.h"
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 FILE *parse_input = NULL;
+char *parse_script = NULL;
 int parse_need_more = 0;
 int parse_noexpand = 0;
+int parse_inspect = 0;
 
-/* Free a linked list of PipelineSegment structures */
-void free_pipeline(PipelineSegment *p) {
-    while (p) {
-        PipelineSegment *next = p->next;
-        for (int i = 0; p->argv[i]; i++)
-            free(p->argv[i]);
-        for (int i = 0; i < p->assign_count; i++)
-            free(p->assigns[i]);
-        free(p->assigns);
-        if (p->here_doc && p->in_file)
-            unlink(p->in_file);
-        free(p->in_file);
-        free(p->out_file);
-        /* err_file may share the same allocation as out_file */
-        if (p->err_file && p->err_file != p->out_file)
-            free(p->err_file);
-        free(p);
-        p = next;
+#define SEGMENT_INITIAL_WORDS 8
+
+/*
+ * State of the tree being built.  Every node, word array and word of a
+ * parse comes from one arena that the first command of the tree owns, so
+ * free_commands() drops the whole tree at once.  Words are interned while
+ * parsing: a script repeating `echo`, `"$i"` or `>/dev/null` stores each
+ * spelling once.  Clause bodies are parsed into the enclosing tree by
+ * parse_command_list(); parse_line() always starts a new one.
+ */
+typedef struct {
+    Arena *arena;
+    char **interned;    /* open addressed, nslots is a power of two */
+    size_t nslots;
+    size_t count;
+} ParseTree;
+
+static ParseTree *parse_tree;
+int parse_lineno;
+
+void *parse_alloc(size_t size) {
+    void *p = arena_alloc(parse_tree->arena, size);
+    memset(p, 0, size);
+    return p;
+}
+
+/* Double the intern table of T. */
+static void grow_interned(ParseTree *t) {
+    size_t n = t->nslots ? t->nslots * 2 : 64;
+    char **slots = xcalloc(n, sizeof(char *));
+    for (size_t i = 0; i < t->nslots; i++) {
+        char *w = t->interned[i];
+        if (!w)
+            continue;
+        size_t j = hash_string(w) & (n - 1);
+        while (slots[j])
+            j = (j + 1) & (n - 1);
+        slots[j] = w;
+    }
+    free(t->interned);
+    t->interned = slots;
+    t->nslots = n;
+}
+
+char *parse_intern(char *s) {
+    if (!s)
+        return NULL;
+    ParseTree *t = parse_tree;
+    if ((t->count + 1) * 2 > t->nslots)
+        grow_interned(t);
+    size_t mask = t->nslots - 1;
+    size_t i = hash_string(s) & mask;
+    for (; t->interned[i]; i = (i + 1) & mask) {
+        if (strcmp(t->interned[i], s) == 0) {
+            free(s);
+            return t->interned[i];
+        }
+    }
+    t->interned[i] = arena_strdup(t->arena, s);
+    t->count++;
+    free(s);
+    return t->interned[i];
+}
+
+char *parse_own(char *s) {
+    return arena_own(parse_tree->arena, s);
+}
+
+char **parse_word_array(StrArray *arr) {
+    char **words = parse_alloc((size_t)(arr->count + 1) * sizeof(char *));
+    for (int i = 0; i < arr->count; i++)
+        words[i] = parse_intern(arr->items[i]);
+    free(arr->items);
+    strarray_init(arr);
+    return words;
+}
+
+Command *parse_line(char *line) {
+    ParseTree tree = { NULL, NULL, 0, 0 };
+    shell_stats.parses++;
+    shell_stats.parse_bytes += strlen(line);
+    tree.arena = xmalloc(sizeof(Arena));
+    arena_init(tree.arena);
+    ParseTree *outer = parse_tree;
+    parse_tree = &tree;
+    /* current_lineno is the last line read, continuation lines included */
+    int outer_lineno = parse_lineno;
+    parse_lineno = current_lineno;
+    for (const char *nl = strchr(line, '\n'); nl; nl = strchr(nl + 1, '\n'))
+        parse_lineno--;
+    if (parse_lineno < 1)
+        parse_lineno = 1;
+    Command *head = parse_command_list(line);
+    parse_lineno = outer_lineno;
+    parse_tree = outer;
+    free(tree.interned);
+    if (!head) {
+        arena_release(tree.arena);
+        free(tree.arena);
+        return NULL;
+    }
+    head->arena = tree.arena;
+    return head;
+}
+
+/* Allocate an empty pipeline segment with default redirections.  Its word
+ * arrays grow on the heap until finish_segments() moves them into the
+ * tree. */
+PipelineSegment *new_pipeline_segment(void) {
+    PipelineSegment *seg = parse_alloc(sizeof(PipelineSegment));
+    seg->argv_cap = SEGMENT_INITIAL_WORDS;
+    seg->argv = xcalloc(seg->argv_cap, sizeof(char *));
+    seg->expand = xcalloc(seg->argv_cap, 1);
+    seg->quoted = xcalloc(seg->argv_cap, 1);
+    seg->dup_out = -1;
+    seg->dup_err = -1;
+    seg->out_fd = STDOUT_FILENO;
+    seg->in_fd = STDIN_FILENO;
+    return seg;
+}
+
+/* Append the malloc'd WORD to SEG at index *ARGC, growing the word arrays
+ * as needed and keeping argv NULL terminated.  WORD is interned into the
+ * tree.  Returns 0 on success or -1 when memory cannot be allocated, in
+ * which case WORD is left to the caller. */
+int segment_add_word(PipelineSegment *seg, int *argc, char *word, int expand,
+                     int quoted) {
+    if (*argc + 2 > seg->argv_cap) {
+        int newcap = seg->argv_cap * 2;
+        while (*argc + 2 > newcap)
+            newcap *= 2;
+        char **av = realloc(seg->argv, (size_t)newcap * sizeof(char *));
+        if (!av)
+            return -1;
+        seg->argv = av;
+        unsigned char *ex = realloc(seg->expand, (size_t)newcap);
+        if (!ex)
+            return -1;
+        seg->expand = ex;
+        unsigned char *qu = realloc(seg->quoted, (size_t)newcap);
+        if (!qu)
+            return -1;
+        seg->quoted = qu;
+        seg->argv_cap = newcap;
+    }
+    seg->argv[*argc] = parse_intern(word);
+    seg->expand[*argc] = expand;
+    seg->quoted[*argc] = quoted;
+    (*argc)++;
+    seg->argv[*argc] = NULL;
+    seg->expand[*argc] = 0;
+    seg->quoted[*argc] = 0;
+    return 0;
+}
+
+void finish_segments(PipelineSegment *seg) {
+    for (; seg; seg = seg->next) {
+        int n = 0;
+        while (seg->argv[n])
+            n++;
+        char **av = parse_alloc((size_t)(n + 1) * sizeof(char *));
+        memcpy(av, seg->argv, (size_t)n * sizeof(char *));
+        unsigned char *ex = parse_alloc((size_t)n + 1);
+        memcpy(ex, seg->expand, (size_t)n);
+        unsigned char *qu = parse_alloc((size_t)n + 1);
+        memcpy(qu, seg->quoted, (size_t)n);
+        free(seg->argv);
+        free(seg->expand);
+        free(seg->quoted);
+        seg->argv = av;
+        seg->expand = ex;
+        seg->quoted = qu;
+        seg->argv_cap = n + 1;
     }
 }
 
 void free_case_items(CaseItem *ci);
 
-/* Recursively free a chain of Command structures */
+/*
+ * Free a tree returned by parse_line().  Nodes and words go with the
+ * arena; only the compiled case tables and arithmetic programs attached
+ * to nodes are allocated separately.  Called on a list inside a tree
+ * being built it releases just those.
+ */
 void free_commands(Command *c) {
-    while (c) {
-        Command *next = c->next;
-        if (c->type == CMD_PIPELINE) {
-            free_pipeline(c->pipeline);
-        } else if (c->type == CMD_IF) {
+    if (!c)
+        return;
+    Arena *arena = c->arena;
+    for (; c; c = c->next) {
+        switch (c->type) {
+        case CMD_IF:
             free_commands(c->cond);
             free_commands(c->body);
             free_commands(c->else_part);
-        } else if (c->type == CMD_WHILE || c->type == CMD_UNTIL) {
+            break;
+        case CMD_WHILE:
+        case CMD_UNTIL:
             free_commands(c->cond);
             free_commands(c->body);
-        } else if (c->type == CMD_FOR) {
-            free(c->var);
-            for (int i = 0; i < c->word_count; i++)
-                free(c->words[i]);
-            free(c->words);
-            free(c->word_expand);
-            free(c->word_quoted);
-            free_commands(c->body);
-        } else if (c->type == CMD_SELECT) {
-            free(c->var);
-            for (int i = 0; i < c->word_count; i++)
-                free(c->words[i]);
-            free(c->words);
-            free(c->word_expand);
-            free(c->word_quoted);
+            break;
+        case CMD_FOR:
+        case CMD_SELECT:
+        case CMD_FUNCDEF:
             free_commands(c->body);
-        } else if (c->type == CMD_FOR_ARITH) {
-            free(c->arith_init);
-            free(c->arith_cond);
-            free(c->arith_update);
+            break;
+        case CMD_FOR_ARITH:
+            for (int i = 0; i < 3; i++)
+                free_arith(c->arith_prog[i]);
             free_commands(c->body);
-        } else if (c->type == CMD_CASE) {
-            free(c->var);
+            break;
+        case CMD_CASE:
             free_case_items(c->cases);
-        } else if (c->type == CMD_FUNCDEF) {
-            free(c->var);
-            free(c->text);
-            free_commands(c->body);
-        } else if (c->type == CMD_SUBSHELL || c->type == CMD_GROUP) {
+            free_case_match(c->case_match);
+            break;
+        case CMD_SUBSHELL:
+        case CMD_GROUP:
             free_commands(c->group);
-        } else if (c->type == CMD_COND) {
-            for (int i = 0; i < c->word_count; i++)
-                free(c->words[i]);
-            free(c->words);
-        } else if (c->type == CMD_ARITH) {
-            free(c->text);
+            break;
+        case CMD_ARITH:
+            free_arith(c->arith_prog[0]);
+            break;
+        default:
+            break;
         }
-        free(c);
-        c = next;
+    }
+    if (arena) {
+        arena_release(arena);
+        free(arena);
     }
 }
 
+int has_here_or_proc_subst(const Command *c) {
+    for (; c; c = c->next) {
+        for (PipelineSegment *s = c->pipeline; s; s = s->next) {
+            if (s->here_doc || s->proc_subst)
+                return 1;
+        }
+        if (has_here_or_proc_subst(c->cond) ||
+            has_here_or_proc_subst(c->body) ||
+            has_here_or_proc_subst(c->else_part) ||
+            has_here_or_proc_subst(c->group))
+            return 1;
+        for (CaseItem *ci = c->cases; ci; ci = ci->next) {
+            if (has_here_or_proc_subst(ci->body))
+                return 1;
+        }
+    }
+    return 0;
+}
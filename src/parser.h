@@ -11,16 +11,21 @@
 #include <stdio.h>
 #include <unistd.h>
 
-#define MAX_TOKENS 64
+#include "strarray.h"
+#include "arena.h"
+
 #define MAX_LINE 1024
 
 typedef struct PipelineSegment {
-    char *argv[MAX_TOKENS];
-    int expand[MAX_TOKENS];
-    int quoted[MAX_TOKENS];
+    char **argv;      /* NULL terminated word list */
+    unsigned char *expand; /* per-word expansion flags, NULL once expanded */
+    unsigned char *quoted; /* per-word quoting flags, NULL once expanded */
+    int argv_cap;     /* allocated slots in argv, expand and quoted */
     char *in_file;
-    int here_doc;     /* input file is temporary here-doc */
-    int here_doc_quoted; /* delimiter was quoted */
+    char *here_text;  /* here-document or here-string body */
+    int here_doc;     /* input comes from here_text */
+    int here_doc_quoted; /* delimiter was quoted: here_text is not expanded */
+    int proc_subst;   /* a word is a process substitution */
     char *out_file;
     int append;
     int force;       /* >| force overwrite */
@@ -34,6 +39,7 @@ typedef struct PipelineSegment {
     int in_fd;        /* fd number for < redirections */
     char **assigns;   /* NAME=value pairs preceding the command */
     int assign_count;
+    Arena arena;      /* execution copies: memory allocated by expansion */
     struct PipelineSegment *next;
 } PipelineSegment;
 
@@ -63,6 +69,8 @@ typedef enum {
 typedef struct CaseItem {
     char **patterns;
     int pattern_count;
+    unsigned char *pattern_quoted; /* quoting flags for patterns */
+    unsigned char *pattern_expand; /* expansion flags for patterns */
     struct Command *body;
     int fall_through;
     struct CaseItem *next;
@@ -77,22 +85,45 @@ typedef struct Command {
     char *var;                /* for for loop variable */
     char **words;             /* for loop word list or [[ expression ]] */
     int word_count;
-    int *word_expand;         /* expansion flags for words */
-    int *word_quoted;         /* quoting flags for words */
+    unsigned char *word_expand; /* expansion flags for words */
+    unsigned char *word_quoted; /* quoting flags for words */
     char *arith_init;         /* for arithmetic for loop */
     char *arith_cond;
     char *arith_update;
+    struct ArithExpr *arith_prog[3]; /* compiled init, cond and update or
+                                        (( )) text, built on first use */
     char *text;               /* function body as text */
     CaseItem *cases;          /* for case clause items */
+    struct CaseMatch *case_match; /* compiled case patterns */
     struct Command *group;    /* commands for subshell or group */
     int negate;               /* invert status with leading ! */
     int background;
     int time_pipeline;        /* time entire pipeline when set */
     CmdOp op; /* operator connecting to next command */
+    int lineno;               /* source line the command starts on */
+    Arena *arena;             /* set on the first command of a parsed tree:
+                                 holds every node and word of it */
     struct Command *next;
 } Command;
 
+/* Parse LINE into a new tree released with free_commands(). */
 Command *parse_line(char *line);
+/* Parse LINE, such as a clause body, into the tree being built. */
+Command *parse_command_list(char *line);
+/* Source line reached by the parser.  parse_line() starts it from
+ * current_lineno and parse_command_list() advances it past each newline
+ * it consumes, so nested clause bodies continue the count. */
+extern int parse_lineno;
+/* Allocate SIZE zeroed bytes in the tree being built. */
+void *parse_alloc(size_t size);
+/* Move the malloc'd word S into the tree, sharing storage with equal
+ * words.  S is freed; the result must not be modified. */
+char *parse_intern(char *s);
+/* Hand the malloc'd text S, such as a here-document body, to the tree. */
+char *parse_own(char *s);
+/* Intern the words collected in ARR into a NULL terminated tree array and
+ * release ARR. */
+char **parse_word_array(StrArray *arr);
 char *read_continuation_lines(FILE *f, char *buf, size_t size);
 char *gather_until(char **p, const char **stops, int nstops, int *idx);
 char *gather_until_done(char **p);
@@ -108,11 +139,27 @@ Command *parse_conditional(char **p, CmdOp *op_out);
 Command *parse_arith_command(char **p, CmdOp *op_out);
 Command *parse_control_clause(char **p, CmdOp *op_out);
 void free_case_items(CaseItem *ci);
-void free_pipeline(PipelineSegment *p);
+PipelineSegment *new_pipeline_segment(void);
+int segment_add_word(PipelineSegment *seg, int *argc, char *word, int expand,
+                     int quoted);
+/* Move the word arrays of the segments starting at SEG into the tree,
+ * sized to fit.  Called once when the pipeline has been read. */
+void finish_segments(PipelineSegment *seg);
 void free_commands(Command *c);
+/* Return non-zero when C contains a here-document, a here-string or a
+ * process substitution.  Parsing here-documents reads input and parsing
+ * process substitutions starts them, so such trees are not reused. */
+int has_here_or_proc_subst(const Command *c);
 void cleanup_proc_subs(void);
+int proc_subs_pending(void);
 extern FILE *parse_input;
+/* Unread remainder of an in-memory script.  Here-documents are read from
+ * it when parse_input is NULL. */
+extern char *parse_script;
 extern int parse_need_more;
 extern int parse_noexpand;
+/* Set while a tree is parsed only to be examined: here-document bodies are
+ * left unread and process substitutions are not started. */
+extern int parse_inspect;
 
 #endif /* PARSER_H */
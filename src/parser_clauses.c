@@ -17,6 +17,7 @@
 #include "cleanup.h"
 #include "util.h"
 #include "options.h"
+#include "case_match.h"
 
 /* helpers from parser_utils */
 extern char *gather_until(char **p, const char **stops, int nstops, int *idx);
@@ -34,29 +35,23 @@ static Command *parse_if_clause(char **p) {
     const char *stop1[] = {"then"};
     char *cond = gather_until(p, stop1, 1, NULL);
     if (!cond) return NULL;
-    Command *cond_cmd = parse_line(cond);
+    Command *cond_cmd = parse_command_list(cond);
     free(cond);
     int idx = -1;
     const char *stop2[] = {"else", "elif", "fi"};
     char *body = gather_until(p, stop2, 3, &idx);
     if (!body) { free_commands(cond_cmd); return NULL; }
-    Command *body_cmd = parse_line(body); free(body);
+    Command *body_cmd = parse_command_list(body); free(body);
     Command *else_cmd = NULL;
     if (idx == 0) {
         const char *stop3[] = {"fi"};
         char *els = gather_until(p, stop3, 1, NULL);
         if (!els) { free_commands(cond_cmd); free_commands(body_cmd); return NULL; }
-        else_cmd = parse_line(els); free(els);
+        else_cmd = parse_command_list(els); free(els);
     } else if (idx == 1) {
         else_cmd = parse_if_clause(p);
     }
-    Command *cmd = xcalloc(1, sizeof(Command));
-    if (!cmd) {
-        free_commands(cond_cmd);
-        free_commands(body_cmd);
-        free_commands(else_cmd);
-        return NULL;
-    }
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->type = CMD_IF;
     cmd->cond = cond_cmd;
     cmd->body = body_cmd;
@@ -69,7 +64,7 @@ static Command *parse_loop_body(char **p) {
     char *body = gather_until_done(p);
     if (!body)
         return NULL;
-    Command *body_cmd = parse_line(body);
+    Command *body_cmd = parse_command_list(body);
     free(body);
     return body_cmd;
 }
@@ -80,7 +75,7 @@ static Command *parse_loop_clause(char **p, int until) {
     char *cond = gather_until(p, stop1, 1, NULL);
     if (!cond)
         return NULL;
-    Command *cond_cmd = parse_line(cond);
+    Command *cond_cmd = parse_command_list(cond);
     free(cond);
 
     Command *body_cmd = parse_loop_body(p);
@@ -89,13 +84,7 @@ static Command *parse_loop_clause(char **p, int until) {
         return NULL;
     }
 
-    Command *cmd = xcalloc(1, sizeof(Command));
-    if (!cmd) {
-        free_commands(cond_cmd);
-        free_commands(body_cmd);
-        return NULL;
-    }
-
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->type = until ? CMD_UNTIL : CMD_WHILE;
     cmd->cond = cond_cmd;
     cmd->body = body_cmd;
@@ -112,14 +101,48 @@ static Command *parse_until_clause(char **p) {
     return parse_loop_clause(p, 1);
 }
 
+/* Append W with its quoting flag Q and expansion flag DE to the word
+ * list ARR, growing the flag arrays QF and EF of capacity *CAP to match. */
+static int push_list_word(StrArray *arr, unsigned char **qf,
+                          unsigned char **ef, int *cap, char *w, int q,
+                          int de) {
+    if (strarray_push(arr, w) == -1) {
+        free(w);
+        return -1;
+    }
+    if (arr->count > *cap) {
+        int nc = *cap ? *cap * 2 : 4;
+        unsigned char *tmpq = realloc(*qf, nc);
+        if (tmpq)
+            *qf = tmpq;
+        unsigned char *tmpe = realloc(*ef, nc);
+        if (tmpe)
+            *ef = tmpe;
+        if (!tmpq || !tmpe)
+            return -1;
+        *cap = nc;
+    }
+    (*qf)[arr->count - 1] = q;
+    (*ef)[arr->count - 1] = de;
+    return 0;
+}
+
+/* Copy the N flags at F into the tree being built. */
+static unsigned char *tree_flags(const unsigned char *f, int n) {
+    unsigned char *res = parse_alloc(n ? n : 1);
+    if (n)
+        memcpy(res, f, n);
+    return res;
+}
+
 /* Collect a list of words for for/select loops. */
-static int parse_word_list(char **p, char ***out, int **quoted_out,
-                          int **expand_out, int *count) {
+static int parse_word_list(char **p, char ***out, unsigned char **quoted_out,
+                          unsigned char **expand_out, int *count) {
     CLEANUP_STRARRAY StrArray arr;
     strarray_init(&arr);
     int cap = 0;
-    CLEANUP_FREE int *qflags = NULL;
-    CLEANUP_FREE int *eflags = NULL;
+    CLEANUP_FREE unsigned char *qflags = NULL;
+    CLEANUP_FREE unsigned char *eflags = NULL;
     while (1) {
         int q = 0; int de = 1;
         while (**p == ' ' || **p == '\t') (*p)++;
@@ -127,87 +150,41 @@ static int parse_word_list(char **p, char ***out, int **quoted_out,
             (*p)++;
             while (**p == ' ' || **p == '\t') (*p)++;
             char *next = read_token(p, &q, &de);
-            if (!next) {
-                strarray_release(&arr);
+            if (!next)
                 return -1;
-            }
             if (!q && strcmp(next, "do") == 0) { free(next); break; }
-            char *dup_tok = next;
-            if (strarray_push(&arr, dup_tok) == -1) {
-                free(dup_tok);
-                goto fail;
-            }
-            if (arr.count > cap) {
-                int nc = cap ? cap * 2 : 4;
-                int *tmpq = realloc(qflags, nc * sizeof(int));
-                int *tmpe = realloc(eflags, nc * sizeof(int));
-                if (!tmpq || !tmpe) { free(tmpq); free(tmpe); goto fail; }
-                qflags = tmpq; eflags = tmpe; cap = nc;
-            }
-            qflags[arr.count - 1] = q;
-            eflags[arr.count - 1] = de;
+            if (push_list_word(&arr, &qflags, &eflags, &cap, next, q, de) == -1)
+                return -1;
             continue;
         }
-        if (**p == '\0') {
-            goto fail;
-        }
+        if (**p == '\0')
+            return -1;
         q = 0; de = 1;
         char *w = read_token(p, &q, &de);
-        if (!w) {
-            goto fail;
-        }
+        if (!w)
+            return -1;
         if (!q && strcmp(w, "do") == 0) { free(w); break; }
         if (!q && strcmp(w, ";") == 0) {
             free(w);
             while (**p == ' ' || **p == '\t') (*p)++;
             q = 0; de = 1;
             char *next = read_token(p, &q, &de);
-            if (!next) {
-                strarray_release(&arr);
+            if (!next)
                 return -1;
-            }
             if (!q && strcmp(next, "do") == 0) { free(next); break; }
-            if (strarray_push(&arr, next) == -1) {
-                free(next);
-                goto fail;
-            }
-            if (arr.count > cap) {
-                int nc = cap ? cap * 2 : 4;
-                int *tmpq = realloc(qflags, nc * sizeof(int));
-                int *tmpe = realloc(eflags, nc * sizeof(int));
-                if (!tmpq || !tmpe) { free(tmpq); free(tmpe); goto fail; }
-                qflags = tmpq; eflags = tmpe; cap = nc;
-            }
-            qflags[arr.count - 1] = q;
-            eflags[arr.count - 1] = de;
+            if (push_list_word(&arr, &qflags, &eflags, &cap, next, q, de) == -1)
+                return -1;
             continue;
         }
-        if (strarray_push(&arr, w) == -1) {
-            free(w);
-            goto fail;
-        }
-        if (arr.count > cap) {
-            int nc = cap ? cap * 2 : 4;
-            int *tmpq = realloc(qflags, nc * sizeof(int));
-            int *tmpe = realloc(eflags, nc * sizeof(int));
-            if (!tmpq || !tmpe) { free(tmpq); free(tmpe); goto fail; }
-            qflags = tmpq; eflags = tmpe; cap = nc;
-        }
-        qflags[arr.count - 1] = q;
-        eflags[arr.count - 1] = de;
-    }
-    {
-        int cnt = arr.count;
-        char **vals = strarray_finish(&arr);
-        if (!vals) goto fail;
-        *out = vals;
-        if (quoted_out) { *quoted_out = qflags; qflags = NULL; }
-        if (expand_out) { *expand_out = eflags; eflags = NULL; }
-        if (count) *count = cnt;
-        return 0;
-    }
-fail:
-    return -1;
+        if (push_list_word(&arr, &qflags, &eflags, &cap, w, q, de) == -1)
+            return -1;
+    }
+    int cnt = arr.count;
+    if (quoted_out) *quoted_out = tree_flags(qflags, cnt);
+    if (expand_out) *expand_out = tree_flags(eflags, cnt);
+    *out = parse_word_array(&arr);
+    if (count) *count = cnt;
+    return 0;
 }
 
 /* Parse a traditional for loop clause. */
@@ -221,7 +198,8 @@ static Command *parse_for_clause(char **p) {
     char *tok = read_token(p, &q, &de);
     if (!tok || strcmp(tok, "in") != 0) { free(var); free(tok); return NULL; }
     free(tok);
-    char **words = NULL; int count = 0; int *qflags = NULL; int *eflags = NULL;
+    char **words = NULL; int count = 0;
+    unsigned char *qflags = NULL, *eflags = NULL;
     if (parse_word_list(p, &words, &qflags, &eflags, &count) == -1) {
         free(var);
         return NULL;
@@ -229,22 +207,11 @@ static Command *parse_for_clause(char **p) {
     Command *body_cmd = parse_loop_body(p);
     if (!body_cmd) {
         free(var);
-        for (int i=0;i<count;i++)
-            free(words[i]);
-        free(words);
-        return NULL;
-    }
-    Command *cmd = xcalloc(1, sizeof(Command));
-    if (!cmd) {
-        free(var);
-        for (int i=0; i<count; i++)
-            free(words[i]);
-        free(words);
-        free_commands(body_cmd);
         return NULL;
     }
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->type = CMD_FOR;
-    cmd->var = var;
+    cmd->var = parse_intern(var);
     cmd->words = words;
     cmd->word_count = count;
     cmd->word_quoted = qflags;
@@ -264,7 +231,8 @@ static Command *parse_select_clause(char **p) {
     char *tok = read_token(p, &q, &de);
     if (!tok || strcmp(tok, "in") != 0) { free(var); free(tok); return NULL; }
     free(tok);
-    char **words = NULL; int count = 0; int *qflags = NULL; int *eflags = NULL;
+    char **words = NULL; int count = 0;
+    unsigned char *qflags = NULL, *eflags = NULL;
     if (parse_word_list(p, &words, &qflags, &eflags, &count) == -1) {
         free(var);
         return NULL;
@@ -272,22 +240,11 @@ static Command *parse_select_clause(char **p) {
     Command *body_cmd = parse_loop_body(p);
     if (!body_cmd) {
         free(var);
-        for (int i=0;i<count;i++)
-            free(words[i]);
-        free(words);
-        return NULL;
-    }
-    Command *cmd = xcalloc(1, sizeof(Command));
-    if (!cmd) {
-        free(var);
-        for (int i=0;i<count;i++)
-            free(words[i]);
-        free(words);
-        free_commands(body_cmd);
         return NULL;
     }
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->type = CMD_SELECT;
-    cmd->var = var;
+    cmd->var = parse_intern(var);
     cmd->words = words;
     cmd->word_count = count;
     cmd->word_quoted = qflags;
@@ -366,39 +323,29 @@ static Command *parse_for_arith_clause(char **p) {
         free(incr);
         return NULL;
     }
-    Command *cmd = xcalloc(1, sizeof(Command));
-    if (!cmd) {
-        free(init);
-        free(cond);
-        free(incr);
-        free_commands(body_cmd);
-        return NULL;
-    }
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->type = CMD_FOR_ARITH;
-    cmd->arith_init = init;
-    cmd->arith_cond = cond;
-    cmd->arith_update = incr;
+    cmd->arith_init = parse_intern(init);
+    cmd->arith_cond = parse_intern(cond);
+    cmd->arith_update = parse_intern(incr);
     cmd->body = body_cmd;
     return cmd;
 }
 
-/* Free the linked list of case patterns and their command bodies. */
+/* Release what the command bodies of the case items CI hold outside the
+ * tree.  The items themselves belong to the tree's arena. */
 void free_case_items(CaseItem *ci) {
-    while (ci) {
-        CaseItem *n = ci->next;
-        for (int i = 0; i < ci->pattern_count; i++)
-            free(ci->patterns[i]);
-        free(ci->patterns);
+    for (; ci; ci = ci->next)
         free_commands(ci->body);
-        free(ci);
-        ci = n;
-    }
 }
 
 /* Parse a single case item (patterns and body). */
 static CaseItem *parse_case_item(char **p) {
     CLEANUP_STRARRAY StrArray patarr;
     strarray_init(&patarr);
+    int cap = 0;
+    CLEANUP_FREE unsigned char *qflags = NULL;
+    CLEANUP_FREE unsigned char *eflags = NULL;
     int done = 0;
     while (!done) {
         while (**p == ' ' || **p == '\t') (*p)++;
@@ -412,10 +359,8 @@ static CaseItem *parse_case_item(char **p) {
         if (!q && strcmp(ptok, ")") == 0) { free(ptok); break; }
         size_t len = strlen(ptok);
         if (!q && len > 0 && ptok[len-1] == ')') { ptok[len-1] = '\0'; done = 1; }
-        if (strarray_push(&patarr, ptok) == -1) {
-            free(ptok);
+        if (push_list_word(&patarr, &qflags, &eflags, &cap, ptok, q, de) == -1)
             return NULL;
-        }
         if (done) break;
     }
 
@@ -430,21 +375,13 @@ static CaseItem *parse_case_item(char **p) {
         free(body);
         return NULL;
     }
-    Command *body_cmd = parse_line(body);
+    Command *body_cmd = parse_command_list(body);
     free(body);
-    CaseItem *ci = xcalloc(1, sizeof(CaseItem));
-    if (!ci) {
-        free_commands(body_cmd);
-        return NULL;
-    }
-    int pat_count = patarr.count;
-    ci->patterns = strarray_finish(&patarr);
-    if (!ci->patterns) {
-        free_commands(body_cmd);
-        free(ci);
-        return NULL;
-    }
-    ci->pattern_count = pat_count;
+    CaseItem *ci = parse_alloc(sizeof(CaseItem));
+    ci->pattern_count = patarr.count;
+    ci->pattern_quoted = tree_flags(qflags, patarr.count);
+    ci->pattern_expand = tree_flags(eflags, patarr.count);
+    ci->patterns = parse_word_array(&patarr);
     ci->body = body_cmd;
     ci->fall_through = (idx == 1);
     return ci;
@@ -456,6 +393,7 @@ static Command *parse_case_clause(char **p) {
     int q = 0; int de = 1;
     char *word = read_token(p, &q, &de);
     if (!word) return NULL;
+    int word_expand = de;
     while (**p == ' ' || **p == '\t') (*p)++;
     q = 0; de = 1;
     char *tok = read_token(p, &q, &de);
@@ -472,15 +410,11 @@ static Command *parse_case_clause(char **p) {
         if (!head) head = ci; else tail->next = ci; tail = ci;
     }
 
-    Command *cmd = xcalloc(1, sizeof(Command));
-    if (!cmd) {
-        free(word);
-        free_case_items(head);
-        return NULL;
-    }
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->type = CMD_CASE;
-    cmd->var = word;
+    cmd->var = parse_intern(word);
     cmd->cases = head;
+    cmd->case_match = compile_case(head, word_expand);
     return cmd;
 }
 
@@ -524,18 +458,12 @@ Command *parse_function_def(char **p, CmdOp *op_out) {
     if (**p == '{') {
         char *bodytxt = gather_braced(p);
         if (!bodytxt) goto fail;
-        Command *body_cmd = NULL;
-        Command *cmd = xcalloc(1, sizeof(Command));
-        if (!cmd) {
-            free(tok);
-            free(bodytxt);
-            free_commands(body_cmd);
-            return NULL;
-        }
+        /* the body is parsed when the definition runs, into a tree of
+         * its own that the function table keeps */
+        Command *cmd = parse_alloc(sizeof(Command));
         cmd->type = CMD_FUNCDEF;
-        cmd->var = fname;
-        cmd->text = bodytxt;
-        cmd->body = body_cmd;
+        cmd->var = parse_intern(fname);
+        cmd->text = parse_own(bodytxt);
         while (**p == ' ' || **p == '\t') (*p)++;
         CmdOp op = OP_NONE;
         if (**p == ';') { op = OP_SEMI; (*p)++; }
@@ -557,13 +485,9 @@ Command *parse_subshell(char **p, CmdOp *op_out) {
     char *bodytxt = gather_parens(p);
     if (!bodytxt)
         return NULL;
-    Command *body_cmd = parse_line(bodytxt);
+    Command *body_cmd = parse_command_list(bodytxt);
     free(bodytxt);
-    Command *cmd = xcalloc(1, sizeof(Command));
-    if (!cmd) {
-        free_commands(body_cmd);
-        return NULL;
-    }
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->type = CMD_SUBSHELL;
     cmd->group = body_cmd;
     while (**p == ' ' || **p == '\t') (*p)++;
@@ -581,13 +505,9 @@ Command *parse_brace_group(char **p, CmdOp *op_out) {
     char *bodytxt = gather_braced(p);
     if (!bodytxt)
         return NULL;
-    Command *body_cmd = parse_line(bodytxt);
+    Command *body_cmd = parse_command_list(bodytxt);
     free(bodytxt);
-    Command *cmd = xcalloc(1, sizeof(Command));
-    if (!cmd) {
-        free_commands(body_cmd);
-        return NULL;
-    }
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->type = CMD_GROUP;
     cmd->group = body_cmd;
     while (**p == ' ' || **p == '\t') (*p)++;
@@ -629,34 +549,15 @@ Command *parse_conditional(char **p, CmdOp *op_out) {
             return NULL;
         }
     }
-    if (!arr.items && arr.count==0) {
-        /* ensure an empty argument list is well-formed */
-        arr.items = xcalloc(1, sizeof(char*));
-        if (!arr.items)
-            return NULL;
-        arr.capacity = 1;
-    } else {
-        char **tmp = realloc(arr.items, sizeof(char*) * (arr.count + 1));
-        if (!tmp) {
-            strarray_release(&arr);
-            return NULL;
-        }
-        arr.items = tmp;
-    }
-    arr.items[arr.count] = NULL;
     while (**p == ' ' || **p == '\t') (*p)++;
     CmdOp op = OP_NONE;
     if (**p == ';') { op = OP_SEMI; (*p)++; }
     else if (**p == '&' && *(*p + 1) == '&') { op = OP_AND; (*p) += 2; }
     else if (**p == '|' && *(*p + 1) == '|') { op = OP_OR; (*p) += 2; }
-    Command *cmd = xcalloc(1, sizeof(Command));
-    if (!cmd) {
-        strarray_free(arr.items);
-        return NULL;
-    }
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->type = CMD_COND;
-    cmd->words = arr.items;
     cmd->word_count = arr.count;
+    cmd->words = parse_word_array(&arr);
     cmd->op = op;
     if (op_out) *op_out = op;
     return cmd;
@@ -676,13 +577,9 @@ Command *parse_arith_command(char **p, CmdOp *op_out) {
     else if (**p == '&' && *(*p + 1) == '&') { op = OP_AND; (*p) += 2; }
     else if (**p == '|' && *(*p + 1) == '|') { op = OP_OR; (*p) += 2; }
 
-    Command *cmd = xcalloc(1, sizeof(Command));
-    if (!cmd) {
-        free(trim);
-        return NULL;
-    }
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->type = CMD_ARITH;
-    cmd->text = trim;
+    cmd->text = parse_intern(trim);
     cmd->op = op;
     if (op_out) *op_out = op;
     return cmd;
@@ -7,14 +7,69 @@
 #define _GNU_SOURCE
 #include "parser_here_doc.h"
 #include "lexer.h"
-#include "var_expand.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 
-/* Parse here-document delimiter and store contents in a temporary file. */
+/* Return the next character of here-document input from IN or, when IN is
+ * NULL, from the in-memory script. */
+static int here_doc_getc(FILE *in) {
+    if (!in)
+        return *parse_script ? (unsigned char)*parse_script++ : EOF;
+    return fgetc(in);
+}
+
+/* Growing text buffer for here-document bodies. */
+struct here_buf {
+    char *text;
+    size_t len;
+    size_t cap;
+};
+
+/* Append N bytes of S to B keeping it NUL terminated.  Returns 0 or -1. */
+static int here_append(struct here_buf *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 128;
+        while (b->len + n + 1 > cap)
+            cap *= 2;
+        char *t = realloc(b->text, cap);
+        if (!t) {
+            perror("realloc");
+            return -1;
+        }
+        b->text = t;
+        b->cap = cap;
+    }
+    memcpy(b->text + b->len, s, n);
+    b->len += n;
+    b->text[b->len] = '\0';
+    return 0;
+}
+
+/*
+ * Finish the here-document input line collected in LINE.  Returns 1 when
+ * it is the delimiter, 0 after appending it to BODY or -1 on error.  The
+ * text is stored as written; expansion happens when the command runs.
+ */
+static int here_doc_line(struct here_buf *body, struct here_buf *line,
+                         const char *delim, int strip_tabs) {
+    const char *l = line->text ? line->text : "";
+    if (strip_tabs) {
+        while (*l == '\t') l++;
+    }
+    if (strcmp(l, delim) == 0)
+        return 1;
+    if (here_append(body, l, strlen(l)) < 0 || here_append(body, "\n", 1) < 0)
+        return -1;
+    line->len = 0;
+    if (line->text)
+        line->text[0] = '\0';
+    return 0;
+}
+
+/* Parse here-document delimiter and collect its body in memory. */
 int process_here_doc(PipelineSegment *seg, char **p, char *tok, int quoted) {
     if (quoted || strncmp(tok, "<<", 2) != 0)
         return 0;
@@ -63,25 +118,33 @@ int process_here_doc(PipelineSegment *seg, char **p, char *tok, int quoted) {
             delim[dlen - 2] = '\0';
         }
     }
-    char template[] = "/tmp/vushXXXXXX";
-    int fd = mkstemp(template);
-    if (fd < 0) { perror("mkstemp"); free(delim); free(tok); return -1; }
-    FILE *tf = fdopen(fd, "w");
-    if (!tf) { perror("fdopen"); close(fd); unlink(template); free(delim); free(tok); return -1; }
-    FILE *in = parse_input ? parse_input : stdin;
-    char buf[MAX_LINE];
-    size_t pos = 0;
+    if (parse_inspect) {
+        /* the tree is only examined, so leave the body for a real parse */
+        seg->in_file = NULL;
+        seg->here_doc = 1;
+        seg->here_doc_quoted = delim_quoted;
+        free(delim);
+        free(tok);
+        return 1;
+    }
+    FILE *in = parse_input ? parse_input : (parse_script ? NULL : stdin);
+    struct here_buf body = { NULL, 0, 0 };
+    struct here_buf line = { NULL, 0, 0 };
     int found = 0;
     int c;
     int got_eof = 0;
-    while ((c = fgetc(in)) != EOF) {
-        if (c == 4 && isatty(fileno(in))) {
+    int r = 0;
+    while ((c = here_doc_getc(in)) != EOF) {
+        if (c == 4 && in && isatty(fileno(in))) {
             got_eof = 1;
             c = EOF;
             break;
         }
         if (c == '\r') {
-            if (!isatty(fileno(in))) {
+            if (!in) {
+                if (*parse_script == '\n')
+                    parse_script++;
+            } else if (!isatty(fileno(in))) {
                 int n = fgetc(in);
                 if (n != '\n' && n != EOF)
                     ungetc(n, in);
@@ -89,70 +152,33 @@ int process_here_doc(PipelineSegment *seg, char **p, char *tok, int quoted) {
             c = '\n';
         }
         if (c == '\n') {
-            buf[pos] = '\0';
-            char *line = buf;
-            if (strip_tabs) {
-                while (*line == '\t') line++;
-            }
-            if (strcmp(line, delim) == 0) { found = 1; break; }
-            char *out_line = line;
-            if (!delim_quoted) {
-                out_line = expand_var(line);
-                if (!out_line) {
-                    fclose(tf);
-                    unlink(template);
-                    free(delim);
-                    free(tok);
-                    return -1;
-                }
-            }
-            fprintf(tf, "%s\n", out_line);
-            if (!delim_quoted)
-                free(out_line);
-            pos = 0;
-        } else if (pos < sizeof(buf) - 1) {
-            buf[pos++] = c;
-        }
-    }
-    if (c == EOF && pos > 0 && !found) {
-        buf[pos] = '\0';
-        char *line = buf;
-        if (strip_tabs) {
-            while (*line == '\t') line++;
-        }
-        if (strcmp(line, delim) == 0) {
-            found = 1;
+            r = here_doc_line(&body, &line, delim, strip_tabs);
+            if (r != 0)
+                break;
         } else {
-            char *out_line = line;
-            if (!delim_quoted) {
-                out_line = expand_var(line);
-                if (!out_line) {
-                    fclose(tf);
-                    unlink(template);
-                    free(delim);
-                    free(tok);
-                    return -1;
-                }
-            }
-            if (fprintf(tf, "%s\n", out_line) < 0) {
-                if (!delim_quoted)
-                    free(out_line);
-                fclose(tf);
-                unlink(template);
-                free(delim);
-                free(tok);
-                return -1;
+            char ch = (char)c;
+            if (here_append(&line, &ch, 1) < 0) {
+                r = -1;
+                break;
             }
-            if (!delim_quoted)
-                free(out_line);
         }
     }
+    if (c == EOF && line.len > 0 && r == 0)
+        r = here_doc_line(&body, &line, delim, strip_tabs);
+    free(line.text);
+    if (r == 1)
+        found = 1;
+    if (r < 0) {
+        free(body.text);
+        free(delim);
+        free(tok);
+        return -1;
+    }
     if (!found) {
-        int eof = feof(in) || got_eof;
+        int eof = !in || feof(in) || got_eof;
         if (in == stdin && feof(in))
             clearerr(stdin);
-        fclose(tf);
-        unlink(template);
+        free(body.text);
         free(delim);
         free(tok);
         if (eof) {
@@ -163,14 +189,13 @@ int process_here_doc(PipelineSegment *seg, char **p, char *tok, int quoted) {
             parse_need_more = 1;
         return -1;
     }
-    fclose(tf);
-    seg->in_file = strdup(template);
-    if (!seg->in_file) {
-        unlink(template);
+    if (!body.text && here_append(&body, "", 0) < 0) {
         free(delim);
         free(tok);
         return -1;
     }
+    seg->in_file = NULL;
+    seg->here_text = parse_own(body.text);
     seg->here_doc = 1;
     seg->here_doc_quoted = delim_quoted;
     free(delim);
@@ -190,31 +215,24 @@ int parse_here_string(PipelineSegment *seg, char **p, char *tok) {
         (*p)++;
     while (**p == ' ' || **p == '\t') (*p)++;
     char *word = NULL;
+    int de = 1;
     if (strncmp(tok, "<<<", 3) == 0 && tok[3]) {
         word = strdup(tok + 3);
         if (!word) { free(tok); return -1; }
     } else if (**p) {
-        int q = 0; int de = 1;
+        int q = 0;
         word = read_token(p, &q, &de);
         if (!word) { free(tok); return -1; }
     } else {
         word = strdup("");
         if (!word) { free(tok); return -1; }
     }
-    char template[] = "/tmp/vushXXXXXX";
-    int fd = mkstemp(template);
-    if (fd < 0) { perror("mkstemp"); free(word); free(tok); return -1; }
-    FILE *tf = fdopen(fd, "w");
-    if (!tf) { perror("fdopen"); close(fd); unlink(template); free(word); free(tok); return -1; }
-    fprintf(tf, "%s\n", word);
-    fclose(tf);
-    seg->in_file = strdup(template);
-    if (!seg->in_file) {
-        unlink(template);
-        free(word);
-        free(tok);
-        return -1;
-    }
+    size_t wlen = strlen(word);
+    seg->in_file = NULL;
+    seg->here_text = parse_alloc(wlen + 2);
+    memcpy(seg->here_text, word, wlen);
+    memcpy(seg->here_text + wlen, "\n", 2);
+    seg->here_doc_quoted = !de;
     seg->here_doc = 1;
     free(word);
     free(tok);
@@ -21,7 +21,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#include <glob.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -29,6 +28,7 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include "shell_state.h"
+#include "vars.h"
 
 extern char *process_substitution(char **p, int read_from);
 extern char *gather_dbl_parens(char **p); /* for arithmetic for loops */
@@ -101,8 +101,11 @@ static int parse_input_redirect(PipelineSegment *seg, char **p, char *tok) {
     while (**p == ' ' || **p == '\t') (*p)++;
     if (**p) {
         int q = 0; int de = 1;
-        seg->in_file = read_token(p, &q, &de);
-        if (!seg->in_file) { free(tok); return -1; }
+        seg->here_text = NULL;
+        seg->here_doc = 0;
+        char *file = read_token(p, &q, &de);
+        if (!file) { free(tok); return -1; }
+        seg->in_file = parse_intern(file);
     }
     free(tok);
     return 1;
@@ -135,14 +138,15 @@ static int parse_output_redirect(PipelineSegment *seg, char **p, char *tok) {
             int q = 0; int de = 1;
             char *file = read_token(p, &q, &de);
             if (!file) { free(tok); return -1; }
-            seg->out_file = file;
-            seg->err_file = file;
+            seg->out_file = parse_intern(file);
+            seg->err_file = seg->out_file;
             seg->err_append = seg->append;
         }
     } else if (**p) {
         int q = 0; int de = 1;
-        seg->out_file = read_token(p, &q, &de);
-        if (!seg->out_file) { free(tok); return -1; }
+        char *file = read_token(p, &q, &de);
+        if (!file) { free(tok); return -1; }
+        seg->out_file = parse_intern(file);
     }
     free(tok);
     return 1;
@@ -166,12 +170,13 @@ static int parse_error_redirect(PipelineSegment *seg, char **p, char *tok) {
             int q = 0; int de = 1;
             char *file = read_token(p, &q, &de);
             if (!file) { free(tok); return -1; }
-            seg->err_file = file;
+            seg->err_file = parse_intern(file);
         }
     } else if (**p) {
         int q = 0; int de = 1;
-        seg->err_file = read_token(p, &q, &de);
-        if (!seg->err_file) { free(tok); return -1; }
+        char *file = read_token(p, &q, &de);
+        if (!file) { free(tok); return -1; }
+        seg->err_file = parse_intern(file);
     }
     free(tok);
     return 1;
@@ -189,8 +194,8 @@ static int parse_combined_redirect(PipelineSegment *seg, char **p, char *tok) {
         int q = 0; int de = 1;
         char *file = read_token(p, &q, &de);
         if (!file) { free(tok); return -1; }
-        seg->out_file = file;
-        seg->err_file = file;
+        seg->out_file = parse_intern(file);
+        seg->err_file = seg->out_file;
     }
     /* Ensure err_file always mirrors out_file for combined redirection */
     if (!seg->err_file)
@@ -217,14 +222,17 @@ static int parse_redirection(PipelineSegment *seg, char **p, char *tok, int quot
     return 0;
 }
 
-/* Append VAL to assignment array ARR expanding as needed. */
-static int push_assign(char ***arr, int *count, char *val) {
-    StrArray tmp = { *arr, *count, *count };
-    if (strarray_push(&tmp, val) == -1)
-        return -1;
-    *arr = tmp.items;
-    *count = tmp.count;
-    return 0;
+/* Append the interned VAL to the assignment array of SEG.  The array
+ * doubles whenever its length reaches a power of two. */
+static void push_assign(PipelineSegment *seg, char *val) {
+    int n = seg->assign_count;
+    if ((n & (n - 1)) == 0) {
+        char **arr = parse_alloc((size_t)(n ? n * 2 : 1) * sizeof(char *));
+        if (n)
+            memcpy(arr, seg->assigns, (size_t)n * sizeof(char *));
+        seg->assigns = arr;
+    }
+    seg->assigns[seg->assign_count++] = val;
 }
 
 /* Process assignments or expand aliases for the next token. */
@@ -247,7 +255,8 @@ static int handle_assignment_or_alias(PipelineSegment *seg, int *argc, char **p,
             int parens = 1;
             char *tmp;
             do {
-                while (**p == ' ' || **p == '\t') (*p)++;
+                /* the elements may continue on the following lines */
+                while (**p == ' ' || **p == '\t' || **p == '\n') (*p)++;
                 int q2 = 0; int de2 = 1;
                 tmp = read_token(p, &q2, &de2);
                 if (!tmp) { free(assign); free(tok); return -1; }
@@ -272,12 +281,10 @@ static int handle_assignment_or_alias(PipelineSegment *seg, int *argc, char **p,
             } while (parens > 0);
             free(tok);
             tok = assign;
-            eq = strchr(tok, '=');
-        }
-        if (push_assign(&seg->assigns, &seg->assign_count, tok) == -1) {
-            free(tok);
-            return -1;
         }
+        tok = parse_intern(tok);
+        push_assign(seg, tok);
+        eq = strchr(tok, '=');
         if (eq) {
             char *name = strndup(tok, eq - tok);
             if (name) { set_temp_var(name, eq + 1); free(name); }
@@ -301,28 +308,16 @@ static int handle_assignment_or_alias(PipelineSegment *seg, int *argc, char **p,
 static void finalize_segment(PipelineSegment *seg, int argc, int *background) {
     if (argc > 0 && strcmp(seg->argv[argc - 1], "&") == 0) {
         *background = 1;
-        free(seg->argv[argc - 1]);
         seg->argv[argc - 1] = NULL;
-    } else {
-        seg->argv[argc] = NULL;
-        seg->expand[argc] = 0;
-        seg->quoted[argc] = 0;
+        seg->expand[argc - 1] = 0;
+        seg->quoted[argc - 1] = 0;
     }
 }
 
 /* Begin a new pipeline segment after a pipe symbol. */
 static int start_new_segment(char **p, PipelineSegment **seg_ptr, int *argc) {
     PipelineSegment *seg = *seg_ptr;
-    seg->argv[*argc] = NULL;
-    seg->expand[*argc] = 0;
-    seg->quoted[*argc] = 0;
-    PipelineSegment *next = xcalloc(1, sizeof(PipelineSegment));
-    next->dup_out = -1;
-    next->dup_err = -1;
-    next->out_fd = STDOUT_FILENO;
-    next->in_fd = STDIN_FILENO;
-    next->assigns = NULL;
-    next->assign_count = 0;
+    PipelineSegment *next = new_pipeline_segment();
     seg->next = next;
     *seg_ptr = next;
     *argc = 0;
@@ -337,7 +332,7 @@ static int parse_pipeline_segment(char **p, PipelineSegment **seg_ptr, int *argc
                                   CmdOp *op_out) {
     PipelineSegment *seg = *seg_ptr;
     CmdOp op = OP_NONE;
-    while (**p && *argc < MAX_TOKENS - 1) {
+    while (**p) {
         while (**p == ' ' || **p == '\t') (*p)++;
         if (**p == '\0' || **p == '#') { op = OP_NONE; break; }
         if (**p == ';') { op = OP_SEMI; (*p)++; break; }
@@ -350,22 +345,24 @@ static int parse_pipeline_segment(char **p, PipelineSegment **seg_ptr, int *argc
         }
         if (**p == '<' && *(*p + 1) == '(') {
             (*p)++;
+            seg->proc_subst = 1;
             char *path = process_substitution(p, 0);
             if (!path) return -1;
-            seg->argv[*argc] = path;
-            seg->expand[*argc] = 0;
-            seg->quoted[*argc] = 0;
-            (*argc)++;
+            if (segment_add_word(seg, argc, path, 0, 0) == -1) {
+                free(path);
+                return -1;
+            }
             continue;
         }
         if (**p == '>' && *(*p + 1) == '(') {
             (*p)++;
+            seg->proc_subst = 1;
             char *path = process_substitution(p, 1);
             if (!path) return -1;
-            seg->argv[*argc] = path;
-            seg->expand[*argc] = 0;
-            seg->quoted[*argc] = 0;
-            (*argc)++;
+            if (segment_add_word(seg, argc, path, 0, 0) == -1) {
+                free(path);
+                return -1;
+            }
             continue;
         }
         int quoted = 0; int de_tok = 1;
@@ -394,7 +391,7 @@ static int parse_pipeline_segment(char **p, PipelineSegment **seg_ptr, int *argc
                 tok = nt;
             }
         }
-        if (getenv("VUSH_DEBUG"))
+        if (get_env_var("VUSH_DEBUG"))
             fprintf(stderr, "parse_pipeline token: '%s'\n", tok ? tok : "(null)");
         if (!tok) return -1;
         int h = handle_assignment_or_alias(seg, argc, p, &tok, quoted);
@@ -411,46 +408,15 @@ static int parse_pipeline_segment(char **p, PipelineSegment **seg_ptr, int *argc
         if (!btoks)
             return -1;
         int bi = 0;
-        for (; bi < bcount && *argc < MAX_TOKENS - 1; bi++) {
-            char *bt = btoks[bi];
-            if (!quoted && !opt_noglob && (strchr(bt, '*') || strchr(bt, '?')) ) {
-                glob_t g;
-                int r = glob(bt, 0, NULL, &g);
-                if (r == 0 && g.gl_pathc > 0) {
-                    size_t start = (size_t)*argc;
-                    for (size_t gi = 0; gi < g.gl_pathc && *argc < MAX_TOKENS - 1; gi++) {
-                        char *dup = strdup(g.gl_pathv[gi]);
-                        if (!dup) {
-                            while ((size_t)*argc > start) {
-                                free(seg->argv[--(*argc)]);
-                                seg->argv[*argc] = NULL;
-                            }
-                            free(bt);
-                            globfree(&g);
-                            for (int bj = bi + 1; bj < bcount; bj++)
-                                free(btoks[bj]);
-                            free(btoks);
-                            return -1;
-                        }
-                        seg->argv[*argc] = dup;
-                        seg->expand[*argc] = de_tok;
-                        seg->quoted[*argc] = 0;
-                        (*argc)++;
-                    }
-                    free(bt);
-                    globfree(&g);
-                    continue;
-                }
-                globfree(&g);
-            }
-            seg->argv[*argc] = bt;
-            seg->expand[*argc] = de_tok;
-            seg->quoted[*argc] = quoted;
-            (*argc)++;
+        for (; bi < bcount; bi++) {
+            if (segment_add_word(seg, argc, btoks[bi], de_tok, quoted) == -1)
+                break;
         }
         for (int bj = bi; bj < bcount; bj++)
             free(btoks[bj]);
         free(btoks);
+        if (bi < bcount)
+            return -1;
     }
     if (op_out) *op_out = op;
     *seg_ptr = seg;
@@ -494,23 +460,18 @@ static Command *parse_pipeline(char **p, CmdOp *op_out) {
         if (cmd) cmd->time_pipeline = timed;
         return cmd;
     }
-    PipelineSegment *seg_head = xcalloc(1, sizeof(PipelineSegment));
-    seg_head->dup_out = -1;
-    seg_head->dup_err = -1;
-    seg_head->out_fd = STDOUT_FILENO;
-    seg_head->in_fd = STDIN_FILENO;
-    seg_head->assigns = NULL;
-    seg_head->assign_count = 0;
+    PipelineSegment *seg_head = new_pipeline_segment();
     PipelineSegment *seg = seg_head;
     int argc = 0;
     int background = 0;
     CmdOp op = OP_NONE;
-    if (parse_pipeline_segment(p, &seg, &argc, &op) == -1) {
-        free_pipeline(seg_head);
+    int r = parse_pipeline_segment(p, &seg, &argc, &op);
+    if (r == 0)
+        finalize_segment(seg, argc, &background);
+    finish_segments(seg_head);
+    if (r == -1)
         return NULL;
-    }
-    finalize_segment(seg, argc, &background);
-    Command *cmd = xcalloc(1, sizeof(Command));
+    Command *cmd = parse_alloc(sizeof(Command));
     cmd->pipeline = seg_head;
     cmd->background = background;
     cmd->negate = negate;
@@ -527,8 +488,16 @@ char *read_continuation_lines(FILE *f, char *buf, size_t size) {
 }
 
 /* Parse LINE into a linked list of Command structures. */
-Command *parse_line(char *line) {
+/* Advance parse_lineno over the newlines in [FROM, TO). */
+static void count_lines(const char *from, const char *to) {
+    for (; from < to; from++)
+        if (*from == '\n')
+            parse_lineno++;
+}
+
+Command *parse_command_list(char *line) {
     char *p = line;
+    char *counted = line;
     Command *head = NULL, *cur_cmd = NULL;
     parse_need_more = 0;
     clear_temp_vars();
@@ -536,6 +505,12 @@ Command *parse_line(char *line) {
         while (*p == ' ' || *p == '\t') p++;
         if (*p == '\0' || *p == '#')
             break;
+        /* clause bodies parsed below move parse_lineno on their own, so
+         * recount from the start of this command afterwards */
+        char *start = p + strspn(p, " \t\n");
+        count_lines(counted, start);
+        counted = start;
+        int lineno = parse_lineno;
         CmdOp op = OP_NONE;
         Command *cmd = parse_function_def(&p, &op);
         if (!cmd)
@@ -553,6 +528,10 @@ Command *parse_line(char *line) {
                 last_status = 1;
             return NULL;
         }
+        cmd->lineno = lineno;
+        parse_lineno = lineno;
+        count_lines(counted, p);
+        counted = p;
         if (!head) head = cmd;
         if (cur_cmd) cur_cmd->next = cmd;
         cur_cmd = cmd;
@@ -561,6 +540,7 @@ Command *parse_line(char *line) {
         if (!*p) break;
         if (op == OP_NONE) break;
     }
+    count_lines(counted, counted + strlen(counted));
     return head;
 }
 
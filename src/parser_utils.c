@@ -23,6 +23,7 @@
 #include <sys/stat.h>
 #include <signal.h>
 #include "util.h"
+#include "vars.h"
 
 
 /* Temporary variable tracking for process substitutions */
@@ -86,6 +87,11 @@ void cleanup_proc_subs(void) {
     proc_subs = NULL;
 }
 
+/* Return non-zero while process substitutions await cleanup. */
+int proc_subs_pending(void) {
+    return proc_subs != NULL;
+}
+
 /* Collect tokens until one of STOPS is encountered. */
 char *gather_until(char **p, const char **stops, int nstops, int *idx) {
     char *res = NULL;
@@ -299,7 +305,9 @@ char *process_substitution(char **p, int read_from) {
     char *body = gather_parens(p);
     if (!body)
         return NULL;
-    const char *tmpdir = getenv("TMPDIR");
+    if (parse_inspect)
+        return body; /* stands in for the FIFO path */
+    const char *tmpdir = get_env_var("TMPDIR");
     if (!tmpdir || !*tmpdir)
         tmpdir = "/tmp";
     size_t len = strlen(tmpdir) + sizeof("/vushpsXXXXXX");
@@ -334,7 +342,7 @@ char *process_substitution(char **p, int read_from) {
         free(body);
         return NULL;
     }
-    pid_t pid = fork();
+    pid_t pid = shell_fork();
     int added = 0;
     if (pid == 0) {
         signal(SIGINT, SIG_DFL);
@@ -0,0 +1,447 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Shell pattern matching on string slices.
+ */
+
+/*
+ * Parameter modifiers such as ${v#pat} used to copy every prefix of the
+ * value into a new string and hand it to fnmatch(), which is quadratic in
+ * both time and allocations.  The matcher here works directly on a pointer
+ * and length.  pattern_compile() records the literal text a match must
+ * start and end with so most candidate positions are rejected with one
+ * memcmp() before the matcher runs at all.
+ *
+ * Trying every prefix, suffix or start position is still quadratic when a
+ * `*` lets the candidates run to the end of the value, so the searches
+ * split the pattern at its stars instead.  A value matches
+ * FIRST*MIDDLE1*...*LAST when FIRST matches at its start, LAST at its end
+ * and the middle segments can be placed in order in between; placing each
+ * one as early (or, working from the end, as late) as possible decides
+ * that in one pass.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "pattern.h"
+
+/* Characters that are never plain text in a pattern. */
+#define PATTERN_SPECIAL "*?[]\\"
+
+/* Test C against the character class named by the N bytes at NAME. */
+static int match_class(const char *name, size_t n, unsigned char c) {
+    static const struct {
+        const char *name;
+        int (*fn)(int);
+    } classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+        {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+        {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+        {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) == n && memcmp(classes[i].name, name, n) == 0)
+            return classes[i].fn(c) != 0;
+    }
+    return 0;
+}
+
+/* Match C against the bracket expression starting at P, which points at
+ * '['.  Returns the position after the closing ']' and stores the result
+ * in *MATCHED, or NULL when the expression is not terminated and the '['
+ * must be taken literally. */
+static const char *match_bracket(const char *p, unsigned char c, int *matched) {
+    p++;
+    int negate = 0;
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+    int found = 0;
+    int first = 1;
+    while (*p && (*p != ']' || first)) {
+        first = 0;
+        if (p[0] == '[' && p[1] == ':') {
+            const char *end = strstr(p + 2, ":]");
+            if (end) {
+                if (match_class(p + 2, end - (p + 2), c))
+                    found = 1;
+                p = end + 2;
+                continue;
+            }
+        }
+        unsigned char lo = (unsigned char)*p;
+        if (lo == '\\' && p[1]) {
+            p++;
+            lo = (unsigned char)*p;
+        }
+        p++;
+        unsigned char hi = lo;
+        if (p[0] == '-' && p[1] && p[1] != ']') {
+            p++;
+            if (*p == '\\' && p[1])
+                p++;
+            hi = (unsigned char)*p;
+            p++;
+        }
+        if (c >= lo && c <= hi)
+            found = 1;
+    }
+    if (*p != ']')
+        return NULL;
+    *matched = found != negate;
+    return p + 1;
+}
+
+int pattern_match(const char *pat, const char *s, size_t n) {
+    const char *p = pat;
+    const char *star_p = NULL;
+    size_t star_i = 0;
+    size_t i = 0;
+    while (i < n) {
+        if (*p == '*') {
+            while (*p == '*')
+                p++;
+            if (!*p)
+                return 1;
+            star_p = p;
+            star_i = i;
+            continue;
+        }
+        if (*p) {
+            const char *next = NULL;
+            int ok = 0;
+            if (*p == '?') {
+                ok = 1;
+                next = p + 1;
+            } else if (*p == '[') {
+                next = match_bracket(p, (unsigned char)s[i], &ok);
+            }
+            if (!next) {
+                char lc = *p;
+                next = p + 1;
+                if (lc == '\\' && p[1]) {
+                    lc = p[1];
+                    next = p + 2;
+                }
+                ok = lc == s[i];
+            }
+            if (ok) {
+                p = next;
+                i++;
+                continue;
+            }
+        }
+        /* a later `*` can absorb anything an earlier one could, so only
+         * the most recent one needs to be retried */
+        if (!star_p)
+            return 0;
+        p = star_p;
+        i = ++star_i;
+    }
+    while (*p == '*')
+        p++;
+    return *p == '\0';
+}
+
+int pattern_compile(PatternInfo *pi, const char *pat) {
+    memset(pi, 0, sizeof(*pi));
+    pi->pat = pat;
+    int wild = 0;
+    for (const char *p = pat; *p;) {
+        int dummy;
+        if (*p == '*') {
+            if (!pi->first_star)
+                pi->first_star = p;
+            pi->last_star = p;
+            pi->has_star = 1;
+            wild = 1;
+            p++;
+        } else if (*p == '?') {
+            wild = 1;
+            pi->min_len++;
+            p++;
+        } else if (*p == '[' && match_bracket(p, 0, &dummy)) {
+            wild = 1;
+            pi->min_len++;
+            p = match_bracket(p, 0, &dummy);
+        } else {
+            if (*p == '\\' && p[1])
+                p++;
+            pi->min_len++;
+            p++;
+        }
+    }
+    if (!wild) {
+        pi->lit = malloc(strlen(pat) + 1);
+        if (!pi->lit)
+            return -1;
+        char *d = pi->lit;
+        for (const char *p = pat; *p; p++) {
+            if (*p == '\\' && p[1])
+                p++;
+            *d++ = *p;
+        }
+        *d = '\0';
+        pi->literal = 1;
+        pi->lit_len = d - pi->lit;
+        return 0;
+    }
+    pi->head = pat;
+    pi->head_len = strcspn(pat, PATTERN_SPECIAL);
+    size_t len = strlen(pat);
+    size_t t = len;
+    while (t > 0 && !strchr(PATTERN_SPECIAL, pat[t - 1]))
+        t--;
+    /* an escaped character is literal but keep the check simple */
+    if (t > 0 && pat[t - 1] == '\\' && t < len)
+        t++;
+    pi->tail = pat + t;
+    pi->tail_len = len - t;
+    return 0;
+}
+
+void pattern_free(PatternInfo *pi) {
+    free(pi->lit);
+    pi->lit = NULL;
+}
+
+int pattern_match_info(const PatternInfo *pi, const char *s, size_t n) {
+    if (pi->literal)
+        return n == pi->lit_len && memcmp(s, pi->lit, n) == 0;
+    if (n < pi->min_len || (!pi->has_star && n != pi->min_len))
+        return 0;
+    if (pi->head_len > n || memcmp(s, pi->head, pi->head_len) != 0)
+        return 0;
+    if (pi->tail_len > n ||
+        memcmp(s + n - pi->tail_len, pi->tail, pi->tail_len) != 0)
+        return 0;
+    return pattern_match(pi->pat, s, n);
+}
+
+/* Offset returned when a segment is not found. */
+#define NO_POS ((size_t)-1)
+
+/* Elements of a pattern between two stars: the text from A to B, which
+ * matches exactly N bytes. */
+typedef struct {
+    const char *a;
+    const char *b;
+    size_t n;
+} Segment;
+
+/* Return the position after the pattern element at P. */
+static const char *step_end(const char *p) {
+    int dummy;
+    if (*p == '[') {
+        const char *e = match_bracket(p, 0, &dummy);
+        if (e)
+            return e;
+    }
+    if (*p == '\\' && p[1])
+        return p + 2;
+    return p + 1;
+}
+
+/* Return non-zero if the pattern element at P, which is not `*`, matches
+ * C.  An unterminated '[' is taken literally. */
+static int step_match(const char *p, unsigned char c) {
+    if (*p == '?')
+        return 1;
+    if (*p == '[') {
+        int ok;
+        if (match_bracket(p, c, &ok))
+            return ok;
+    }
+    if (*p == '\\' && p[1])
+        p++;
+    return (unsigned char)*p == c;
+}
+
+/* Describe the elements from A up to the next `*` or B. */
+static Segment segment_at(const char *a, const char *b) {
+    Segment seg = { a, a, 0 };
+    while (seg.b < b && *seg.b != '*') {
+        seg.b = step_end(seg.b);
+        seg.n++;
+    }
+    return seg;
+}
+
+/* Return non-zero if SEG matches the SEG->n bytes at S. */
+static int segment_match(const Segment *seg, const char *s) {
+    for (const char *p = seg->a; p < seg->b; p = step_end(p), s++) {
+        if (!step_match(p, (unsigned char)*s))
+            return 0;
+    }
+    return 1;
+}
+
+/* Return the first (or with LAST the last) offset from FROM to TO at
+ * which SEG matches S, or NO_POS. */
+static size_t segment_find(const Segment *seg, const char *s, size_t from,
+                           size_t to, int last) {
+    if (from > to)
+        return NO_POS;
+    /* a plain first element lets memchr() skip ahead */
+    int plain = seg->n && !strchr(PATTERN_SPECIAL, *seg->a);
+    if (!last) {
+        for (size_t i = from; i <= to; i++) {
+            if (plain) {
+                const char *c = memchr(s + i, *seg->a, to - i + 1);
+                if (!c)
+                    return NO_POS;
+                i = c - s;
+            }
+            if (segment_match(seg, s + i))
+                return i;
+        }
+        return NO_POS;
+    }
+    for (size_t i = to + 1; i-- > from;) {
+        if (plain) {
+            const char *c = memrchr(s + from, *seg->a, i - from + 1);
+            if (!c)
+                return NO_POS;
+            i = c - s;
+        }
+        if (segment_match(seg, s + i))
+            return i;
+    }
+    return NO_POS;
+}
+
+/* Place the segments between the first and last `*` of PI in order in
+ * the LEN bytes at S, each as early as possible from offset AT.  Returns
+ * the offset after the last one or NO_POS when they do not fit. */
+static size_t place_forward(const PatternInfo *pi, const char *s,
+                            size_t len, size_t at) {
+    for (const char *p = pi->first_star; p < pi->last_star;) {
+        if (*p == '*') {
+            p++;
+            continue;
+        }
+        Segment seg = segment_at(p, pi->last_star);
+        if (seg.n > len || at > len - seg.n)
+            return NO_POS;
+        size_t i = segment_find(&seg, s, at, len - seg.n, 0);
+        if (i == NO_POS)
+            return NO_POS;
+        at = i + seg.n;
+        p = seg.b;
+    }
+    return at;
+}
+
+/* Place the same segments from the last to the first, each as late as
+ * possible ending at or before offset AT.  Returns the offset of the first
+ * one or NO_POS. */
+static size_t place_backward(const PatternInfo *pi, const char *s,
+                             size_t at) {
+    const char *end = pi->last_star;
+    while (end > pi->first_star) {
+        /* find the segment that ends at END */
+        const char *a = pi->first_star;
+        const char *p = a;
+        while (p < end) {
+            if (*p == '*')
+                a = step_end(p);
+            p = step_end(p);
+        }
+        if (a >= end) {
+            end = a - 1;
+            continue;
+        }
+        Segment seg = segment_at(a, end);
+        if (seg.n > at)
+            return NO_POS;
+        size_t i = segment_find(&seg, s, 0, at - seg.n, 1);
+        if (i == NO_POS)
+            return NO_POS;
+        at = i;
+        end = a - 1;
+    }
+    return at;
+}
+
+long pattern_anchored(const PatternInfo *pi, const char *s, size_t len,
+                      int suffix, int longest) {
+    size_t lo = pi->literal ? pi->lit_len : pi->min_len;
+    if (lo > len)
+        return -1;
+    if (!pi->has_star) {
+        /* only one length can match */
+        const char *slice = suffix ? s + len - lo : s;
+        return pattern_match_info(pi, slice, lo) ? (long)lo : -1;
+    }
+    Segment first = segment_at(pi->pat, pi->first_star);
+    Segment last = segment_at(pi->last_star + 1, pi->pat + strlen(pi->pat));
+    if (!suffix) {
+        if (!segment_match(&first, s))
+            return -1;
+        size_t end = place_forward(pi, s, len, first.n);
+        if (end == NO_POS || end + last.n > len)
+            return -1;
+        size_t i = segment_find(&last, s, end, len - last.n, longest);
+        return i == NO_POS ? -1 : (long)(i + last.n);
+    }
+    if (!segment_match(&last, s + len - last.n))
+        return -1;
+    size_t start = place_backward(pi, s, len - last.n);
+    if (start == NO_POS || start < first.n)
+        return -1;
+    size_t i = segment_find(&first, s, 0, start - first.n, !longest);
+    return i == NO_POS ? -1 : (long)(len - i);
+}
+
+int pattern_search(const PatternInfo *pi, const char *s, size_t len,
+                   size_t *start, size_t *mlen) {
+    if (pi->literal) {
+        if (pi->lit_len == 0)
+            return 0;
+        const char *m = memmem(s, len, pi->lit, pi->lit_len);
+        if (!m)
+            return 0;
+        *start = m - s;
+        *mlen = pi->lit_len;
+        return 1;
+    }
+    if (pi->min_len > len)
+        return 0;
+    if (pi->has_star) {
+        /*
+         * Placing the segments from a later start can only push them
+         * later, so when the first start where the leading segment fits
+         * has no match no later start does either.
+         */
+        Segment first = segment_at(pi->pat, pi->first_star);
+        size_t i = segment_find(&first, s, 0, len - pi->min_len, 0);
+        if (i == NO_POS)
+            return 0;
+        long l = pattern_anchored(pi, s + i, len - i, 0, 1);
+        if (l <= 0)
+            return 0;
+        *start = i;
+        *mlen = (size_t)l;
+        return 1;
+    }
+    size_t lo = pi->min_len;
+    for (size_t i = 0; i + lo <= len; i++) {
+        if (pi->head_len) {
+            const char *h = memchr(s + i, pi->head[0], len - i);
+            if (!h)
+                return 0;
+            i = h - s;
+            if (i + lo > len)
+                return 0;
+        }
+        if (pattern_match_info(pi, s + i, lo)) {
+            *start = i;
+            *mlen = lo;
+            return 1;
+        }
+    }
+    return 0;
+}
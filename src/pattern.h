@@ -0,0 +1,60 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Shell pattern matching on string slices.
+ */
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stddef.h>
+
+/*
+ * Facts about a pattern gathered once so callers can skip positions that
+ * cannot match.  HEAD and TAIL are the literal text before the first and
+ * after the last `*`; a pattern without `*` only matches MIN_LEN bytes.
+ * FIRST_STAR and LAST_STAR point at the first and last `*` of PAT.
+ */
+typedef struct {
+    const char *pat;
+    int literal;            /* no wildcards: LIT holds the unescaped text */
+    int has_star;
+    size_t min_len;
+    char *lit;
+    size_t lit_len;
+    const char *head;       /* borrowed from PAT, no escapes inside */
+    size_t head_len;
+    const char *tail;
+    size_t tail_len;
+    const char *first_star;
+    const char *last_star;
+} PatternInfo;
+
+/* Analyse PAT.  Returns 0 on success or -1 on allocation failure. */
+int pattern_compile(PatternInfo *pi, const char *pat);
+void pattern_free(PatternInfo *pi);
+
+/* Return non-zero if the N bytes at S match PAT as fnmatch() would with no
+ * flags.  Nothing is allocated. */
+int pattern_match(const char *pat, const char *s, size_t n);
+
+/* Return non-zero if the N bytes at S match the analysed pattern PI. */
+int pattern_match_info(const PatternInfo *pi, const char *s, size_t n);
+
+/*
+ * Find the shortest (or with LONGEST the longest) prefix of the LEN bytes
+ * at S matching PI and return its length, or -1 when none does.  With
+ * SUFFIX the search is for a suffix instead.  The time is linear in LEN.
+ */
+long pattern_anchored(const PatternInfo *pi, const char *s, size_t len,
+                      int suffix, int longest);
+
+/*
+ * Find the leftmost longest non-empty match of PI in the LEN bytes at S.
+ * Returns 1 and stores the offset and length in *START and *MLEN, or 0.
+ * The time is linear in LEN.
+ */
+int pattern_search(const PatternInfo *pi, const char *s, size_t len,
+                   size_t *start, size_t *mlen);
+
+#endif /* PATTERN_H */
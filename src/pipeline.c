@@ -13,7 +13,11 @@
  * that the child's stdout feeds into the next segment's stdin.  The parent
  * retains the read end of that pipe and passes it to the next fork.  In the
  * child process unused pipe ends are closed, redirections are applied and the
- * command is executed.  After all segments have been spawned,
+ * command is executed.  Builtins and shell functions run directly in the
+ * forked shell; only external commands are exec'd.  External commands whose
+ * redirections can be expressed as posix_spawn file actions skip the fork
+ * entirely and are launched with posix_spawn(), which does not copy the
+ * shell's page tables.  After all segments have been spawned,
  * wait_for_pipeline() either waits for the children to finish or registers the
  * job for background execution.
  */
@@ -25,7 +29,11 @@
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/wait.h>
+#ifdef HAVE_POSIX_SPAWN
+#include <spawn.h>
+#endif
 
 #include "pipeline.h"
 #include "jobs.h"
@@ -33,6 +41,11 @@
 #include "hash.h"
 #include "redir.h"
 #include "error.h"
+#include "builtins.h"
+#include "func_exec.h"
+#include "vars.h"
+#include "util.h"
+#include "stats.h"
 
 
 /*
@@ -55,14 +68,191 @@ void setup_child_pipes(PipelineSegment *seg, int in_fd, int pipefd[2]) {
     }
 }
 
+/* Return non-zero if NAME is a builtin command. */
+static int is_builtin_name(const char *name) {
+    for (int i = 0; i < BI_COUNT; i++) {
+        if (strcmp(name, builtin_table[i].name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+#ifdef HAVE_POSIX_SPAWN
+/* Build the environment for a spawned child: shell_environ() with the
+ * temporary NAME=value assignments of SEG overriding or extending it.  Only
+ * the pointer array is allocated; the strings are shared. */
+static char **spawn_environment(PipelineSegment *seg) {
+    char **env = shell_environ();
+    if (seg->assign_count == 0)
+        return env;
+    size_t n = 0;
+    while (env[n])
+        n++;
+    char **envp = xmalloc((n + seg->assign_count + 1) * sizeof(char *));
+    memcpy(envp, env, n * sizeof(char *));
+    for (int i = 0; i < seg->assign_count; i++) {
+        char *eq = strchr(seg->assigns[i], '=');
+        if (!eq)
+            continue;
+        size_t len = (size_t)(eq - seg->assigns[i]) + 1;
+        size_t j = 0;
+        while (j < n && strncmp(envp[j], seg->assigns[i], len) != 0)
+            j++;
+        envp[j] = seg->assigns[i];
+        if (j == n)
+            n++;
+    }
+    envp[n] = NULL;
+    return envp;
+}
+
+/* Translate the redirections of SEG into file actions mirroring
+ * setup_child_pipes() and setup_redirections().  Returns 0 on success. */
+static int spawn_file_actions(posix_spawn_file_actions_t *fa,
+                              PipelineSegment *seg, int in_fd, int pipefd[2],
+                              int here_fd) {
+    int r = 0;
+    if (in_fd != -1) {
+        r |= posix_spawn_file_actions_adddup2(fa, in_fd, STDIN_FILENO);
+        r |= posix_spawn_file_actions_addclose(fa, in_fd);
+    }
+    if (seg->next) {
+        r |= posix_spawn_file_actions_addclose(fa, pipefd[0]);
+        r |= posix_spawn_file_actions_adddup2(fa, pipefd[1], STDOUT_FILENO);
+        r |= posix_spawn_file_actions_addclose(fa, pipefd[1]);
+    }
+
+    if (here_fd != -1) {
+        r |= posix_spawn_file_actions_adddup2(fa, here_fd, seg->in_fd);
+        r |= posix_spawn_file_actions_addclose(fa, here_fd);
+    } else if (seg->in_file) {
+        r |= posix_spawn_file_actions_addopen(fa, seg->in_fd, seg->in_file,
+                                              O_RDONLY, 0);
+    }
+
+    int oflags = O_WRONLY | O_CREAT | (seg->append ? O_APPEND : O_TRUNC);
+    if (seg->out_file && seg->err_file && strcmp(seg->out_file, seg->err_file) == 0 &&
+        seg->append == seg->err_append) {
+        r |= posix_spawn_file_actions_addopen(fa, STDOUT_FILENO, seg->out_file,
+                                              oflags, 0666);
+        r |= posix_spawn_file_actions_adddup2(fa, STDOUT_FILENO, STDERR_FILENO);
+    } else {
+        if (seg->out_file)
+            r |= posix_spawn_file_actions_addopen(fa, seg->out_fd, seg->out_file,
+                                                  oflags, 0666);
+        if (seg->err_file) {
+            int eflags = O_WRONLY | O_CREAT |
+                         (seg->err_append ? O_APPEND : O_TRUNC);
+            r |= posix_spawn_file_actions_addopen(fa, STDERR_FILENO,
+                                                  seg->err_file, eflags, 0666);
+        }
+    }
+
+    int close_err = seg->close_err;
+    int dup_err = seg->dup_err;
+    if (seg->close_out) {
+        r |= posix_spawn_file_actions_addclose(fa, seg->out_fd);
+        if (seg->out_fd == STDERR_FILENO)
+            close_err = 0;
+        if (dup_err == seg->out_fd)
+            dup_err = -1;
+    } else if (seg->dup_out != -1) {
+        r |= posix_spawn_file_actions_adddup2(fa, seg->dup_out, seg->out_fd);
+    }
+
+    if (close_err)
+        r |= posix_spawn_file_actions_addclose(fa, STDERR_FILENO);
+    else if (dup_err != -1)
+        r |= posix_spawn_file_actions_adddup2(fa, dup_err, STDERR_FILENO);
+    return r;
+}
+
+/*
+ * Launch the external command of SEG with posix_spawn().
+ *
+ * Returns the child's pid, or -1 when the fast path cannot be used or the
+ * spawn failed.  The caller then falls back to fork_segment's full fork
+ * path, which also produces the usual diagnostics for missing commands and
+ * unopenable files.  Output redirections under noclobber are left to the
+ * fork path so that a failed spawn never leaves a file it created behind
+ * for the retry to trip over, as are temporary PATH assignments.
+ *
+ * The command is looked up in the shell's own PATH, which the process
+ * environment no longer mirrors, and spawned by its full path.  Names that
+ * are not found go straight to the fork path.
+ */
+static pid_t spawn_segment(PipelineSegment *seg, int in_fd, int pipefd[2]) {
+    if (seg->out_file && opt_noclobber)
+        return -1;
+    for (int i = 0; i < seg->assign_count; i++) {
+        if (strncmp(seg->assigns[i], "PATH=", 5) == 0)
+            return -1;
+    }
+    if (is_builtin_name(seg->argv[0]) || find_function(seg->argv[0]))
+        return -1;
+
+    const char *path = seg->argv[0];
+    char found[PATH_MAX];
+    if (!strchr(path, '/')) {
+        path = hash_lookup(seg->argv[0], NULL);
+        if (!path) {
+            if (hash_search(seg->argv[0], found, sizeof(found)) < 0)
+                return -1;
+            path = found;
+        }
+    }
+
+    posix_spawn_file_actions_t fa;
+    if (posix_spawn_file_actions_init(&fa) != 0)
+        return -1;
+    posix_spawnattr_t attr;
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&fa);
+        return -1;
+    }
+
+    pid_t pid = -1;
+    int here_fd = -1;
+    if (seg->here_doc)
+        here_fd = here_doc_fd(seg->here_text);
+    sigset_t dfl;
+    sigemptyset(&dfl);
+    sigaddset(&dfl, SIGINT);
+    if ((!seg->here_doc || here_fd != -1) &&
+        spawn_file_actions(&fa, seg, in_fd, pipefd, here_fd) == 0 &&
+        posix_spawnattr_setsigdefault(&attr, &dfl) == 0 &&
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF) == 0) {
+        char **envp = spawn_environment(seg);
+        int err = posix_spawn(&pid, path, &fa, &attr, seg->argv, envp);
+        if (err != 0) {
+            pid = -1;
+        } else {
+            fork_count++;
+            stats_exec(0);
+        }
+        if (seg->assign_count > 0)
+            free(envp);
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if (here_fd != -1)
+        close(here_fd);
+    return pid;
+}
+#endif
+
 /*
  * Fork a child process for one pipeline segment.
  *
  * This spawns the command for SEG.  A pipe is created when the segment has a
  * successor.  The child installs the appropriate pipe ends using
  * setup_child_pipes(), applies any I/O redirections and exports temporary
- * assignments before executing the command.  The parent's copy of 'in_fd' is
- * updated with the read end of the pipe so the next segment can consume it.
+ * assignments before running the command.  Builtins and functions are
+ * dispatched in the child and never reach execvp().  External commands are
+ * tried with spawn_segment() first when posix_spawn is available.  The
+ * parent's copy of 'in_fd' is updated with the read end of the pipe so the
+ * next segment can consume it.
  */
 pid_t fork_segment(PipelineSegment *seg, int *in_fd) {
     if (!seg->argv[0] || seg->argv[0][0] == '\0') {
@@ -75,7 +265,12 @@ pid_t fork_segment(PipelineSegment *seg, int *in_fd) {
     if (seg->next)
         RETURN_IF_ERR(pipe(pipefd) < 0, "pipe");
 
-    pid_t pid = fork();
+    pid_t pid = -1;
+#ifdef HAVE_POSIX_SPAWN
+    pid = spawn_segment(seg, *in_fd, pipefd);
+#endif
+    if (pid < 0)
+        pid = shell_fork();
     if (pid == 0) {
         signal(SIGINT, SIG_DFL);
         setup_child_pipes(seg, *in_fd, pipefd);
@@ -87,19 +282,32 @@ pid_t fork_segment(PipelineSegment *seg, int *in_fd) {
                 size_t len = (size_t)(eq - seg->assigns[ai]);
                 char *name = strndup(seg->assigns[ai], len);
                 if (name) {
-                    setenv(name, eq + 1, 1);
+                    export_var(name, eq + 1);
                     free(name);
                 }
             }
         }
 
+        /* builtins and functions run in the forked shell without exec */
+        int is_blt = is_builtin_name(seg->argv[0]);
+        FuncEntry *fn = is_blt ? NULL : find_function(seg->argv[0]);
+        if (is_blt || fn) {
+            if (is_blt)
+                run_builtin(seg->argv);
+            else
+                run_function(fn, seg->argv);
+            fflush(stdout);
+            _exit(last_status);
+        }
+
+        environ = shell_environ();
         const char *hpath = NULL;
         int hfd = -1;
         if (!strchr(seg->argv[0], '/'))
             hpath = hash_lookup(seg->argv[0], &hfd);
+        stats_exec(hpath && hfd >= 0);
         if (hpath) {
 #ifdef HAVE_FEXECVE
-            extern char **environ;
             if (hfd >= 0) {
                 fcntl(hfd, F_SETFD, 0);
                 fexecve(hfd, seg->argv, environ);
@@ -112,7 +320,7 @@ pid_t fork_segment(PipelineSegment *seg, int *in_fd) {
             fprintf(stderr, "%s: command not found\n", seg->argv[0]);
         else
             fprintf(stderr, "%s: %s\n", seg->argv[0], strerror(errno));
-        exit(127);
+        _exit(127);
     } else if (pid > 0) {
         if (*in_fd != -1)
             close(*in_fd);
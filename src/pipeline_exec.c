@@ -16,7 +16,6 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <glob.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -34,6 +33,9 @@
 #include "redir.h"
 #include "assignment_utils.h"
 #include "parser.h"
+#include "strarray.h"
+#include "glob_expand.h"
+#include "strbuf.h"
 
 
 static int spawn_pipeline_segments(PipelineSegment *pipeline, int background,
@@ -68,142 +70,144 @@ static int run_builtin_shell(PipelineSegment *seg) {
     return handled;
 }
 
+/* Record the malloc'd S as belonging to the execution copy SEG so that it
+ * is released together with the copy.  Returns S. */
+static char *seg_own(PipelineSegment *seg, char *s) {
+    return arena_own(&seg->arena, s);
+}
+
 /* Expand only the temporary assignment words of SEG using the current environment. */
 static void expand_temp_assignments(PipelineSegment *seg) {
-    for (int i = 0; i < seg->assign_count; i++)
-        expand_assignment(&seg->assigns[i]);
+    for (int i = 0; i < seg->assign_count; i++) {
+        char *n = expand_assignment(seg->assigns[i]);
+        if (n)
+            seg->assigns[i] = seg_own(seg, n);
+    }
 }
 
-static void expand_segment(PipelineSegment *seg) {
-    char *newargv[MAX_TOKENS];
-    int ai = 0;
+/* Append S, borrowed from the parsed command or owned by the segment, to
+ * the argument list ARGS. */
+static void push_arg(StrArray *args, char *s) {
+    if (strarray_push(args, s) == -1)
+        perror("malloc");
+}
 
-    for (int i = 0; seg->argv[i] && ai < MAX_TOKENS - 1; i++) {
+/* Expand the argument words of SEG into a new argument vector.  Field
+ * splitting and globbing may produce any number of words.  Directory
+ * listings are shared by all the patterns of the command. */
+static void expand_segment_words(PipelineSegment *seg) {
+    StrArray args;
+    strarray_init(&args);
+    GlobCache gcache;
+    glob_cache_init(&gcache);
+
+    for (int i = 0; seg->argv[i]; i++) {
         char *word = seg->argv[i];
-        if (seg->expand[i]) {
-            char *exp = expand_var(word);
-            if (!exp) exp = strdup("");
-
-            size_t start = (size_t)ai;
-            if (!seg->quoted[i]) {
-                int count = 0;
-                char **fields = split_fields(exp, &count);
-                free(exp);
-                if (fields) {
-                    for (int f = 0; f < count && ai < MAX_TOKENS - 1; f++) {
-                        char *fld = fields[f];
-                        if (!opt_noglob &&
-                            (strchr(fld, '*') || strchr(fld, '?'))) {
-                            glob_t g;
-                            int r = glob(fld, 0, NULL, &g);
-                            if (r == 0 && g.gl_pathc > 0) {
-                                size_t gstart = (size_t)ai;
-                                for (size_t gi = 0; gi < g.gl_pathc &&
-                                                 ai < MAX_TOKENS - 1; gi++) {
-                                    char *dup = strdup(g.gl_pathv[gi]);
-                                    if (!dup) {
-                                        while ((size_t)ai > gstart) {
-                                            free(newargv[--ai]);
-                                            newargv[ai] = NULL;
-                                        }
-                                        free(fld);
-                                        globfree(&g);
-                                        goto skip_field;
-                                    }
-                                    newargv[ai] = dup;
-                                    seg->expand[ai] = 0;
-                                    seg->quoted[ai] = 0;
-                                    ai++;
-                                }
-                                free(fld);
-                                globfree(&g);
-                                continue;
-                            }
-                            globfree(&g);
-                        }
-                        newargv[ai] = fld;
-                        seg->expand[ai] = 0;
-                        seg->quoted[ai] = 0;
-                        ai++;
-                    skip_field: ;
-                    }
-                    free(fields);
-                } else {
-                    exp = strdup("");
-                    newargv[ai] = exp;
-                    seg->expand[ai] = 0;
-                    seg->quoted[ai] = 0;
-                    ai++;
-                }
-            } else {
-                newargv[ai] = exp;
-                seg->expand[ai] = 0;
-                seg->quoted[ai] = 0;
-                ai++;
-            }
+        if (!seg->expand[i]) {
+            push_arg(&args, word);
+            continue;
+        }
 
-            int changed = 1;
-            if ((size_t)ai == start + 1 && strcmp(newargv[start], word) == 0)
-                changed = 0;
-            if (!changed) {
-                free(newargv[start]);
-                newargv[start] = word;
-                seg->quoted[start] = seg->quoted[i];
-            } else {
-                free(word);
-                seg->argv[i] = NULL;
+        char *exp = expand_var(word);
+        if (!exp) exp = xstrdup("");
+
+        int start = args.count;
+        if (!seg->quoted[i]) {
+            /* fields are carved out of EXP, now owned by the segment */
+            int count = 0;
+            char **fields = split_fields(exp, &count, &seg->arena);
+            for (int f = 0; f < count; f++) {
+                char *fld = fields[f];
+                if (!opt_noglob &&
+                    (strchr(fld, '*') || strchr(fld, '?'))) {
+                    int before = args.count;
+                    int r = glob_expand(&gcache, fld, &args);
+                    for (int j = before; j < args.count; j++)
+                        seg_own(seg, args.items[j]);
+                    if (r > 0)
+                        continue;
+                    if (r < 0)
+                        perror("malloc");
+                }
+                push_arg(&args, fld);
             }
         } else {
-            newargv[ai] = word;
-            seg->expand[ai] = 0;
-            seg->quoted[ai] = seg->quoted[i];
-            ai++;
+            push_arg(&args, seg_own(seg, exp));
         }
+
+        /* an unchanged word keeps pointing at the parsed command */
+        if (args.count == start + 1 && args.items[start] &&
+            strcmp(args.items[start], word) == 0)
+            args.items[start] = word;
     }
-    newargv[ai] = NULL;
-    seg->expand[ai] = 0;
-    seg->quoted[ai] = 0;
 
-    for (int j = ai; seg->argv[j]; j++)
-        free(seg->argv[j]);
+    glob_cache_release(&gcache);
 
-    for (int j = 0; j <= ai; j++) {
-        seg->argv[j] = newargv[j];
-        seg->expand[j] = 0;
-        seg->quoted[j] = 0;
+    /* terminate by hand: strarray_finish() would free borrowed words */
+    if (strarray_push(&args, NULL) == -1) {
+        perror("malloc");
+        free(args.items);
+        seg->argv[0] = NULL;
+    } else {
+        free(seg->argv);
+        seg->argv = args.items;
     }
-    for (int j = ai + 1; j < MAX_TOKENS; j++) {
-        seg->argv[j] = NULL;
-        seg->expand[j] = 0;
-        seg->quoted[j] = 0;
+    seg->expand = NULL;
+    seg->quoted = NULL;
+}
+
+/* Expand each line of the here-document TEXT as the parser used to when
+ * it read the body.  Returns a new string or NULL on error. */
+static char *expand_here_text(const char *text) {
+    if (!strpbrk(text, "$`\\~"))
+        return NULL; /* nothing to expand: keep borrowing TEXT */
+    StrBuf res;
+    strbuf_init(&res, strlen(text));
+    const char *p = text;
+    while (*p) {
+        const char *nl = strchr(p, '\n');
+        size_t n = nl ? (size_t)(nl - p) : strlen(p);
+        char *line = strndup(p, n);
+        char *exp = line ? expand_var(line) : NULL;
+        free(line);
+        if (!exp) {
+            strbuf_release(&res);
+            return NULL;
+        }
+        strbuf_appends(&res, exp);
+        free(exp);
+        if (nl)
+            strbuf_appendc(&res, '\n');
+        p = nl ? nl + 1 : p + n;
     }
+    return strbuf_finish(&res);
+}
+
+/* Expand the words and redirection targets of the execution copy SEG.
+ * Words that do not change keep pointing at the parsed command; only the
+ * results of expansion are allocated, and they are owned by SEG. */
+static void expand_segment(PipelineSegment *seg) {
+    if (seg->expand)
+        expand_segment_words(seg);
 
-    for (int i = 0; i < seg->assign_count; i++)
-        expand_assignment(&seg->assigns[i]);
+    expand_temp_assignments(seg);
 
-    if (seg->in_file) {
-        char *n = expand_var(seg->in_file);
-        free(seg->in_file);
-        seg->in_file = n;
+    if (seg->in_file)
+        seg->in_file = seg_own(seg, expand_var(seg->in_file));
+    if (seg->here_doc && !seg->here_doc_quoted) {
+        char *text = expand_here_text(seg->here_text);
+        if (text)
+            seg->here_text = seg_own(seg, text);
     }
 
     if (seg->out_file && seg->err_file && seg->out_file == seg->err_file) {
-        char *n = expand_var(seg->out_file);
-        free(seg->out_file);
-        seg->out_file = n;
+        seg->out_file = seg_own(seg, expand_var(seg->out_file));
         seg->err_file = seg->out_file;
     } else {
-        if (seg->out_file) {
-            char *n = expand_var(seg->out_file);
-            free(seg->out_file);
-            seg->out_file = n;
-        }
-
-        if (seg->err_file) {
-            char *n = expand_var(seg->err_file);
-            free(seg->err_file);
-            seg->err_file = n;
-        }
+        if (seg->out_file)
+            seg->out_file = seg_own(seg, expand_var(seg->out_file));
+        if (seg->err_file)
+            seg->err_file = seg_own(seg, expand_var(seg->err_file));
     }
 }
 
@@ -214,7 +218,7 @@ static void expand_pipeline(PipelineSegment *pipeline) {
 
 /* Expand all parts of SEG except for temporary assignments. */
 static void expand_segment_no_assign(PipelineSegment *seg) {
-    if (getenv("VUSH_DEBUG")) {
+    if (get_env_var("VUSH_DEBUG")) {
         fprintf(stderr, "expand_segment_no_assign before:");
         for (int i = 0; seg->argv[i]; i++)
             fprintf(stderr, " '%s'", seg->argv[i]);
@@ -226,7 +230,7 @@ static void expand_segment_no_assign(PipelineSegment *seg) {
     expand_segment(seg);
     seg->assign_count = save;
 
-    if (getenv("VUSH_DEBUG")) {
+    if (get_env_var("VUSH_DEBUG")) {
         fprintf(stderr, "expand_segment_no_assign after:");
         for (int i = 0; seg->argv[i]; i++)
             fprintf(stderr, " '%s'", seg->argv[i]);
@@ -234,59 +238,29 @@ static void expand_segment_no_assign(PipelineSegment *seg) {
     }
 }
 
-/* Create a deep copy of a pipeline so that expansions can be performed
- * without modifying the original command.  Returns NULL on allocation failure. */
+/* Create the per-execution copy of a pipeline that expansion works on.
+ * The copy has its own argument vector but borrows every string and the
+ * expansion flags from SRC.  Expansion replaces the words it changes with
+ * strings owned by the segment's arena, so the parsed command is
+ * never modified.  Release with free_pipeline_copy(). */
 static PipelineSegment *copy_pipeline(PipelineSegment *src) {
     PipelineSegment *head = NULL;
     PipelineSegment **tail = &head;
     while (src) {
-        PipelineSegment *seg = xcalloc(1, sizeof(*seg));
-
-        int i = 0;
-        while (src->argv[i]) {
-            seg->argv[i] = strdup(src->argv[i]);
-            if (!seg->argv[i]) {
-                free_pipeline(seg);
-                free_pipeline(head);
-                return NULL;
-            }
-            seg->expand[i] = src->expand[i];
-            seg->quoted[i] = src->quoted[i];
-            i++;
-        }
-        seg->argv[i] = NULL;
-        seg->quoted[i] = 0;
-
-        seg->in_file = src->in_file ? strdup(src->in_file) : NULL;
-        seg->here_doc = src->here_doc;
-        seg->here_doc_quoted = src->here_doc_quoted;
-        seg->out_file = src->out_file ? strdup(src->out_file) : NULL;
-        seg->append = src->append;
-        seg->force = src->force;
-        seg->dup_out = src->dup_out;
-        seg->close_out = src->close_out;
-        if (src->err_file == src->out_file)
-            seg->err_file = seg->out_file;
-        else
-            seg->err_file = src->err_file ? strdup(src->err_file) : NULL;
-        seg->err_append = src->err_append;
-        seg->dup_err = src->dup_err;
-        seg->close_err = src->close_err;
-        seg->out_fd = src->out_fd;
-        seg->in_fd = src->in_fd;
-        seg->assign_count = src->assign_count;
+        PipelineSegment *seg = xmalloc(sizeof(*seg));
+        *seg = *src;
+        arena_init(&seg->arena);
+        int argc = 0;
+        while (src->argv[argc])
+            argc++;
+        seg->argv = xmalloc((size_t)(argc + 1) * sizeof(char *));
+        memcpy(seg->argv, src->argv, (size_t)(argc + 1) * sizeof(char *));
+        seg->argv_cap = argc + 1;
         if (src->assign_count > 0) {
             seg->assigns = xcalloc(src->assign_count, sizeof(char *));
-            for (int j = 0; j < src->assign_count; j++) {
-                seg->assigns[j] = strdup(src->assigns[j]);
-                if (!seg->assigns[j]) {
-                    free_pipeline(seg);
-                    free_pipeline(head);
-                    return NULL;
-                }
-            }
+            memcpy(seg->assigns, src->assigns,
+                   src->assign_count * sizeof(char *));
         }
-
         seg->next = NULL;
         *tail = seg;
         tail = &seg->next;
@@ -295,6 +269,19 @@ static PipelineSegment *copy_pipeline(PipelineSegment *src) {
     return head;
 }
 
+/* Free a pipeline created by copy_pipeline() along with every string that
+ * expansion allocated for it. */
+static void free_pipeline_copy(PipelineSegment *p) {
+    while (p) {
+        PipelineSegment *next = p->next;
+        arena_release(&p->arena);
+        free(p->argv);
+        free(p->assigns);
+        free(p);
+        p = next;
+    }
+}
+
 /* Export temporary assignments and return the previous values to be restored
  * later.  When no command is present, assignments are applied permanently and
  * NULL is returned. */
@@ -313,8 +300,6 @@ static struct assign_backup *set_temp_environment(PipelineSegment *pipeline) {
                 apply_array_assignment(name, val, opt_allexport);
             } else {
                 set_shell_var(name, val);
-                if (opt_allexport)
-                    setenv(name, val, 1);
             }
             free(name);
         }
@@ -335,8 +320,7 @@ static struct assign_backup *set_temp_environment(PipelineSegment *pipeline) {
         if (vlen > 1 && val[0] == '(' && val[vlen - 1] == ')') {
             apply_array_assignment(backs[i].name, val, 1);
         } else {
-            setenv(backs[i].name, val, 1);
-            set_shell_var(backs[i].name, val);
+            export_var(backs[i].name, val);
         }
     }
 
@@ -348,15 +332,13 @@ static int run_temp_command(PipelineSegment *pipeline, int background,
                             const char *line) {
     expand_segment_no_assign(pipeline);
     if (!pipeline->argv[0] || pipeline->argv[0][0] == '\0') {
-        if (pipeline->argv[0]) {
-            free(pipeline->argv[0]);
-            pipeline->argv[0] = NULL;
-        }
+        pipeline->argv[0] = NULL;
         return -1;        /* nothing to execute after expansion */
     }
 
     int has_redir =
-        pipeline->in_file || pipeline->out_file || pipeline->err_file ||
+        pipeline->in_file || pipeline->here_doc ||
+        pipeline->out_file || pipeline->err_file ||
         pipeline->dup_out != -1 || pipeline->dup_err != -1 ||
         pipeline->close_out || pipeline->close_err ||
         pipeline->out_fd != STDOUT_FILENO || pipeline->in_fd != STDIN_FILENO;
@@ -464,14 +446,10 @@ int run_pipeline_internal(PipelineSegment *pipeline, int background, const char
         return 0;
 
     PipelineSegment *copy = copy_pipeline(pipeline);
-    if (!copy) {
-        last_status = 1;
-        return 1;
-    }
 
     param_error = 0;
     if (opt_xtrace && line) {
-        const char *ps4 = getenv("PS4");
+        const char *ps4 = get_env_var("PS4");
         if (!ps4) ps4 = "+ ";
         fprintf(stderr, "%s%s\n", ps4, line);
     }
@@ -480,7 +458,7 @@ int run_pipeline_internal(PipelineSegment *pipeline, int background, const char
     if (handled || (!copy->argv[0] && copy->assign_count > 0)) {
         if (param_error)
             last_status = 1;
-        free_pipeline(copy);
+        free_pipeline_copy(copy);
         cleanup_proc_subs();
         if (opt_errexit && last_status != 0)
             exit(last_status);
@@ -492,14 +470,14 @@ int run_pipeline_internal(PipelineSegment *pipeline, int background, const char
     if (!copy->argv[0] || copy->argv[0][0] == '\0') {
         fprintf(stderr, "syntax error: missing command\n");
         last_status = 1;
-        free_pipeline(copy);
+        free_pipeline_copy(copy);
         cleanup_proc_subs();
         return last_status;
     }
     int r = spawn_pipeline_segments(copy, background, line);
     if (param_error)
         last_status = 1;
-    free_pipeline(copy);
+    free_pipeline_copy(copy);
     cleanup_proc_subs();
     if (opt_errexit && !background && last_status != 0)
         exit(last_status);
@@ -0,0 +1,355 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Script profiler.
+ */
+
+/*
+ * With `set -o profile`, or VUSH_PROFILE naming a report file at startup,
+ * run_pipeline() times every command it runs and run_function() tracks the
+ * functions entered.  Each command's own time is its wall and CPU time minus
+ * that of the commands run from it, so a loop line only accounts for the
+ * loop itself and the lines of its body report their share.  CPU time
+ * includes the children the shell has waited for.
+ *
+ * When the shell exits a report sorted by self time is written to
+ * $VUSH_PROFILE, or standard error when it is not set.  With VUSH_PROFILE
+ * the self time of every stack of functions and lines is also written to
+ * $VUSH_PROFILE.folded in the folded format read by flame graph tools,
+ * one "main;func;line N microseconds" entry per line.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "profile.h"
+#include "options.h"
+#include "strbuf.h"
+#include "util.h"
+#include "vars.h"
+
+typedef struct {
+    char *name;             /* function, "main" or a folded stack */
+    int line;               /* 0 for function and stack entries */
+    unsigned long count;    /* calls or executions */
+    unsigned long iters;
+    double wall;            /* functions: inclusive, lines: self */
+    double cpu;
+    unsigned long forks;
+    double self_wall;       /* functions only */
+    double self_cpu;
+    int depth;              /* active calls, so recursion counts once */
+} ProfEntry;
+
+typedef struct {
+    ProfEntry **slots;      /* open addressed, nslots is a power of two */
+    size_t nslots;
+    size_t count;
+} ProfTable;
+
+typedef struct {
+    ProfEntry *fn;          /* NULL for the top level */
+    size_t stack_len;       /* length of stack_text before this frame */
+    double wall;
+    double cpu;
+    unsigned long forks;
+} ProfFrame;
+
+static ProfTable funcs;
+static ProfTable lines;
+static ProfTable stacks;
+static ProfFrame *frames;
+static int nframes;
+static int frames_cap;
+static StrBuf stack_text;   /* "main;f;g" for the open frames */
+static ProfileMark *current;
+static int started;
+static pid_t owner;
+static char *report_path;
+static double start_wall;
+static double start_cpu;
+static unsigned long start_forks;
+
+static double wall_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double tv_secs(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* CPU time of the shell and of the children it has waited for. */
+static double cpu_now(void) {
+    struct rusage self, kids;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &kids);
+    return tv_secs(self.ru_utime) + tv_secs(self.ru_stime) +
+           tv_secs(kids.ru_utime) + tv_secs(kids.ru_stime);
+}
+
+static size_t hash_key(const char *name, int line) {
+    return (hash_string(name) ^ (size_t)line) * 16777619u;
+}
+
+static void table_insert(ProfTable *t, ProfEntry *e) {
+    size_t mask = t->nslots - 1;
+    size_t i = hash_key(e->name, e->line) & mask;
+    while (t->slots[i])
+        i = (i + 1) & mask;
+    t->slots[i] = e;
+}
+
+/* Return the entry for NAME and LINE in T, adding it when missing. */
+static ProfEntry *table_get(ProfTable *t, const char *name, int line) {
+    if ((t->count + 1) * 2 > t->nslots) {
+        ProfEntry **old = t->slots;
+        size_t nold = t->nslots;
+        t->nslots = nold ? nold * 2 : 64;
+        t->slots = xcalloc(t->nslots, sizeof(*t->slots));
+        for (size_t i = 0; i < nold; i++)
+            if (old[i])
+                table_insert(t, old[i]);
+        free(old);
+    }
+    size_t mask = t->nslots - 1;
+    size_t i = hash_key(name, line) & mask;
+    for (; t->slots[i]; i = (i + 1) & mask) {
+        ProfEntry *e = t->slots[i];
+        if (e->line == line && strcmp(e->name, name) == 0)
+            return e;
+    }
+    ProfEntry *e = xcalloc(1, sizeof(*e));
+    e->name = xstrdup(name);
+    e->line = line;
+    t->slots[i] = e;
+    t->count++;
+    return e;
+}
+
+/* Return the entries of T in a malloc'd array sorted by CMP. */
+static ProfEntry **table_sorted(ProfTable *t,
+                                int (*cmp)(const void *, const void *)) {
+    ProfEntry **res = xcalloc(t->count ? t->count : 1, sizeof(*res));
+    size_t n = 0;
+    for (size_t i = 0; i < t->nslots; i++)
+        if (t->slots[i])
+            res[n++] = t->slots[i];
+    qsort(res, n, sizeof(*res), cmp);
+    return res;
+}
+
+static int by_self_time(const void *a, const void *b) {
+    const ProfEntry *x = *(ProfEntry *const *)a;
+    const ProfEntry *y = *(ProfEntry *const *)b;
+    return x->self_wall < y->self_wall ? 1 : x->self_wall > y->self_wall ? -1 : 0;
+}
+
+static int by_line_time(const void *a, const void *b) {
+    const ProfEntry *x = *(ProfEntry *const *)a;
+    const ProfEntry *y = *(ProfEntry *const *)b;
+    return x->wall < y->wall ? 1 : x->wall > y->wall ? -1 : 0;
+}
+
+static void stack_truncate(size_t len) {
+    stack_text.len = len;
+    stack_text.data[len] = '\0';
+}
+
+static void push_frame(ProfEntry *fn) {
+    if (nframes == frames_cap) {
+        frames_cap = frames_cap ? frames_cap * 2 : 16;
+        ProfFrame *tmp = realloc(frames, frames_cap * sizeof(*frames));
+        if (!tmp) {
+            perror("realloc");
+            exit(1);
+        }
+        frames = tmp;
+    }
+    ProfFrame *f = &frames[nframes++];
+    f->fn = fn;
+    f->stack_len = stack_text.len;
+    if (stack_text.len)
+        strbuf_appendc(&stack_text, ';');
+    strbuf_appends(&stack_text, fn ? fn->name : "main");
+    f->wall = wall_now();
+    f->cpu = cpu_now();
+    f->forks = fork_count;
+}
+
+static void write_report(FILE *out) {
+    fprintf(out, "vush profile: %.3f s wall, %.3f s cpu, %lu forks\n",
+            wall_now() - start_wall, cpu_now() - start_cpu,
+            fork_count - start_forks);
+
+    ProfEntry **fns = table_sorted(&funcs, by_self_time);
+    fprintf(out, "\nFunctions by self time\n");
+    fprintf(out, "%10s %12s %12s %12s %8s  %s\n", "calls", "total ms",
+            "self ms", "cpu ms", "forks", "function");
+    for (size_t i = 0; i < funcs.count; i++) {
+        ProfEntry *e = fns[i];
+        fprintf(out, "%10lu %12.3f %12.3f %12.3f %8lu  %s\n", e->count,
+                e->wall * 1e3, e->self_wall * 1e3, e->cpu * 1e3, e->forks,
+                e->name);
+    }
+    free(fns);
+
+    ProfEntry **ls = table_sorted(&lines, by_line_time);
+    fprintf(out, "\nLines by self time\n");
+    fprintf(out, "%10s %12s %12s %8s %10s  %s\n", "count", "self ms",
+            "cpu ms", "forks", "iters", "line");
+    for (size_t i = 0; i < lines.count; i++) {
+        ProfEntry *e = ls[i];
+        fprintf(out, "%10lu %12.3f %12.3f %8lu %10lu  %s:%d\n", e->count,
+                e->wall * 1e3, e->cpu * 1e3, e->forks, e->iters, e->name,
+                e->line);
+    }
+    free(ls);
+}
+
+static void write_folded(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    for (size_t i = 0; i < stacks.nslots; i++) {
+        ProfEntry *e = stacks.slots[i];
+        unsigned long us = e ? (unsigned long)(e->wall * 1e6 + 0.5) : 0;
+        if (us)
+            fprintf(f, "%s %lu\n", e->name, us);
+    }
+    fclose(f);
+}
+
+/* Close whatever is still open, as when `exit` runs inside a function,
+ * and write the results.  Forked subshells inherit the handler but only
+ * the shell that started profiling reports. */
+static void profile_finish(void) {
+    if (getpid() != owner)
+        return;
+    while (current) {
+        while (nframes > current->frames)
+            profile_return();
+        profile_leave(current);
+    }
+    while (nframes > 1)
+        profile_return();
+    if (report_path) {
+        FILE *out = fopen(report_path, "w");
+        if (!out) {
+            perror(report_path);
+            return;
+        }
+        write_report(out);
+        fclose(out);
+        char *folded;
+        if (xasprintf(&folded, "%s.folded", report_path) >= 0) {
+            write_folded(folded);
+            free(folded);
+        }
+    } else {
+        write_report(stderr);
+    }
+}
+
+void profile_start(void) {
+    if (started)
+        return;
+    started = 1;
+    owner = getpid();
+    const char *path = get_shell_var("VUSH_PROFILE");
+    if (!path)
+        path = get_env_var("VUSH_PROFILE");
+    if (path && *path)
+        report_path = xstrdup(path);
+    strbuf_init(&stack_text, 64);
+    start_wall = wall_now();
+    start_cpu = cpu_now();
+    start_forks = fork_count;
+    push_frame(NULL);
+    atexit(profile_finish);
+}
+
+void profile_enter(ProfileMark *mark, Command *cmd) {
+    memset(mark, 0, sizeof(*mark));
+    if (!started)
+        return;
+    mark->active = 1;
+    mark->lineno = cmd->lineno ? cmd->lineno : current_lineno;
+    mark->frames = nframes;
+    mark->outer = current;
+    mark->wall = wall_now();
+    mark->cpu = cpu_now();
+    mark->forks = fork_count;
+    current = mark;
+}
+
+void profile_leave(ProfileMark *mark) {
+    if (!mark->active)
+        return;
+    mark->active = 0;
+    double wall = wall_now() - mark->wall;
+    double cpu = cpu_now() - mark->cpu;
+    unsigned long forks = fork_count - mark->forks;
+    current = mark->outer;
+    if (current) {
+        current->nested_wall += wall;
+        current->nested_cpu += cpu;
+        current->nested_forks += forks;
+    }
+    double self_wall = wall - mark->nested_wall;
+    double self_cpu = cpu - mark->nested_cpu;
+    unsigned long self_forks = forks - mark->nested_forks;
+
+    ProfEntry *fn = frames[nframes - 1].fn;
+    ProfEntry *e = table_get(&lines, fn ? fn->name : "main", mark->lineno);
+    e->count++;
+    e->iters += mark->iters;
+    e->wall += self_wall;
+    e->cpu += self_cpu;
+    e->forks += self_forks;
+    if (fn) {
+        fn->self_wall += self_wall;
+        fn->self_cpu += self_cpu;
+    }
+
+    size_t len = stack_text.len;
+    char leaf[32];
+    snprintf(leaf, sizeof(leaf), ";line %d", mark->lineno);
+    strbuf_appends(&stack_text, leaf);
+    table_get(&stacks, stack_text.data, 0)->wall += self_wall;
+    stack_truncate(len);
+}
+
+void profile_iteration(void) {
+    if (current)
+        current->iters++;
+}
+
+void profile_call(const char *name) {
+    if (!started)
+        return;
+    ProfEntry *fn = table_get(&funcs, name, 0);
+    fn->count++;
+    fn->depth++;
+    push_frame(fn);
+}
+
+void profile_return(void) {
+    if (nframes <= 1)
+        return;
+    ProfFrame *f = &frames[--nframes];
+    ProfEntry *fn = f->fn;
+    if (--fn->depth == 0) {
+        fn->wall += wall_now() - f->wall;
+        fn->cpu += cpu_now() - f->cpu;
+        fn->forks += fork_count - f->forks;
+    }
+    stack_truncate(f->stack_len);
+}
@@ -0,0 +1,42 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Script profiler.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "parser.h"
+
+/*
+ * State of one command being timed.  run_pipeline() keeps it on its stack
+ * so nested commands can subtract their time from the enclosing one.
+ */
+typedef struct ProfileMark {
+    struct ProfileMark *outer;
+    int active;             /* profiling was on when the command started */
+    int lineno;
+    int frames;             /* function frames open at the start */
+    double wall;            /* clocks and fork count at the start */
+    double cpu;
+    unsigned long forks;
+    double nested_wall;     /* spent in commands run from this one */
+    double nested_cpu;
+    unsigned long nested_forks;
+    unsigned long iters;    /* loop iterations */
+} ProfileMark;
+
+/* Start collecting data and arrange for the report to be written when the
+ * shell exits.  Does nothing when already started. */
+void profile_start(void);
+/* Begin timing CMD.  MARK must stay valid until profile_leave(). */
+void profile_enter(ProfileMark *mark, Command *cmd);
+void profile_leave(ProfileMark *mark);
+/* Count one iteration of the loop being timed. */
+void profile_iteration(void);
+/* Attribute the commands run until profile_return() to function NAME. */
+void profile_call(const char *name);
+void profile_return(void);
+
+#endif /* PROFILE_H */
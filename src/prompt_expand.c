@@ -9,6 +9,7 @@
 #include "var_expand.h"
 #include "lexer.h"
 #include "parser.h" /* for MAX_LINE */
+#include "vars.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,7 +35,7 @@ char *expand_prompt(const char *prompt) {
     int quoted = 0;
     int do_expand = 1;
     char *res = read_token(&p, &quoted, &do_expand);
-    if (getenv("VUSH_DEBUG"))
+    if (get_env_var("VUSH_DEBUG"))
         fprintf(stderr, "expand_prompt token='%s' de=%d\n", res ? res : "", do_expand);
     free(tmp);
     if (!res)
@@ -49,7 +50,7 @@ char *expand_prompt(const char *prompt) {
             free(res);
             return strdup("");
         }
-        if (getenv("VUSH_DEBUG"))
+        if (get_env_var("VUSH_DEBUG"))
             fprintf(stderr, "expand_prompt result='%s'\n", out);
         free(res);
         res = out;
@@ -7,28 +7,96 @@
 /*
  * Redirection helpers for builtins and child processes.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 
 #include "redir.h"
 #include "util.h"
 
+/* Write all LEN bytes of BUF to FD.  Returns 0 or -1 on error. */
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int here_doc_fd(const char *text) {
+    size_t len = strlen(text);
+    int fd;
+    if (len <= PIPE_BUF) {
+        /* an empty pipe always holds PIPE_BUF bytes without blocking */
+        int pfd[2];
+        if (pipe(pfd) < 0)
+            return -1;
+        if (write_all(pfd[1], text, len) < 0) {
+            close(pfd[0]);
+            close(pfd[1]);
+            return -1;
+        }
+        close(pfd[1]);
+        return pfd[0];
+    }
+    fd = -1;
+#ifdef HAVE_MEMFD_CREATE
+    fd = memfd_create("vush-heredoc", MFD_CLOEXEC);
+#endif
+    if (fd < 0) {
+        FILE *f = tmpfile();
+        if (!f)
+            return -1;
+        fd = fcntl(fileno(f), F_DUPFD_CLOEXEC, 0);
+        fclose(f);
+        if (fd < 0)
+            return -1;
+    }
+    if (write_all(fd, text, len) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Open the input redirection of SEG.  Returns a descriptor or -1 after
+ * printing a diagnostic. */
+static int open_input(PipelineSegment *seg) {
+    if (seg->here_doc) {
+        int fd = here_doc_fd(seg->here_text);
+        if (fd < 0)
+            perror("here-document");
+        return fd;
+    }
+    int fd = open(seg->in_file, O_RDONLY);
+    if (fd < 0)
+        perror(seg->in_file);
+    return fd;
+}
+
 /* Apply redirections in the current shell process and
  * save the original descriptors in SV for restoration. */
 int apply_redirs_shell(PipelineSegment *seg, struct redir_save *sv) {
     sv->in = sv->out = sv->err = -1;
-    if (seg->in_file) {
+    if (seg->in_file || seg->here_doc) {
         sv->in = dup(seg->in_fd);
-        int fd = open(seg->in_file, O_RDONLY);
-        if (fd < 0) {
-            perror(seg->in_file);
+        int fd = open_input(seg);
+        if (fd < 0)
             return -1;
-        }
-        if (seg->here_doc)
-            unlink(seg->in_file);
         dup2(fd, seg->in_fd);
         close(fd);
     }
@@ -106,14 +174,10 @@ void redirect_fd(int fd, int dest) {
 
 /* Apply pending redirections in a child process. */
 void setup_redirections(PipelineSegment *seg) {
-    if (seg->in_file) {
-        int fd = open(seg->in_file, O_RDONLY);
-        if (fd < 0) {
-            perror(seg->in_file);
+    if (seg->in_file || seg->here_doc) {
+        int fd = open_input(seg);
+        if (fd < 0)
             exit(1);
-        }
-        if (seg->here_doc)
-            unlink(seg->in_file);
         redirect_fd(fd, seg->in_fd);
     }
 
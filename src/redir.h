@@ -14,6 +14,12 @@ struct redir_save { int in, out, err; };
 int apply_redirs_shell(PipelineSegment *seg, struct redir_save *sv);
 void restore_redirs_shell(PipelineSegment *seg, struct redir_save *sv);
 void redirect_fd(int fd, int dest);
+/*
+ * Return a descriptor reading the here-document TEXT from its start.
+ * Bodies up to PIPE_BUF bytes are delivered through a pipe, larger ones
+ * through an anonymous memory file.  Returns -1 with errno set on error.
+ */
+int here_doc_fd(const char *text);
 void setup_redirections(PipelineSegment *seg);
 
 #endif /* REDIR_H */
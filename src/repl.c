@@ -26,85 +26,241 @@
 #include "vars.h"
 
 
+/* Reap finished children and run any traps that fired. */
+static void reap_and_run_traps(void)
+{
+    process_pending_traps();
+    if (opt_monitor)
+        check_jobs();
+    else
+        while (waitpid(-1, NULL, WNOHANG) > 0)
+            ;
+}
+
+/* Execute the commands in CMDS honouring && and || between them. */
+static void run_command_line(Command *cmds, const char *line)
+{
+    CmdOp prev = OP_SEMI;
+    for (Command *c = cmds; c; c = c->next) {
+        int run = 1;
+        if (c != cmds) {
+            if (prev == OP_AND)
+                run = (last_status == 0);
+            else if (prev == OP_OR)
+                run = (last_status != 0);
+        }
+        if (run)
+            run_pipeline(c, line);
+        prev = c->op;
+    }
+}
+
+/* Read all of INPUT into a NUL terminated buffer.  Returns NULL on error. */
+static char *read_script(FILE *input)
+{
+    size_t cap = 8192, len = 0;
+    char *buf = malloc(cap);
+    if (!buf) {
+        perror("malloc");
+        return NULL;
+    }
+    size_t n;
+    while ((n = fread(buf + len, 1, cap - len - 1, input)) > 0) {
+        len += n;
+        if (cap - len - 1 == 0) {
+            char *tmp = realloc(buf, cap * 2);
+            if (!tmp) {
+                perror("realloc");
+                free(buf);
+                return NULL;
+            }
+            buf = tmp;
+            cap *= 2;
+        }
+    }
+    if (ferror(input)) {
+        perror("read");
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+/*
+ * Move the next logical line of the script at parse_script to DST, which
+ * lies in the same buffer at or before parse_script.  Backslash
+ * continuations are joined like read_logical_line() does.  Returns the
+ * terminating NUL of the line or NULL at the end of the script.
+ */
+static char *next_script_line(char *dst)
+{
+    char *src = parse_script;
+    if (!*src)
+        return NULL;
+    char *start = dst;
+    while (1) {
+        while (*src && *src != '\n' && *src != '\r')
+            *dst++ = *src++;
+        if (*src == '\r' && src[1] == '\n')
+            src += 2;
+        else if (*src)
+            src++;
+        if (dst == start || dst[-1] != '\\' || !*src)
+            break;
+        while (dst > start && dst[-1] == '\\')
+            dst--;
+    }
+    *dst = '\0';
+    parse_script = src;
+    return dst;
+}
+
+/*
+ * Execute the script read from INPUT.  The file is loaded into memory
+ * once and each command is parsed in place, so script lines have no
+ * length limit and constructs spanning several lines are extended inside
+ * the buffer instead of being copied together.  Commands are still parsed
+ * one at a time because aliases and here-documents take effect while
+ * parsing.  HIST_EXPAND enables history expansion as for typed lines.
+ */
+void run_script(FILE *input, int hist_expand)
+{
+    char *script = read_script(input);
+    if (!script)
+        return;
+    FILE *prev_input = parse_input;
+    char *prev_script = parse_script;
+    parse_script = script;
+
+    while (1) {
+        reap_and_run_traps();
+        char *line = parse_script;
+        char *end = next_script_line(line);
+        if (!end) {
+            if (process_pending_traps())
+                continue;
+            break;
+        }
+        current_lineno++;
+        if (opt_verbose)
+            printf("%s\n", line);
+
+        while (1) {
+            char *expanded = hist_expand ? expand_history(line) : line;
+            if (!expanded)
+                break;
+
+            parse_input = NULL;
+            Command *cmds = parse_line(expanded);
+            if (parse_need_more) {
+                free_commands(cmds);
+                if (expanded != line)
+                    free(expanded);
+                /* continue the command with the following line */
+                char *more = end + 1;
+                *end = '\n';
+                end = next_script_line(more);
+                if (!end) {
+                    if (any_pending_traps())
+                        process_pending_traps();
+                    break;
+                }
+                current_lineno++;
+                if (opt_verbose)
+                    printf("%s\n", more);
+                continue;
+            }
+
+            if (cmds) {
+                add_history(line);
+                run_command_line(cmds, expanded);
+            }
+            free_commands(cmds);
+            if (expanded != line)
+                free(expanded);
+            if (cmds)
+                process_pending_traps();
+            break;
+        }
+
+        if (opt_onecmd)
+            break;
+    }
+
+    parse_input = prev_input;
+    parse_script = prev_script;
+    free(script);
+}
+
 /*
  * Main read-eval-print loop driving interactive and script execution.
- * When INPUT is stdin the shell behaves interactively, otherwise it
- * reads and executes commands from the given stream until EOF.
+ * When INPUT is stdin the shell behaves interactively, otherwise the
+ * stream is run as a script by run_script().
  */
 void repl_loop(FILE *input)
 {
-    char linebuf[MAX_LINE];
     char *line;
-    int interactive = (input == stdin);
     int eof_count = 0;
 
+    if (input != stdin) {
+        run_script(input, 1);
+        return;
+    }
+
     while (1) {
-        process_pending_traps();
-        if (opt_monitor)
-            check_jobs();
+        reap_and_run_traps();
+        check_mail();
+        /* write the previous commands while waiting for the next one */
+        history_flush();
+        const char *ps = get_shell_var("PS1");
+        if (!ps)
+            ps = get_env_var("PS1");
+        char *prompt = expand_prompt(ps ? ps : "vush> ");
+        jobs_at_prompt = 1;
+        check_jobs();
+        if (jobs_at_prompt)
+            line = line_edit(prompt);
         else
-            while (waitpid(-1, NULL, WNOHANG) > 0)
-                ;
-        if (interactive) {
-            check_mail();
-            const char *ps = get_shell_var("PS1");
-            if (!ps)
-                ps = getenv("PS1");
-            char *prompt = expand_prompt(ps ? ps : "vush> ");
-            jobs_at_prompt = 1;
-            check_jobs();
-            if (jobs_at_prompt)
-                line = line_edit(prompt);
-            else
-                line = line_edit("");
-            jobs_at_prompt = 0;
-            free(prompt);
-            if (!line) {
-                if (jobs_changed) {
-                    jobs_at_prompt = 1;
-                    if (check_jobs_internal(1) && jobs_at_prompt) {
-                        const char *ps = getenv("PS1");
-                        printf("%s", ps ? ps : "vush> ");
-                        fflush(stdout);
-                        jobs_at_prompt = 0;
-                    } else {
-                        jobs_at_prompt = 0;
-                    }
-                    jobs_changed = 0;
-                    continue;
-                }
-                if (any_pending_traps()) {
-                    printf("\n");
-                    process_pending_traps();
-                    continue;
-                }
-                if (opt_ignoreeof) {
-                    eof_count++;
-                    if (eof_count < 10) {
-                        printf("\nUse \"exit\" to leave the shell.\n");
-                        continue;
-                    }
+            line = line_edit("");
+        jobs_at_prompt = 0;
+        free(prompt);
+        if (!line) {
+            if (jobs_changed) {
+                jobs_at_prompt = 1;
+                if (check_jobs_internal(1) && jobs_at_prompt) {
+                    const char *ps = get_env_var("PS1");
+                    printf("%s", ps ? ps : "vush> ");
+                    fflush(stdout);
+                    jobs_at_prompt = 0;
+                } else {
+                    jobs_at_prompt = 0;
                 }
-                break;
+                jobs_changed = 0;
+                continue;
+            }
+            if (any_pending_traps()) {
+                printf("\n");
+                process_pending_traps();
+                continue;
             }
-            eof_count = 0;
-            current_lineno++;
-        } else {
-            if (!read_logical_line(input, linebuf, sizeof(linebuf))) {
-                if (process_pending_traps())
+            if (opt_ignoreeof) {
+                eof_count++;
+                if (eof_count < 10) {
+                    printf("\nUse \"exit\" to leave the shell.\n");
                     continue;
-                break;
+                }
             }
-            current_lineno++;
-            line = linebuf;
+            break;
         }
+        eof_count = 0;
+        current_lineno++;
 
         if (opt_verbose)
             printf("%s\n", line);
 
         char *cmdline = strdup(line);
-        if (line != linebuf)
-            free(line);
+        free(line);
         if (!cmdline) {
             perror("strdup");
             break;
@@ -123,47 +279,34 @@ void repl_loop(FILE *input)
             if (parse_need_more) {
                 free_commands(cmds);
                 free(expanded);
-                const char *ps2 = getenv("PS2");
-                char *more = NULL;
-                if (interactive) {
-                    char *p2 = expand_prompt(ps2 ? ps2 : "> ");
-                    jobs_at_prompt = 1;
-                    more = line_edit(p2);
-                    jobs_at_prompt = 0;
-                    free(p2);
-                    if (!more) {
-                        if (jobs_changed) {
-                            jobs_at_prompt = 1;
-                            if (check_jobs_internal(1) && jobs_at_prompt) {
-                                const char *ps = getenv("PS1");
-                                printf("%s", ps ? ps : "vush> ");
-                                fflush(stdout);
-                                jobs_at_prompt = 0;
-                            } else {
-                                jobs_at_prompt = 0;
-                            }
-                            jobs_changed = 0;
-                        }
-                        free(cmdline);
-                        cmdline = NULL;
-                        if (any_pending_traps()) {
-                            printf("\n");
-                            process_pending_traps();
+                const char *ps2 = get_env_var("PS2");
+                char *p2 = expand_prompt(ps2 ? ps2 : "> ");
+                jobs_at_prompt = 1;
+                char *more = line_edit(p2);
+                jobs_at_prompt = 0;
+                free(p2);
+                if (!more) {
+                    if (jobs_changed) {
+                        jobs_at_prompt = 1;
+                        if (check_jobs_internal(1) && jobs_at_prompt) {
+                            const char *ps = get_env_var("PS1");
+                            printf("%s", ps ? ps : "vush> ");
+                            fflush(stdout);
+                            jobs_at_prompt = 0;
+                        } else {
+                            jobs_at_prompt = 0;
                         }
-                        break;
+                        jobs_changed = 0;
                     }
-                    current_lineno++;
-                } else {
-                    if (!read_logical_line(input, linebuf, sizeof(linebuf))) {
-                        free(cmdline);
-                        cmdline = NULL;
-                        if (any_pending_traps())
-                            process_pending_traps();
-                        break;
+                    free(cmdline);
+                    cmdline = NULL;
+                    if (any_pending_traps()) {
+                        printf("\n");
+                        process_pending_traps();
                     }
-                    current_lineno++;
-                    more = strdup(linebuf);
+                    break;
                 }
+                current_lineno++;
                 if (opt_verbose)
                     printf("%s\n", more);
                 size_t len1 = strlen(cmdline);
@@ -196,20 +339,7 @@ void repl_loop(FILE *input)
             }
 
             add_history(cmdline);
-
-            CmdOp prev = OP_SEMI;
-            for (Command *c = cmds; c; c = c->next) {
-                int run = 1;
-                if (c != cmds) {
-                    if (prev == OP_AND)
-                        run = (last_status == 0);
-                    else if (prev == OP_OR)
-                        run = (last_status != 0);
-                }
-                if (run)
-                    run_pipeline(c, expanded);
-                prev = c->op;
-            }
+            run_command_line(cmds, expanded);
             free_commands(cmds);
             free(expanded);
             process_pending_traps();
@@ -221,4 +351,3 @@ void repl_loop(FILE *input)
             break;
     }
 }
-
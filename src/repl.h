@@ -13,5 +13,10 @@
  * commands.  When INPUT is stdin the shell runs interactively.
  */
 void repl_loop(FILE *input);
+/*
+ * Load the script in INPUT into memory and execute it.  History expansion
+ * is applied to each command when HIST_EXPAND is non-zero.
+ */
+void run_script(FILE *input, int hist_expand);
 
 #endif /* REPL_H */
@@ -34,6 +34,9 @@ typedef struct ShellState {
     int opt_onecmd;
     int opt_hashall;
     int opt_keyword;
+    int opt_globstar;
+    int opt_profile;
+    int opt_histrank;
     int current_lineno;
     pid_t parent_pid;
 } ShellState;
@@ -0,0 +1,144 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Internal counters reported by the vushstat builtin.
+ */
+
+/*
+ * Most counters are plain fields bumped by the shell process.  Commands
+ * are executed and looked up in the command hash by forked children, so
+ * those counters live in an anonymous page shared with every child and
+ * are updated atomically.  Work done by subshells therefore counts towards
+ * execs, fexecve and hash lookups but not towards the per-process fields.
+ *
+ * When the linker supports --wrap the Makefile routes the shell's own
+ * malloc(), calloc(), realloc(), strdup() and strndup() calls through the
+ * wrappers below and defines HAVE_ALLOC_WRAP.  Allocations made inside the
+ * C library are not counted.
+ *
+ * Resetting only records the current values; reports subtract them so the
+ * profiler, which reads fork_count, is not disturbed.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+#include "cmd_subst.h"
+#include "util.h"
+
+typedef struct {
+    unsigned long execs;
+    unsigned long fexecve;
+    unsigned long hash_hits;
+    unsigned long hash_misses;
+} SharedStats;
+
+ShellStats shell_stats;
+
+static SharedStats local_shared;
+static SharedStats *shared = &local_shared;
+
+const char *const stats_names[] = {
+    "forks", "execs", "fexecve", "parses", "parse_bytes", "hash_hits",
+    "hash_misses", "var_lookups", "cmd_substs", "globs",
+#ifdef HAVE_ALLOC_WRAP
+    "allocs",
+#endif
+    NULL
+};
+
+#define NSTATS (sizeof(stats_names) / sizeof(stats_names[0]) - 1)
+
+static unsigned long baseline[NSTATS];
+
+#define SHARED_INC(field) __atomic_add_fetch(&shared->field, 1, __ATOMIC_RELAXED)
+
+void stats_init(void) {
+    void *p = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return;
+    memcpy(p, shared, sizeof(*shared));
+    shared = p;
+}
+
+void stats_exec(int via_fd) {
+    SHARED_INC(execs);
+    if (via_fd)
+        SHARED_INC(fexecve);
+}
+
+void stats_hash_lookup(int hit) {
+    if (hit)
+        SHARED_INC(hash_hits);
+    else
+        SHARED_INC(hash_misses);
+}
+
+/* Current raw value of counter number IDX in stats_names. */
+static unsigned long raw_value(size_t idx) {
+    switch (idx) {
+    case 0: return fork_count;
+    case 1: return __atomic_load_n(&shared->execs, __ATOMIC_RELAXED);
+    case 2: return __atomic_load_n(&shared->fexecve, __ATOMIC_RELAXED);
+    case 3: return shell_stats.parses;
+    case 4: return shell_stats.parse_bytes;
+    case 5: return __atomic_load_n(&shared->hash_hits, __ATOMIC_RELAXED);
+    case 6: return __atomic_load_n(&shared->hash_misses, __ATOMIC_RELAXED);
+    case 7: return shell_stats.var_lookups;
+    case 8: return command_output_count;
+    case 9: return shell_stats.globs;
+    case 10: return shell_stats.allocs;
+    }
+    return 0;
+}
+
+int stats_get(const char *name, unsigned long *out) {
+    for (size_t i = 0; i < NSTATS; i++) {
+        if (strcmp(stats_names[i], name) == 0) {
+            *out = raw_value(i) - baseline[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void stats_reset(void) {
+    for (size_t i = 0; i < NSTATS; i++)
+        baseline[i] = raw_value(i);
+}
+
+#ifdef HAVE_ALLOC_WRAP
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+
+void *__wrap_malloc(size_t size) {
+    shell_stats.allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    shell_stats.allocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    shell_stats.allocs++;
+    return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s) {
+    shell_stats.allocs++;
+    return __real_strdup(s);
+}
+
+char *__wrap_strndup(const char *s, size_t n) {
+    shell_stats.allocs++;
+    return __real_strndup(s, n);
+}
+#endif
@@ -0,0 +1,42 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Internal counters reported by the vushstat builtin.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+/* Counters kept by the shell process itself.  Forks and command
+ * substitutions are read from fork_count and command_output_count. */
+typedef struct {
+    unsigned long parses;       /* parse_line() calls */
+    unsigned long parse_bytes;  /* bytes handed to parse_line() */
+    unsigned long var_lookups;
+    unsigned long globs;        /* glob_expand() calls */
+    unsigned long allocs;       /* malloc, calloc, realloc, strdup, strndup */
+} ShellStats;
+
+extern ShellStats shell_stats;
+
+/* Set to 1 when the build counts allocations; see stats.c. */
+extern const int stats_count_allocs;
+
+/* Map the page shared with child processes.  Call before the first fork. */
+void stats_init(void);
+/* Count an external command about to be executed, and whether it goes
+ * through the descriptor kept by the command hash.  Also called from
+ * forked children. */
+void stats_exec(int via_fd);
+/* Count a command hash lookup that found (HIT) or missed its entry. */
+void stats_hash_lookup(int hit);
+
+/* Counter names in report order. */
+extern const char *const stats_names[];
+/* Store the value of counter NAME since the last reset in *OUT.
+ * Returns -1 for an unknown name. */
+int stats_get(const char *name, unsigned long *out);
+/* Start counting from zero again. */
+void stats_reset(void);
+
+#endif /* STATS_H */
@@ -0,0 +1,65 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Growable string buffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "strbuf.h"
+#include "util.h"
+
+void strbuf_init(StrBuf *sb, size_t hint) {
+    sb->cap = hint < 16 ? 16 : hint + 1;
+    sb->data = xmalloc(sb->cap);
+    sb->data[0] = '\0';
+    sb->len = 0;
+}
+
+/* Make room for N more bytes and the terminator. */
+static void strbuf_reserve(StrBuf *sb, size_t n) {
+    if (sb->len + n < sb->cap)
+        return;
+    size_t cap = sb->cap;
+    while (sb->len + n >= cap)
+        cap *= 2;
+    char *tmp = realloc(sb->data, cap);
+    if (!tmp) {
+        perror("realloc");
+        exit(1);
+    }
+    sb->data = tmp;
+    sb->cap = cap;
+}
+
+void strbuf_append(StrBuf *sb, const char *s, size_t n) {
+    strbuf_reserve(sb, n);
+    memcpy(sb->data + sb->len, s, n);
+    sb->len += n;
+    sb->data[sb->len] = '\0';
+}
+
+void strbuf_appends(StrBuf *sb, const char *s) {
+    strbuf_append(sb, s, strlen(s));
+}
+
+void strbuf_appendc(StrBuf *sb, char c) {
+    strbuf_reserve(sb, 1);
+    sb->data[sb->len++] = c;
+    sb->data[sb->len] = '\0';
+}
+
+char *strbuf_finish(StrBuf *sb) {
+    char *res = sb->data;
+    sb->data = NULL;
+    sb->len = sb->cap = 0;
+    return res;
+}
+
+void strbuf_release(StrBuf *sb) {
+    free(sb->data);
+    sb->data = NULL;
+    sb->len = sb->cap = 0;
+}
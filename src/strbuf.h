@@ -0,0 +1,30 @@
+/*
+ * vush - a simple UNIX shell
+ * Licensed under the BSD 2-Clause Simplified License.
+ * Growable string buffer.
+ */
+
+#ifndef STRBUF_H
+#define STRBUF_H
+
+#include <stddef.h>
+
+/* A NUL terminated string whose capacity doubles as it grows. */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+/* Prepare SB with room for at least HINT bytes.  Exits when memory runs
+ * out, as do the append functions. */
+void strbuf_init(StrBuf *sb, size_t hint);
+/* Append the N bytes at S. */
+void strbuf_append(StrBuf *sb, const char *s, size_t n);
+void strbuf_appends(StrBuf *sb, const char *s);
+void strbuf_appendc(StrBuf *sb, char c);
+/* Return the malloc'd string and leave SB empty. */
+char *strbuf_finish(StrBuf *sb);
+void strbuf_release(StrBuf *sb);
+
+#endif /* STRBUF_H */
@@ -20,6 +20,7 @@
 #include "options.h"
 #include "parser.h" /* for MAX_LINE */
 #include "util.h"
+#include "vars.h"
 
 /* calloc wrapper that exits on allocation failure */
 void *xcalloc(size_t nmemb, size_t size) {
@@ -51,6 +52,24 @@ char *xstrdup(const char *s) {
     return ptr;
 }
 
+/* strndup wrapper that exits on allocation failure */
+char *xstrndup(const char *s, size_t n) {
+    char *ptr = strndup(s, n);
+    if (!ptr) {
+        perror("strndup");
+        exit(1);
+    }
+    return ptr;
+}
+
+/* FNV-1a hash of a NUL terminated string */
+size_t hash_string(const char *s) {
+    size_t h = 2166136261u;
+    for (; *s; s++)
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
 /*
  * Portable wrapper around asprintf.  Allocates a formatted string
  * into *STRP and returns its length or -1 on error.  Uses system
@@ -170,16 +189,16 @@ int open_redirect(const char *path, int append, int force) {
 char *make_user_path(const char *env_var, const char *secondary,
                      const char *default_name) {
     if (env_var) {
-        const char *val = getenv(env_var);
+        const char *val = get_env_var(env_var);
         if (val && *val)
             return strdup(val);
     }
     if (secondary) {
-        const char *val = getenv(secondary);
+        const char *val = get_env_var(secondary);
         if (val && *val)
             return strdup(val);
     }
-    const char *home = getenv("HOME");
+    const char *home = get_env_var("HOME");
     if (!home || !*home) {
         struct passwd *pw = getpwuid(getuid());
         if (pw && pw->pw_dir && *pw->pw_dir)
@@ -224,3 +243,12 @@ size_t get_path_max(void) {
         pm = PATH_MAX;
     return (size_t)pm + 1; /* include terminating null */
 }
+
+unsigned long fork_count;
+
+pid_t shell_fork(void) {
+    pid_t pid = fork();
+    if (pid > 0)
+        fork_count++;
+    return pid;
+}
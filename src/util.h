@@ -12,6 +12,7 @@
 #ifndef VUSH_UTIL_H
 #define VUSH_UTIL_H
 #include <stdio.h>
+#include <sys/types.h>
 /* Reads a logical line from FILE, merging backslash continuations.
  * Returns the buffer on success or NULL on EOF or error. */
 char *read_logical_line(FILE *f, char *buf, size_t size);
@@ -35,10 +36,19 @@ void *xcalloc(size_t nmemb, size_t size);
 void *xmalloc(size_t size);
 /* strdup that terminates the program when memory cannot be allocated. */
 char *xstrdup(const char *s);
+/* strndup that terminates the program when memory cannot be allocated. */
+char *xstrndup(const char *s, size_t n);
+/* FNV-1a hash of the string S, shared by the shell's hash tables. */
+size_t hash_string(const char *s);
 /* asprintf wrapper using system implementation when available.
  * Returns the number of bytes written or -1 on failure. */
 int xasprintf(char **strp, const char *fmt, ...);
 /* Return the system PATH_MAX using pathconf when available, falling back
  * to the compile time PATH_MAX constant. */
 size_t get_path_max(void);
+/* Child processes started by this shell process with fork() or
+ * posix_spawn(). */
+extern unsigned long fork_count;
+/* fork() and count the child in fork_count. */
+pid_t shell_fork(void);
 #endif /* VUSH_UTIL_H */
@@ -7,9 +7,14 @@
 #ifndef VAR_EXPAND_H
 #define VAR_EXPAND_H
 
+#include "arena.h"
+
 char *expand_var(const char *token);
 char *ansi_unescape(const char *src);
 char *expand_simple(const char *token);
-char **split_fields(const char *text, int *count);
+/* Split the malloc'd string TEXT at the characters of IFS.  TEXT is handed
+ * to ARENA and the fields point into it; the NULL terminated array holding
+ * them is allocated from ARENA too. */
+char **split_fields(char *text, int *count, Arena *arena);
 
 #endif /* VAR_EXPAND_H */
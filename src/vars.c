@@ -4,6 +4,24 @@
  * Shell variable storage and lookup.
  */
 
+/*
+ * Shell variables live in an open addressing hash table keyed by name.
+ * Each entry carries its readonly and export attributes, so assignments
+ * and lookups cost one probe sequence regardless of how many variables
+ * exist.  An entry may hold neither a scalar nor an array value when it
+ * only records attributes, e.g. after `readonly NAME` on an unset name.
+ *
+ * While a checkpoint is active the first change to each variable saves its
+ * previous state to an undo log so commands run in-process on behalf of a
+ * subshell can be rolled back.  Entries remember the checkpoint that saved
+ * them, so a loop assigning the same variable adds a single record.
+ *
+ * The table is also the shell's environment.  Variables inherited at start
+ * up are imported with the export attribute and the shell never calls
+ * setenv().  Each change that affects an exported variable bumps a
+ * generation counter; shell_environ() builds the NAME=value array for a
+ * child only when the generation moved since the last build.
+ */
 #define _GNU_SOURCE
 #include "vars.h"
 #include "options.h"
@@ -12,47 +30,299 @@
 #include <string.h>
 #include <unistd.h>
 #include "util.h"
+#include "stats.h"
 
 struct var_entry {
     char *name;
+    unsigned int hash;
     char *value;        /* scalar value or NULL when array is used */
     char **array;       /* NULL for scalar variables */
     int array_len;
-    struct var_entry *next;
+    int readonly;
+    int exported;
+    unsigned long undo_mark; /* checkpoint that saved this entry */
 };
 
-static struct var_entry *shell_vars = NULL;
+#define VAR_TABLE_MIN 64
 
-struct readonly_entry {
-    char *name;
-    struct readonly_entry *next;
-};
+/* Marks a slot whose entry was removed so probe chains stay intact. */
+static struct var_entry var_tombstone;
+#define VAR_TOMBSTONE (&var_tombstone)
 
-static struct readonly_entry *readonly_vars = NULL;
+static struct var_entry **var_slots = NULL;
+static size_t var_cap = 0;      /* number of slots, always a power of two */
+static size_t var_count = 0;    /* live entries */
+static size_t var_filled = 0;   /* live entries plus tombstones */
 
-static int is_readonly(const char *name)
+static unsigned long var_epoch = 1;      /* bumped when an entry is freed */
+static unsigned long env_generation = 1; /* bumped when the environment changes */
+static unsigned long undo_current = 0;   /* innermost checkpoint, 0 for none */
+static unsigned long undo_serial = 0;    /* last checkpoint number handed out */
+static unsigned long env_built = 0;      /* generation env_cache was built for */
+static char **env_cache = NULL;
+
+/* Return the entry for NAME or NULL when it does not exist. */
+static struct var_entry *var_lookup(const char *name)
+{
+    shell_stats.var_lookups++;
+    if (!var_cap)
+        return NULL;
+    unsigned int h = hash_string(name);
+    size_t mask = var_cap - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        struct var_entry *v = var_slots[i];
+        if (!v)
+            return NULL;
+        if (v != VAR_TOMBSTONE && v->hash == h && strcmp(v->name, name) == 0)
+            return v;
+    }
+}
+
+/* Rebuild the table with NEWCAP slots, dropping tombstones. */
+static int var_resize(size_t newcap)
 {
-    for (struct readonly_entry *r = readonly_vars; r; r = r->next) {
-        if (strcmp(r->name, name) == 0)
-            return 1;
+    struct var_entry **slots = calloc(newcap, sizeof(*slots));
+    if (!slots)
+        return -1;
+    size_t mask = newcap - 1;
+    for (size_t i = 0; i < var_cap; i++) {
+        struct var_entry *v = var_slots[i];
+        if (!v || v == VAR_TOMBSTONE)
+            continue;
+        size_t j = v->hash & mask;
+        while (slots[j])
+            j = (j + 1) & mask;
+        slots[j] = v;
     }
+    free(var_slots);
+    var_slots = slots;
+    var_cap = newcap;
+    var_filled = var_count;
     return 0;
 }
 
-void add_readonly(const char *name)
+/*
+ * Return the entry for NAME, creating an empty one when missing.
+ * NULL is returned when memory cannot be allocated.
+ */
+static struct var_entry *var_intern(const char *name)
 {
-    if (is_readonly(name))
-        return;
-    struct readonly_entry *r = malloc(sizeof(*r));
-    if (!r)
+    struct var_entry *v = var_lookup(name);
+    if (v)
+        return v;
+    /* keep the load factor including tombstones below 3/4 */
+    if ((var_filled + 1) * 4 > var_cap * 3) {
+        size_t newcap = var_cap ? var_cap : VAR_TABLE_MIN;
+        while ((var_count + 1) * 2 > newcap)
+            newcap *= 2;
+        if (var_resize(newcap) < 0) {
+            perror("calloc");
+            return NULL;
+        }
+    }
+    v = calloc(1, sizeof(*v));
+    if (!v) {
+        perror("calloc");
+        return NULL;
+    }
+    v->name = strdup(name);
+    if (!v->name) {
+        perror("strdup");
+        free(v);
+        return NULL;
+    }
+    v->hash = hash_string(name);
+    /* changes made under a checkpoint record the name before creating it */
+    v->undo_mark = undo_current;
+    size_t mask = var_cap - 1;
+    size_t i = v->hash & mask;
+    while (var_slots[i] && var_slots[i] != VAR_TOMBSTONE)
+        i = (i + 1) & mask;
+    if (!var_slots[i])
+        var_filled++;
+    var_slots[i] = v;
+    var_count++;
+    return v;
+}
+
+/* Release the value stored in V, leaving its attributes untouched. */
+static void var_clear_value(struct var_entry *v)
+{
+    free(v->value);
+    v->value = NULL;
+    if (v->array) {
+        for (int i = 0; i < v->array_len; i++)
+            free(v->array[i]);
+        free(v->array);
+        v->array = NULL;
+        v->array_len = 0;
+    }
+}
+
+/* Remove V from the table and free it. */
+static void var_delete(struct var_entry *v)
+{
+    if (v->exported)
+        env_generation++;
+    size_t mask = var_cap - 1;
+    for (size_t i = v->hash & mask;; i = (i + 1) & mask) {
+        if (var_slots[i] == v) {
+            var_slots[i] = VAR_TOMBSTONE;
+            break;
+        }
+    }
+    var_count--;
+    var_epoch++;
+    var_clear_value(v);
+    free(v->name);
+    free(v);
+}
+
+/* Prior state of a variable saved while a checkpoint is active.  Each
+ * checkpoint starts with a record whose NAME is NULL. */
+struct var_undo {
+    char *name;
+    int existed;
+    char *value;
+    char **array;
+    int array_len;
+    int readonly;
+    int exported;
+    unsigned long mark;     /* prior undo_mark, or undo_current for a checkpoint */
+    struct var_undo *next;
+};
+
+static struct var_undo *undo_log = NULL;
+
+/* Save the current state of NAME to the undo log unless the innermost
+ * checkpoint already holds it. */
+static void var_record(const char *name)
+{
+    if (!undo_current)
         return;
-    r->name = strdup(name);
-    if (!r->name) {
-        free(r);
+    struct var_entry *v = var_lookup(name);
+    if (v && v->undo_mark == undo_current)
         return;
+    struct var_undo *u = xcalloc(1, sizeof(*u));
+    u->name = xstrdup(name);
+    if (v) {
+        u->mark = v->undo_mark;
+        v->undo_mark = undo_current;
+        u->existed = 1;
+        u->value = v->value ? xstrdup(v->value) : NULL;
+        if (v->array) {
+            u->array = xcalloc(v->array_len ? v->array_len : 1, sizeof(char *));
+            for (int i = 0; i < v->array_len; i++)
+                u->array[i] = xstrdup(v->array[i]);
+            u->array_len = v->array_len;
+        }
+        u->readonly = v->readonly;
+        u->exported = v->exported;
+    }
+    u->next = undo_log;
+    undo_log = u;
+}
+
+void *checkpoint_shell_vars(void)
+{
+    struct var_undo *u = xcalloc(1, sizeof(*u));
+    u->mark = undo_current;
+    u->next = undo_log;
+    undo_log = u;
+    undo_current = ++undo_serial;
+    return u;
+}
+
+void rollback_shell_vars(void *mark)
+{
+    while (undo_log && undo_log != mark) {
+        struct var_undo *u = undo_log;
+        undo_log = u->next;
+        if (!u->name) {
+            /* a nested checkpoint left open */
+            undo_current = u->mark;
+            free(u);
+            continue;
+        }
+        struct var_entry *v = var_lookup(u->name);
+        if (!u->existed) {
+            if (v)
+                var_delete(v);
+        } else {
+            if (!v)
+                v = var_intern(u->name);
+            if (v) {
+                var_clear_value(v);
+                v->value = u->value;
+                v->array = u->array;
+                v->array_len = u->array_len;
+                v->readonly = u->readonly;
+                v->exported = u->exported;
+                v->undo_mark = u->mark;
+                u->value = NULL;
+                u->array = NULL;
+                u->array_len = 0;
+            }
+        }
+        free(u->value);
+        for (int i = 0; i < u->array_len; i++)
+            free(u->array[i]);
+        free(u->array);
+        free(u->name);
+        free(u);
+    }
+    if (undo_log) {
+        struct var_undo *u = undo_log;
+        undo_log = u->next;
+        undo_current = u->mark;
+        free(u);
+    }
+    env_generation++;
+}
+
+static int is_readonly(const char *name)
+{
+    struct var_entry *v = var_lookup(name);
+    return v && v->readonly;
+}
+
+void add_readonly(const char *name)
+{
+    var_record(name);
+    struct var_entry *v = var_intern(name);
+    if (v)
+        v->readonly = 1;
+}
+
+/* Compare two entries by name for qsort(). */
+static int cmp_var_entry(const void *a, const void *b)
+{
+    const struct var_entry *va = *(struct var_entry *const *)a;
+    const struct var_entry *vb = *(struct var_entry *const *)b;
+    return strcmp(va->name, vb->name);
+}
+
+/*
+ * Return a newly allocated array of the live entries sorted by name so
+ * listings are stable.  *COUNT receives the number of entries.
+ */
+static struct var_entry **sorted_entries(size_t *count)
+{
+    *count = 0;
+    struct var_entry **list = malloc((var_count ? var_count : 1) * sizeof(*list));
+    if (!list) {
+        perror("malloc");
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < var_cap; i++) {
+        struct var_entry *v = var_slots[i];
+        if (v && v != VAR_TOMBSTONE)
+            list[n++] = v;
     }
-    r->next = readonly_vars;
-    readonly_vars = r;
+    qsort(list, n, sizeof(*list), cmp_var_entry);
+    *count = n;
+    return list;
 }
 
 void print_array(const char *prefix, char **arr, int len)
@@ -68,34 +338,40 @@ void print_array(const char *prefix, char **arr, int len)
 
 void print_readonly_vars(void)
 {
-    for (struct readonly_entry *r = readonly_vars; r; r = r->next) {
-        const char *val = get_shell_var(r->name);
-        if (val) {
-            printf("readonly %s=%s\n", r->name, val);
+    size_t n;
+    struct var_entry **list = sorted_entries(&n);
+    if (!list)
+        return;
+    for (size_t i = 0; i < n; i++) {
+        struct var_entry *v = list[i];
+        if (!v->readonly)
+            continue;
+        if (v->value) {
+            printf("readonly %s=%s\n", v->name, v->value);
+        } else if (v->array) {
+            printf("readonly ");
+            print_array(v->name, v->array, v->array_len);
         } else {
-            int len = 0;
-            char **arr = get_shell_array(r->name, &len);
-            if (arr) {
-                printf("readonly ");
-                print_array(r->name, arr, len);
-            } else {
-                printf("readonly %s\n", r->name);
-            }
+            printf("readonly %s\n", v->name);
         }
     }
+    free(list);
 }
 
 void print_shell_vars(void)
 {
-    for (struct var_entry *v = shell_vars; v; v = v->next) {
-        if (v->array) {
+    size_t n;
+    struct var_entry **list = sorted_entries(&n);
+    if (!list)
+        return;
+    for (size_t i = 0; i < n; i++) {
+        struct var_entry *v = list[i];
+        if (v->array)
             print_array(v->name, v->array, v->array_len);
-        } else if (v->value) {
+        else if (v->value)
             printf("%s=%s\n", v->name, v->value);
-        } else {
-            printf("%s=\n", v->name);
-        }
     }
+    free(list);
 }
 
 struct local_var {
@@ -104,8 +380,7 @@ struct local_var {
     char **array;
     int array_len;
     int had_shell;
-    int had_env;
-    char *env_val;
+    int exported;
     struct local_var *next;
 };
 
@@ -146,13 +421,10 @@ void pop_local_scope(void) {
                 set_shell_array(v->name, v->array, v->array_len);
             else
                 set_shell_var(v->name, v->value);
+            set_var_exported(v->name, v->exported);
         } else {
             unset_shell_var(v->name);
         }
-        if (v->had_env)
-            setenv(v->name, v->env_val ? v->env_val : "", 1);
-        else
-            unsetenv(v->name);
         free(v->name);
         free(v->value);
         if (v->array) {
@@ -160,7 +432,6 @@ void pop_local_scope(void) {
                 free(v->array[i]);
             free(v->array);
         }
-        free(v->env_val);
         free(v);
     }
     free(f);
@@ -200,93 +471,91 @@ void record_local_var(const char *name) {
     } else {
         lv->had_shell = 0;
     }
-    const char *e = getenv(name);
-    if (e) {
-        lv->env_val = strdup(e);
-        if (lv->env_val) {
-            lv->had_env = 1;
-        } else {
-            /* if strdup fails, pretend there was no env value so we unset */
-            lv->had_env = 0;
-        }
-    } else {
-        lv->had_env = 0;
-    }
+    struct var_entry *e = var_lookup(name);
+    lv->exported = e && e->exported;
     lv->next = local_stack->vars;
     local_stack->vars = lv;
 }
 
-const char *get_shell_var(const char *name) {
-    for (struct var_entry *v = shell_vars; v; v = v->next) {
-        if (strcmp(v->name, name) == 0) {
-            if (v->value)
-                return v->value;
-            if (v->array && v->array_len > 0)
-                return v->array[0];
-            return NULL;
-        }
-    }
+/* Return the scalar value of V or the first element of its array. */
+static const char *var_value(const struct var_entry *v)
+{
+    if (!v)
+        return NULL;
+    if (v->value)
+        return v->value;
+    if (v->array && v->array_len > 0)
+        return v->array[0];
     return NULL;
 }
 
+const char *get_shell_var(const char *name) {
+    return var_value(var_lookup(name));
+}
+
 char **get_shell_array(const char *name, int *len) {
-    for (struct var_entry *v = shell_vars; v; v = v->next) {
-        if (strcmp(v->name, name) == 0 && v->array) {
-            if (len) *len = v->array_len;
-            return v->array;
-        }
+    struct var_entry *v = var_lookup(name);
+    if (v && v->array) {
+        if (len) *len = v->array_len;
+        return v->array;
     }
     if (len) *len = 0;
     return NULL;
 }
 
-void set_shell_var(const char *name, const char *value) {
-    if (is_readonly(name)) {
+/*
+ * Store VALUE in NAME whose current entry is V (NULL when it does not exist
+ * yet).  Returns the entry holding the value or NULL on failure.
+ */
+static struct var_entry *var_assign(struct var_entry *v, const char *name,
+                                    const char *value)
+{
+    if (v && v->readonly) {
         fprintf(stderr, "%s: readonly variable\n", name);
-        return;
-    }
-    for (struct var_entry *v = shell_vars; v; v = v->next) {
-        if (strcmp(v->name, name) == 0) {
-            if (v->array) {
-                for (int i = 0; i < v->array_len; i++)
-                    free(v->array[i]);
-                free(v->array);
-                v->array = NULL;
-                v->array_len = 0;
-            }
-            char *dup = strdup(value ? value : "");
-            if (!dup) {
-                perror("strdup");
-                return;
-            }
-            free(v->value);
-            v->value = dup;
-            if (opt_allexport)
-                setenv(name, v->value, 1);
-            return;
-        }
+        return v;
     }
-    struct var_entry *v = malloc(sizeof(struct var_entry));
-    if (!v) { perror("malloc"); return; }
-    v->name = strdup(name);
-    if (!v->name) {
+    char *dup = strdup(value ? value : "");
+    if (!dup) {
         perror("strdup");
-        free(v);
-        return;
+        return v;
     }
-    v->value = strdup(value ? value : "");
-    if (!v->value) {
-        perror("strdup");
-        free(v->name);
-        free(v);
-        return;
+    var_record(name);
+    if (!v)
+        v = var_intern(name);
+    if (!v) {
+        free(dup);
+        return NULL;
     }
-    v->array = NULL;
-    v->array_len = 0;
-    v->next = shell_vars;
-    shell_vars = v;
+    var_clear_value(v);
+    v->value = dup;
     if (opt_allexport)
-        setenv(name, v->value, 1);
+        v->exported = 1;
+    if (v->exported)
+        env_generation++;
+    return v;
+}
+
+void set_shell_var(const char *name, const char *value) {
+    var_assign(var_lookup(name), name, value);
+}
+
+/* Return the entry SLOT refers to, resolving it again when stale. */
+static struct var_entry *slot_entry(VarSlot *slot)
+{
+    if (!slot->entry || slot->epoch != var_epoch) {
+        slot->entry = var_lookup(slot->name);
+        slot->epoch = var_epoch;
+    }
+    return slot->entry;
+}
+
+const char *get_slot_var(VarSlot *slot) {
+    return var_value(slot_entry(slot));
+}
+
+void set_slot_var(VarSlot *slot, const char *value) {
+    slot->entry = var_assign(slot_entry(slot), slot->name, value);
+    slot->epoch = var_epoch;
 }
 
 void set_shell_array(const char *name, char **values, int count) {
@@ -294,55 +563,10 @@ void set_shell_array(const char *name, char **values, int count) {
         fprintf(stderr, "%s: readonly variable\n", name);
         return;
     }
-    for (struct var_entry *v = shell_vars; v; v = v->next) {
-        if (strcmp(v->name, name) == 0) {
-            size_t alloc_count = count ? count : 1;
-            char **new_arr = xcalloc(alloc_count, sizeof(char *));
-            if (!new_arr) {
-                perror("calloc");
-                return;
-            }
-            for (int i = 0; i < count; i++) {
-                new_arr[i] = strdup(values[i]);
-                if (!new_arr[i]) {
-                    perror("strdup");
-                    for (int j = 0; j < i; j++)
-                        free(new_arr[j]);
-                    free(new_arr);
-                    return;
-                }
-            }
-
-            if (v->value) {
-                free(v->value);
-                v->value = NULL;
-            }
-            if (v->array) {
-                for (int i = 0; i < v->array_len; i++)
-                    free(v->array[i]);
-                free(v->array);
-            }
-            v->array = new_arr;
-            v->array_len = count;
-            return;
-        }
-    }
-    struct var_entry *v = xcalloc(1, sizeof(struct var_entry));
-    if (!v) { perror("malloc"); return; }
-    v->name = strdup(name);
-    if (!v->name) {
-        perror("strdup");
-        free(v);
-        return;
-    }
-    v->value = NULL;
-
     size_t alloc_count = count ? count : 1;
     char **new_arr = xcalloc(alloc_count, sizeof(char *));
     if (!new_arr) {
         perror("calloc");
-        free(v->name);
-        free(v);
         return;
     }
     for (int i = 0; i < count; i++) {
@@ -352,79 +576,170 @@ void set_shell_array(const char *name, char **values, int count) {
             for (int j = 0; j < i; j++)
                 free(new_arr[j]);
             free(new_arr);
-            free(v->name);
-            free(v);
             return;
         }
     }
-
+    var_record(name);
+    struct var_entry *v = var_intern(name);
+    if (!v) {
+        for (int i = 0; i < count; i++)
+            free(new_arr[i]);
+        free(new_arr);
+        return;
+    }
+    var_clear_value(v);
     v->array = new_arr;
     v->array_len = count;
-    v->next = shell_vars;
-    shell_vars = v;
+    if (v->exported)
+        env_generation++;
 }
 
 void unset_shell_var(const char *name) {
-    if (is_readonly(name)) {
+    struct var_entry *v = var_lookup(name);
+    if (!v)
+        return;
+    if (v->readonly) {
         fprintf(stderr, "%s: readonly variable\n", name);
         return;
     }
-    struct var_entry *prev = NULL;
-    for (struct var_entry *v = shell_vars; v; prev = v, v = v->next) {
-        if (strcmp(v->name, name) == 0) {
-            if (prev)
-                prev->next = v->next;
-            else
-                shell_vars = v->next;
-            free(v->name);
-            free(v->value);
-            if (v->array) {
-                for (int i = 0; i < v->array_len; i++)
-                    free(v->array[i]);
-                free(v->array);
-            }
-            free(v);
-            return;
-        }
-    }
+    var_record(name);
+    var_delete(v);
 }
 
 void free_shell_vars(void) {
-    struct var_entry *v = shell_vars;
-    while (v) {
-        struct var_entry *n = v->next;
+    for (size_t i = 0; i < var_cap; i++) {
+        struct var_entry *v = var_slots[i];
+        if (!v || v == VAR_TOMBSTONE)
+            continue;
+        var_clear_value(v);
         free(v->name);
-        free(v->value);
-        if (v->array) {
-            for (int i = 0; i < v->array_len; i++)
-                free(v->array[i]);
-            free(v->array);
-        }
         free(v);
-        v = n;
-    }
-    shell_vars = NULL;
-
-    struct readonly_entry *r = readonly_vars;
-    while (r) {
-        struct readonly_entry *n = r->next;
-        free(r->name);
-        free(r);
-        r = n;
     }
-    readonly_vars = NULL;
+    free(var_slots);
+    var_slots = NULL;
+    var_cap = var_count = var_filled = 0;
+    var_epoch++;
+    env_generation++;
 }
 
 int export_var(const char *name, const char *val) {
+    var_record(name);
     set_shell_var(name, val);
-    const char *v = get_shell_var(name);
-    if (setenv(name, v ? v : "", 1) != 0)
-        return -1;
-    return 0;
+    set_var_exported(name, 1);
+    return var_lookup(name) ? 0 : -1;
+}
+
+void set_var_exported(const char *name, int exported) {
+    struct var_entry *v = var_lookup(name);
+    if (v ? v->exported == !!exported : !exported)
+        return;
+    var_record(name);
+    if (!v)
+        v = var_intern(name);
+    if (!v)
+        return;
+    v->exported = !!exported;
+    env_generation++;
+}
+
+const char *get_env_var(const char *name) {
+    struct var_entry *v = var_lookup(name);
+    if (!v || !v->exported)
+        return NULL;
+    return get_shell_var(name);
 }
 
 void unset_var(const char *name) {
-    unsetenv(name);
     unset_shell_var(name);
 }
 
+void import_environment(char **envp) {
+    for (; envp && *envp; envp++) {
+        const char *eq = strchr(*envp, '=');
+        if (!eq || eq == *envp)
+            continue;
+        char *name = xstrndup(*envp, eq - *envp);
+        struct var_entry *v = var_intern(name);
+        /* running with part of the environment missing is worse than
+         * failing to start: var_intern() has reported the error */
+        if (!v)
+            exit(1);
+        if (!v->value && !v->array) {
+            v->value = xstrdup(eq + 1);
+            v->exported = 1;
+        }
+        free(name);
+    }
+    env_generation++;
+}
+
+/* Compare two NAME=value strings by name for qsort(). */
+static int cmp_env_entry(const void *a, const void *b)
+{
+    const char *ea = *(const char *const *)a;
+    const char *eb = *(const char *const *)b;
+    for (; *ea == *eb && *ea && *ea != '='; ea++, eb++)
+        ;
+    unsigned char ca = *ea == '=' ? 0 : (unsigned char)*ea;
+    unsigned char cb = *eb == '=' ? 0 : (unsigned char)*eb;
+    return ca - cb;
+}
+
+/* Return "NAME=value" for V, joining array elements with spaces. */
+static char *env_string(const struct var_entry *v)
+{
+    size_t nlen = strlen(v->name);
+    size_t len = nlen + 2;
+    if (v->value) {
+        len += strlen(v->value);
+    } else {
+        for (int i = 0; i < v->array_len; i++)
+            len += strlen(v->array[i]) + 1;
+    }
+    char *s = malloc(len);
+    if (!s)
+        return NULL;
+    char *p = s;
+    memcpy(p, v->name, nlen);
+    p += nlen;
+    *p++ = '=';
+    if (v->value) {
+        strcpy(p, v->value);
+    } else {
+        *p = '\0';
+        for (int i = 0; i < v->array_len; i++) {
+            if (i)
+                *p++ = ' ';
+            size_t l = strlen(v->array[i]);
+            memcpy(p, v->array[i], l);
+            p += l;
+            *p = '\0';
+        }
+    }
+    return s;
+}
+
+char **shell_environ(void) {
+    if (env_cache && env_built == env_generation)
+        return env_cache;
+    if (env_cache) {
+        for (char **e = env_cache; *e; e++)
+            free(*e);
+        free(env_cache);
+    }
+    env_cache = xcalloc(var_count + 1, sizeof(char *));
+    size_t n = 0;
+    for (size_t i = 0; i < var_cap; i++) {
+        struct var_entry *v = var_slots[i];
+        if (!v || v == VAR_TOMBSTONE || !v->exported ||
+            (!v->value && !v->array))
+            continue;
+        char *s = env_string(v);
+        if (s)
+            env_cache[n++] = s;
+    }
+    env_cache[n] = NULL;
+    qsort(env_cache, n, sizeof(char *), cmp_env_entry);
+    env_built = env_generation;
+    return env_cache;
+}
@@ -15,6 +15,18 @@ char **get_shell_array(const char *name, int *len);
  */
 void set_shell_var(const char *name, const char *value);
 void set_shell_array(const char *name, char **values, int count);
+/*
+ * A reference to a variable that remembers the table entry it resolved to
+ * so repeated lookups of the same name skip hashing.  Initialise NAME and
+ * leave ENTRY NULL; the binding is refreshed after any variable is removed.
+ */
+typedef struct VarSlot {
+    const char *name;
+    void *entry;
+    unsigned long epoch;
+} VarSlot;
+const char *get_slot_var(VarSlot *slot);
+void set_slot_var(VarSlot *slot, const char *value);
 void unset_shell_var(const char *name);
 void free_shell_vars(void);
 /*
@@ -29,7 +41,31 @@ void record_local_var(const char *name);
 void print_array(const char *prefix, char **arr, int len);
 void print_readonly_vars(void);
 void print_shell_vars(void);
+/* Assign VAL to NAME and give it the export attribute.  Returns 0 on
+ * success. */
 int export_var(const char *name, const char *val);
+/* Set or clear the export attribute of NAME without changing its value. */
+void set_var_exported(const char *name, int exported);
+/* Return the value of NAME when it is exported, like getenv(3) would for
+ * a child process, or NULL. */
+const char *get_env_var(const char *name);
 void unset_var(const char *name);
+/* Import NAME=value strings from ENVP as exported variables.  Names that
+ * already exist keep their value. */
+void import_environment(char **envp);
+/*
+ * Return the environment for a new process built from the exported
+ * variables.  The array is cached and rebuilt only after an exported
+ * variable changed; it remains valid until the next call.
+ */
+char **shell_environ(void);
+/*
+ * Start recording every variable change so it can be undone later.  The
+ * returned mark is passed to rollback_shell_vars() which restores values,
+ * attributes and environment entries as they were at the checkpoint.
+ * Checkpoints nest.
+ */
+void *checkpoint_shell_vars(void);
+void rollback_shell_vars(void *mark);
 
 #endif /* VARS_H */
@@ -32,8 +32,14 @@ test_dirs.expect
 test_tilde_user.expect
 test_script.expect
 test_script_args.expect
+test_script_whole.expect
+test_heredoc_memory.expect
 test_comments.expect
 test_pipe.expect
+test_pipe_builtin.expect
+test_expand_reuse.expect
+test_many_words.expect
+test_spawn.expect
 test_redir.expect
 test_source.expect
 test_fg.expect
@@ -44,12 +50,15 @@ test_kill.expect
 test_sequence.expect
 test_andor.expect
 test_glob.expect
+test_glob_native.expect
 test_status.expect
 test_badcmd.expect
 test_badcmd_noninteractive.expect
 test_empty_cmd.expect
 test_cmdsub.expect
 test_cmdsub_regress.expect
+test_cmdsub_large.expect
+test_cmdsub_inproc.expect
 test_completion.expect
 test_completion_path.expect
 test_err_redir.expect
@@ -74,6 +83,10 @@ test_for_env.expect
 test_while.expect
 test_until.expect
 test_function.expect
+test_function_redefine.expect
+test_profile.expect
+test_vushstat.expect
+test_parse_arena.expect
 test_read.expect
 test_read_eof.expect
 test_read_signal.expect
@@ -85,6 +98,7 @@ test_read_u.expect
 test_read_fdsize.expect
 test_case.expect
 test_case_posix.expect
+test_case_compiled.expect
 test_trap.expect
 test_exit_trap.expect
 test_eval.expect
@@ -124,6 +138,7 @@ test_colon.expect
 test_hash.expect
 test_hash_p.expect
 test_hash_d.expect
+test_hash_path.expect
 test_heredoc_dash.expect
 test_heredoc_tabs.expect
 test_heredoc_expand.expect
@@ -162,6 +177,7 @@ test_path_long.expect
 test_command_v_path_long.expect
 test_dquote_escape.expect
 test_ifs_split.expect
+test_ifs_cache.expect
 test_ifs_empty.expect
 test_calloc_fail.expect
 test_fc_fork_fail.expect
@@ -171,6 +187,7 @@ arithmetic_errors.expect
 arithmetic_forloop.expect
 arithmetic_overflow.expect
 arithmetic_compound.expect
+arithmetic_compiled.expect
 test_pipe_cr.expect
 test_set_o.expect
 "
@@ -23,9 +23,13 @@ test_history.expect
 test_history_clear.expect
 test_history_limit.expect
 test_history_delete.expect
+test_history_long_line.expect
+test_history_append.expect
+test_history_eof.expect
 test_lineedit.expect
 test_reverse_search.expect
 test_forward_search.expect
+test_history_rank.expect
 test_custom_histfile.expect
 test_bang_numeric.expect
 test_bang_words.expect
@@ -59,6 +63,7 @@ for test in $tests; do
         test_history_delete.expect|\
         test_bang_*|\
         test_*search.expect|\
+        test_history_rank.expect|\
         test_lineedit.expect)
             rm -f "$HOME/.vush_history"
             ;;
@@ -35,6 +35,7 @@ test_nounset.expect
 test_for_shellvar.expect
 test_assign.expect
 test_param_replace.expect
+test_param_pattern_large.expect
 test_param_substring.expect
 test_param_indirect.expect
 test_param_error.expect
@@ -45,10 +46,13 @@ test_export_n.expect
 test_export_p_listing.expect
 test_export_quote.expect
 test_export_n_unexport.expect
+test_export_update.expect
+test_env_lazy.expect
 test_export_memfail.expect
 test_readonly_p.expect
 test_set_list.expect
 test_field_split_module.expect
+test_expand_arena.expect
 test_param_expand_module.expect
 test_quote_utils_module.expect
 test_param_at_q.expect